@@ -1,24 +1,69 @@
 /* See LICENSE file for copyright and license details. */
 #include "libcoopgamma.h"
 
+#if defined(__linux__)
+# include <sys/epoll.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# if defined(__GNUC__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#   define HAVE_IO_URING
+#  endif
+# endif
+#endif
+#if defined(__GNUC__)
+# define HAVE_ATOMICS
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+# include <immintrin.h>
+# define HAVE_SIMD_SCAN
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_AVX2_TARGET
+#endif
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 
+/**
+ * The first line of a discovery cache file
+ */
+#define DISCOVERY_MAGIC "libcoopgamma discovery cache 1\n"
+
+
 #if !defined(COOPGAMMAD)
 # define COOPGAMMAD "coopgammad"
 #endif
 
 
+/**
+ * The nanoseconds part of the last modification time in a
+ * `struct stat`; `st_mtime` is a macro where POSIX.1-2008's
+ * `st_mtim` is available, and 0 is used where it is not
+ */
+#if defined(__APPLE__)
+# define ST_MTIME_NSEC(attr) ((long int)(attr).st_mtimespec.tv_nsec)
+#elif defined(st_mtime)
+# define ST_MTIME_NSEC(attr) ((long int)(attr).st_mtim.tv_nsec)
+#else
+# define ST_MTIME_NSEC(attr) 0L
+#endif
+
+
 #if defined(__clang__)
 # pragma GCC diagnostic ignored "-Wdocumentation"
 # pragma GCC diagnostic ignored "-Wcovered-switch-default"
@@ -112,22 +157,73 @@ const char *argv0 __attribute__((weak)) = "libcoopgamma";
 	  (ctx)->error.description = NULL))
 
 
+/* `allocations` is updated both by the thread that
+ * sends and by the thread that receives in thread-safe mode */
+#if defined(HAVE_ATOMICS)
+# define count_allocation(ctx)\
+	((void) __atomic_fetch_add(&(ctx)->allocations, 1, __ATOMIC_RELAXED))
+#else
+# define count_allocation(ctx)\
+	((void) ((ctx)->allocations += 1))
+#endif
+
+
 #define SYNC_CALL(send_call, recv_call, fail_return)\
 	libcoopgamma_async_context_t async;\
+	int armed__ = deadline_arm(ctx);\
+	libcoopgamma_async_context_initialise(&async);\
 	if (send_call < 0) {\
 	reflush:\
 		if (errno != EINTR)\
-			return fail_return;\
+			goto fail__;\
 		if (libcoopgamma_flush(ctx) < 0)\
 			goto reflush;\
 	}\
 	resync:\
 	if (libcoopgamma_synchronise(ctx, &async, (size_t)1, &(size_t){0}) < 0) {\
 		if (errno != EINTR && errno)\
-			return fail_return;\
+			goto fail__;\
 		goto resync;\
 	}\
-	return recv_call
+	deadline_disarm(ctx, armed__);\
+	return recv_call;\
+	fail__:\
+	deadline_disarm(ctx, armed__);\
+	return fail_return
+
+
+#define SUBMIT_CALL(request_kind, send_call)\
+	libcoopgamma_context_t *sender = ctx, scratch__;\
+	libcoopgamma_inflight_t *slot__, request__;\
+	libcoopgamma_async_context_t *async;\
+	uint32_t id__;\
+	if (ctx->threadsafe) {\
+		id__ = submission_begin(ctx, &scratch__);\
+		slot__ = &request__;\
+		sender = &scratch__;\
+	} else {\
+		id__ = ctx->message_id;\
+		slot__ = inflight_reserve(ctx, id__, NULL);\
+		if (!slot__) {\
+			copy_errno(ctx);\
+			return -1;\
+		}\
+	}\
+	async = &slot__->own;\
+	libcoopgamma_async_context_initialise(async);\
+	async->message_id = id__;\
+	slot__->async = async;\
+	slot__->cookie = user;\
+	slot__->callback = callback;\
+	slot__->kind = (request_kind);\
+	if (sender != ctx)\
+		return submission_commit(ctx, &scratch__, &request__, send_call);\
+	if (send_call < 0) {\
+		if (ctx->message_id == id__)\
+			slot__->async = NULL;\
+		return -1;\
+	}\
+	return 0
 
 
 #define INTEGRAL_DEPTHS\
@@ -235,728 +331,1206 @@ libcoopgamma_ramps_unmarshal_(void *restrict this, const void *restrict vbuf,
 }
 
 
-
+#if defined(HAVE_AVX2_TARGET)
 /**
- * Initialise a `libcoopgamma_filter_t`
+ * Check whether the CPU supports AVX2
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * The result is cached with relaxed atomic accesses, so
+ * that the function may be called from any thread; threads
+ * that race to fill the cache store the same value
+ * 
+ * @return  1 if the CPU supports AVX2, 0 otherwise
  */
-int
-libcoopgamma_filter_initialise(libcoopgamma_filter_t *restrict this)
+static int
+have_avx2(void)
 {
-	memset(this, 0, sizeof(*this));
-	return 0;
+	static int have = -1;
+	int r = __atomic_load_n(&have, __ATOMIC_RELAXED);
+	if (r < 0) {
+		__builtin_cpu_init();
+		r = !!__builtin_cpu_supports("avx2");
+		__atomic_store_n(&have, r, __ATOMIC_RELAXED);
+	}
+	return r;
 }
+#endif
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_filter_t`,
- * the allocation of the record itself is not freed
+ * Define a function, `convert_D_S`, that converts a ramp stop
+ * of one type to another when the source type is an unsigned
+ * integer type at least as wide as the destination type
  * 
- * Always call this function after failed call to `libcoopgamma_filter_initialise`
- * or failed call to `libcoopgamma_filter_unmarshal`
+ * Rounds to nearest; since `SMAX` is a multiple of `DMAX`,
+ * ties are impossible
  * 
- * @param  this  The record to destroy
+ * @param  D:identifier  The suffix of the destination type
+ * @param  S:identifier  The suffix of the source type
+ * @param  DT:type       The destination type
+ * @param  ST:type       The source type
+ * @param  DMAX          The greatest value of `DT`
+ * @param  SMAX          The greatest value of `ST`
  */
-void
-libcoopgamma_filter_destroy(libcoopgamma_filter_t *restrict this)
-{
-	free(this->crtc);
-	free(this->class);
-	free(this->ramps.u8.red);
-	memset(this, 0, sizeof(*this));
-}
+#define CONVERT_NARROW(D, S, DT, ST, DMAX, SMAX)\
+	static inline DT\
+	convert_##D##_##S(ST v)\
+	{\
+		const ST k = (ST)((SMAX) / (DMAX));\
+		return (DT)(v / k + (v % k > k / 2));\
+	}
 
+/**
+ * Define a function, `convert_D_S`, that converts a ramp stop
+ * of one unsigned integer type to a wider unsigned integer type
+ * 
+ * The result is exact: the bits of the value are repeated
+ * 
+ * @param  D:identifier  The suffix of the destination type
+ * @param  S:identifier  The suffix of the source type
+ * @param  DT:type       The destination type
+ * @param  ST:type       The source type
+ * @param  DMAX          The greatest value of `DT`
+ * @param  SMAX          The greatest value of `ST`
+ */
+#define CONVERT_WIDEN(D, S, DT, ST, DMAX, SMAX)\
+	static inline DT\
+	convert_##D##_##S(ST v)\
+	{\
+		return (DT)((DT)v * (DT)((DMAX) / (SMAX)));\
+	}
 
 /**
- * Marshal a `libcoopgamma_filter_t` into a buffer
+ * Define a function, `convert_D_S`, that converts a ramp stop
+ * of an unsigned integer type to a floating-point type, mapping
+ * [0, `SMAX`] to [0, 1]
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * @param  D:identifier  The suffix of the destination type
+ * @param  S:identifier  The suffix of the source type
+ * @param  DT:type       The destination type
+ * @param  ST:type       The source type
+ * @param  CT:type       The type to calculate in
+ * @param  SMAX          The greatest value of `ST`
  */
-size_t
-libcoopgamma_filter_marshal(const libcoopgamma_filter_t *restrict this, void *restrict vbuf)
-{
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_FILTER_VERSION);
-	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	marshal_version(LIBCOOPGAMMA_LIFESPAN_VERSION);
-	marshal_prim(this->depth, libcoopgamma_depth_t);
-	marshal_prim(this->priority, int64_t);
-	marshal_string(this->crtc);
-	marshal_string(this->class);
-	marshal_prim(this->lifespan, libcoopgamma_lifespan_t);
-	switch (this->depth) {
-	case LIBCOOPGAMMA_UINT8:  off += libcoopgamma_ramps_marshal(&this->ramps.u8,  SUBBUF); break;
-	case LIBCOOPGAMMA_UINT16: off += libcoopgamma_ramps_marshal(&this->ramps.u16, SUBBUF); break;
-	case LIBCOOPGAMMA_UINT32: off += libcoopgamma_ramps_marshal(&this->ramps.u32, SUBBUF); break;
-	case LIBCOOPGAMMA_UINT64: off += libcoopgamma_ramps_marshal(&this->ramps.u64, SUBBUF); break;
-	case LIBCOOPGAMMA_FLOAT:  off += libcoopgamma_ramps_marshal(&this->ramps.f,   SUBBUF); break;
-	case LIBCOOPGAMMA_DOUBLE: off += libcoopgamma_ramps_marshal(&this->ramps.d,   SUBBUF); break;
-	default:
-		break;
+#define CONVERT_TO_REAL(D, S, DT, ST, CT, SMAX)\
+	static inline DT\
+	convert_##D##_##S(ST v)\
+	{\
+		return (DT)((CT)v / (CT)(SMAX));\
 	}
-	MARSHAL_EPILOGUE;
-}
 
+/**
+ * Define a function, `convert_D_S`, that converts a ramp stop
+ * of a floating-point type to an unsigned integer type, mapping
+ * [0, 1] to [0, `DMAX`], rounding to nearest, and clamping values
+ * outside [0, 1], NaN is converted to 0
+ * 
+ * @param  D:identifier  The suffix of the destination type
+ * @param  S:identifier  The suffix of the source type
+ * @param  DT:type       The destination type
+ * @param  ST:type       The source type
+ * @param  CT:type       The type to calculate in
+ * @param  DMAX          The greatest value of `DT`
+ */
+#define CONVERT_FROM_REAL(D, S, DT, ST, CT, DMAX)\
+	static inline DT\
+	convert_##D##_##S(ST v)\
+	{\
+		/* Clamping after scaling, rather than before,\
+		 * lets the compiler vectorise the conversion */\
+		CT x = (CT)v * (CT)(DMAX) + (CT)0.5;\
+		x = x > 0 ? x : 0;\
+		return x < (CT)(DMAX) ? (DT)x : (DT)(DMAX);\
+	}
 
 /**
- * Unmarshal a `libcoopgamma_filter_t` from a buffer
+ * Define a function, `convert_D_S`, that converts a ramp
+ * stop to another type by plain C conversion
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param  D:identifier  The suffix of the destination type
+ * @param  S:identifier  The suffix of the source type
+ * @param  DT:type       The destination type
+ * @param  ST:type       The source type
  */
-int
-libcoopgamma_filter_unmarshal(libcoopgamma_filter_t *restrict this, const void *restrict vbuf, size_t *restrict np)
-{
-	int r = LIBCOOPGAMMA_SUCCESS;
-	size_t n = 0;
-	UNMARSHAL_PROLOGUE;
-	memset(this, 0, sizeof(*this));
-	unmarshal_version(LIBCOOPGAMMA_FILTER_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_LIFESPAN_VERSION);
-	unmarshal_prim(this->depth, libcoopgamma_depth_t);
-	unmarshal_prim(this->priority, int64_t);
-	unmarshal_string(this->crtc);
-	unmarshal_string(this->class);
-	unmarshal_prim(this->lifespan, libcoopgamma_lifespan_t);
-	switch (this->depth) {
-	case LIBCOOPGAMMA_UINT8:  r = libcoopgamma_ramps_unmarshal(&(this->ramps.u8),  NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT16: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u16), NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT32: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u32), NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT64: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u64), NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_FLOAT:  r = libcoopgamma_ramps_unmarshal(&(this->ramps.f),   NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_DOUBLE: r = libcoopgamma_ramps_unmarshal(&(this->ramps.d),   NNSUBBUF, &n); break;
-	default:
-		break;
+#define CONVERT_CAST(D, S, DT, ST)\
+	static inline DT\
+	convert_##D##_##S(ST v)\
+	{\
+		return (DT)v;\
 	}
-	if (r != LIBCOOPGAMMA_SUCCESS)
-		return r;
-	off += n;
-	UNMARSHAL_EPILOGUE;
-}
 
+CONVERT_CAST(8, 8, uint8_t, uint8_t)
+CONVERT_WIDEN(16, 8, uint16_t, uint8_t, UINT16_MAX, UINT8_MAX)
+CONVERT_WIDEN(32, 8, uint32_t, uint8_t, UINT32_MAX, UINT8_MAX)
+CONVERT_WIDEN(64, 8, uint64_t, uint8_t, UINT64_MAX, UINT8_MAX)
+CONVERT_TO_REAL(f, 8, float, uint8_t, float, UINT8_MAX)
+CONVERT_TO_REAL(d, 8, double, uint8_t, double, UINT8_MAX)
+
+CONVERT_NARROW(8, 16, uint8_t, uint16_t, UINT8_MAX, UINT16_MAX)
+CONVERT_CAST(16, 16, uint16_t, uint16_t)
+CONVERT_WIDEN(32, 16, uint32_t, uint16_t, UINT32_MAX, UINT16_MAX)
+CONVERT_WIDEN(64, 16, uint64_t, uint16_t, UINT64_MAX, UINT16_MAX)
+CONVERT_TO_REAL(f, 16, float, uint16_t, float, UINT16_MAX)
+CONVERT_TO_REAL(d, 16, double, uint16_t, double, UINT16_MAX)
+
+CONVERT_NARROW(8, 32, uint8_t, uint32_t, UINT8_MAX, UINT32_MAX)
+CONVERT_NARROW(16, 32, uint16_t, uint32_t, UINT16_MAX, UINT32_MAX)
+CONVERT_CAST(32, 32, uint32_t, uint32_t)
+CONVERT_WIDEN(64, 32, uint64_t, uint32_t, UINT64_MAX, UINT32_MAX)
+CONVERT_TO_REAL(f, 32, float, uint32_t, double, UINT32_MAX)
+CONVERT_TO_REAL(d, 32, double, uint32_t, double, UINT32_MAX)
+
+CONVERT_NARROW(8, 64, uint8_t, uint64_t, UINT8_MAX, UINT64_MAX)
+CONVERT_NARROW(16, 64, uint16_t, uint64_t, UINT16_MAX, UINT64_MAX)
+CONVERT_NARROW(32, 64, uint32_t, uint64_t, UINT32_MAX, UINT64_MAX)
+CONVERT_CAST(64, 64, uint64_t, uint64_t)
+CONVERT_TO_REAL(f, 64, float, uint64_t, double, UINT64_MAX)
+CONVERT_TO_REAL(d, 64, double, uint64_t, double, UINT64_MAX)
+
+CONVERT_FROM_REAL(8, f, uint8_t, float, float, UINT8_MAX)
+CONVERT_FROM_REAL(16, f, uint16_t, float, float, UINT16_MAX)
+CONVERT_FROM_REAL(32, f, uint32_t, float, double, UINT32_MAX)
+CONVERT_FROM_REAL(64, f, uint64_t, float, double, UINT64_MAX)
+CONVERT_CAST(f, f, float, float)
+CONVERT_CAST(d, f, double, float)
+
+CONVERT_FROM_REAL(8, d, uint8_t, double, double, UINT8_MAX)
+CONVERT_FROM_REAL(16, d, uint16_t, double, double, UINT16_MAX)
+CONVERT_FROM_REAL(32, d, uint32_t, double, double, UINT32_MAX)
+CONVERT_FROM_REAL(64, d, uint64_t, double, double, UINT64_MAX)
+CONVERT_CAST(f, d, float, double)
+CONVERT_CAST(d, d, double, double)
+
+
+#if defined(__GNUC__)
+# define UNALIGNED __attribute__((__aligned__(1)))
+#else
+# define UNALIGNED
+#endif
 
 
 /**
- * Initialise a `libcoopgamma_crtc_info_t`
+ * The number of ramp stops converted per iteration of the
+ * outer loop of a conversion kernel; the inner loop has a
+ * fixed trip count so that the compiler vectorises it
+ */
+#define CONVERT_BLOCK 32
+
+/**
+ * Define a function, `NAME`, that converts an array of ramp
+ * stops using `convert_D_S`
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * The source need not be aligned, as it may be a
+ * payload in `libcoopgamma_context_t.inbound`
+ * 
+ * @param  NAME:identifier  The name of the function
+ * @param  D:identifier     The suffix of the destination type
+ * @param  S:identifier     The suffix of the source type
+ * @param  DT:type          The destination type
+ * @param  ST:type          The source type
  */
-int
-libcoopgamma_crtc_info_initialise(libcoopgamma_crtc_info_t *restrict this)
-{
-	memset(this, 0, sizeof(*this));
-	return 0;
-}
+#define CONVERT_KERNEL(NAME, D, S, DT, ST)\
+	static void\
+	NAME(void *restrict vdst, const void *restrict vsrc, size_t n)\
+	{\
+		typedef ST UNALIGNED NAME##_src_t;\
+		DT *restrict dst = vdst;\
+		const NAME##_src_t *restrict src = vsrc;\
+		size_t i, j;\
+		for (i = 0; n - i >= CONVERT_BLOCK; i += CONVERT_BLOCK)\
+			for (j = 0; j < CONVERT_BLOCK; j++)\
+				dst[i + j] = convert_##D##_##S(src[i + j]);\
+		for (; i < n; i++)\
+			dst[i] = convert_##D##_##S(src[i]);\
+	}
 
+#if defined(HAVE_AVX2_TARGET)
+# define CONVERT_KERNELS(D, S, DT, ST)\
+	CONVERT_KERNEL(convert_kernel_##D##_##S, D, S, DT, ST)\
+	__attribute__((__target__("avx2")))\
+	CONVERT_KERNEL(convert_kernel_##D##_##S##_avx2, D, S, DT, ST)
+#else
+# define CONVERT_KERNELS(D, S, DT, ST)\
+	CONVERT_KERNEL(convert_kernel_##D##_##S, D, S, DT, ST)
+#endif
 
 /**
- * Release all resources allocated to  a `libcoopgamma_crtc_info_t`,
- * the allocation of the record itself is not freed
+ * Define the conversion kernels with a specific source type
  * 
- * Always call this function after failed call to `libcoopgamma_crtc_info_initialise`
- * or failed call to `libcoopgamma_crtc_info_unmarshal`
+ * @param  S:identifier  The suffix of the source type
+ * @param  ST:type       The source type
+ */
+#define CONVERT_KERNELS_FROM(S, ST)\
+	CONVERT_KERNELS(8, S, uint8_t, ST)\
+	CONVERT_KERNELS(16, S, uint16_t, ST)\
+	CONVERT_KERNELS(32, S, uint32_t, ST)\
+	CONVERT_KERNELS(64, S, uint64_t, ST)\
+	CONVERT_KERNELS(f, S, float, ST)\
+	CONVERT_KERNELS(d, S, double, ST)
+
+CONVERT_KERNELS_FROM(8, uint8_t)
+CONVERT_KERNELS_FROM(16, uint16_t)
+CONVERT_KERNELS_FROM(32, uint32_t)
+CONVERT_KERNELS_FROM(64, uint64_t)
+CONVERT_KERNELS_FROM(f, float)
+CONVERT_KERNELS_FROM(d, double)
+
+/**
+ * The conversion kernels with a specific destination
+ * type, indexed by the source type as by `depth_index`
  * 
- * @param  this  The record to destroy
+ * @param  D:identifier   The suffix of the destination type
+ * @param  SFX:token-seq  The suffix of the kernels' names
  */
-void
-libcoopgamma_crtc_info_destroy(libcoopgamma_crtc_info_t *restrict this)
-{
-	(void) this;
-}
+#define CONVERT_KERNEL_ROW(D, SFX)\
+	{convert_kernel_##D##_8##SFX, convert_kernel_##D##_16##SFX, convert_kernel_##D##_32##SFX,\
+	 convert_kernel_##D##_64##SFX, convert_kernel_##D##_f##SFX, convert_kernel_##D##_d##SFX}
 
+/**
+ * Conversion kernels, indexed by the destination
+ * type and the source type, as by `depth_index`
+ */
+static void (*const convert_kernels[6][6])(void *restrict, const void *restrict, size_t) = {
+	CONVERT_KERNEL_ROW(8,), CONVERT_KERNEL_ROW(16,), CONVERT_KERNEL_ROW(32,),
+	CONVERT_KERNEL_ROW(64,), CONVERT_KERNEL_ROW(f,), CONVERT_KERNEL_ROW(d,)
+};
 
+#if defined(HAVE_AVX2_TARGET)
 /**
- * Marshal a `libcoopgamma_crtc_info_t` into a buffer
+ * Like `convert_kernels`, but using AVX2
+ */
+static void (*const convert_kernels_avx2[6][6])(void *restrict, const void *restrict, size_t) = {
+	CONVERT_KERNEL_ROW(8, _avx2), CONVERT_KERNEL_ROW(16, _avx2), CONVERT_KERNEL_ROW(32, _avx2),
+	CONVERT_KERNEL_ROW(64, _avx2), CONVERT_KERNEL_ROW(f, _avx2), CONVERT_KERNEL_ROW(d, _avx2)
+};
+#endif
+
+
+/**
+ * Get the index of a ramp stop type in `convert_kernels`
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   width  Output parameter for the size of a ramp stop
+ * @return         The index, -1 if `depth` is invalid
  */
-size_t
-libcoopgamma_crtc_info_marshal(const libcoopgamma_crtc_info_t *restrict this, void *restrict vbuf)
+static int
+depth_index(libcoopgamma_depth_t depth, size_t *restrict width)
 {
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_CRTC_INFO_VERSION);
-	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	marshal_version(LIBCOOPGAMMA_SUPPORT_VERSION);
-	marshal_version(LIBCOOPGAMMA_COLOURSPACE_VERSION);
-	marshal_prim(this->cooperative, int);
-	marshal_prim(this->depth, libcoopgamma_depth_t);
-	marshal_prim(this->red_size, size_t);
-	marshal_prim(this->green_size, size_t);
-	marshal_prim(this->blue_size, size_t);
-	marshal_prim(this->supported, libcoopgamma_support_t);
-	marshal_prim(this->colourspace, libcoopgamma_colourspace_t);
-	marshal_prim(this->have_gamut, int);
-	marshal_prim(this->red_x, unsigned);
-	marshal_prim(this->red_y, unsigned);
-	marshal_prim(this->green_x, unsigned);
-	marshal_prim(this->green_y, unsigned);
-	marshal_prim(this->blue_x, unsigned);
-	marshal_prim(this->blue_y, unsigned);
-	marshal_prim(this->white_x, unsigned);
-	marshal_prim(this->white_y, unsigned);
-	MARSHAL_EPILOGUE;
+	switch (depth) {
+	case LIBCOOPGAMMA_UINT8:  *width = sizeof(uint8_t);  return 0;
+	case LIBCOOPGAMMA_UINT16: *width = sizeof(uint16_t); return 1;
+	case LIBCOOPGAMMA_UINT32: *width = sizeof(uint32_t); return 2;
+	case LIBCOOPGAMMA_UINT64: *width = sizeof(uint64_t); return 3;
+	case LIBCOOPGAMMA_FLOAT:  *width = sizeof(float);    return 4;
+	case LIBCOOPGAMMA_DOUBLE: *width = sizeof(double);   return 5;
+	default:
+		return -1;
+	}
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_crtc_info_t` from a buffer
+ * Convert an array of ramp stops to another type
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param  dst        The output array
+ * @param  dst_depth  The type of the stops in `dst`, must be valid
+ * @param  src        The input array, need not be aligned
+ * @param  src_depth  The type of the stops in `src`, must be valid
+ * @param  n          The number of stops
  */
-int
-libcoopgamma_crtc_info_unmarshal(libcoopgamma_crtc_info_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+static void
+convert_stops(void *restrict dst, libcoopgamma_depth_t dst_depth,
+              const void *restrict src, libcoopgamma_depth_t src_depth, size_t n)
 {
-	UNMARSHAL_PROLOGUE;
-	unmarshal_version(LIBCOOPGAMMA_CRTC_INFO_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_SUPPORT_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_COLOURSPACE_VERSION);
-	unmarshal_prim(this->cooperative, int);
-	unmarshal_prim(this->depth, libcoopgamma_depth_t);
-	unmarshal_prim(this->red_size, size_t);
-	unmarshal_prim(this->green_size, size_t);
-	unmarshal_prim(this->blue_size, size_t);
-	unmarshal_prim(this->supported, libcoopgamma_support_t);
-	unmarshal_prim(this->colourspace, libcoopgamma_colourspace_t);
-	unmarshal_prim(this->have_gamut, int);
-	unmarshal_prim(this->red_x, unsigned);
-	unmarshal_prim(this->red_y, unsigned);
-	unmarshal_prim(this->green_x, unsigned);
-	unmarshal_prim(this->green_y, unsigned);
-	unmarshal_prim(this->blue_x, unsigned);
-	unmarshal_prim(this->blue_y, unsigned);
-	unmarshal_prim(this->white_x, unsigned);
-	unmarshal_prim(this->white_y, unsigned);
-	UNMARSHAL_EPILOGUE;
+	size_t dw, sw;
+	int di = depth_index(dst_depth, &dw);
+	int si = depth_index(src_depth, &sw);
+#if defined(HAVE_AVX2_TARGET)
+	if (have_avx2()) {
+		convert_kernels_avx2[di][si](dst, src, n);
+		return;
+	}
+#endif
+	convert_kernels[di][si](dst, src, n);
 }
 
 
-
 /**
- * Initialise a `libcoopgamma_filter_query_t`
+ * Convert gamma ramps from one type of ramp stops to another
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * @param   dst        The output ramps, must already be initialised
+ *                     with the same number of stops as `src` in each ramp
+ * @param   dst_depth  The data type and bit-depth of the ramp stops in `dst`
+ * @param   src        The input ramps
+ * @param   src_depth  The data type and bit-depth of the ramp stops in `src`
+ * @return             Zero on success, -1 on error
  */
 int
-libcoopgamma_filter_query_initialise(libcoopgamma_filter_query_t *restrict this)
+libcoopgamma_ramps_convert(void *restrict dst, libcoopgamma_depth_t dst_depth,
+                           const void *restrict src, libcoopgamma_depth_t src_depth)
 {
-	this->crtc = NULL;
-	this->coalesce = 0;
-	this->high_priority = INT64_MAX;
-	this->low_priority = INT64_MIN;
+	libcoopgamma_ramps8_t *restrict dst8 = dst;
+	const libcoopgamma_ramps8_t *restrict src8 = src;
+	size_t dw, sw;
+
+	if (depth_index(dst_depth, &dw) < 0 || depth_index(src_depth, &sw) < 0 ||
+	    dst8->red_size != src8->red_size ||
+	    dst8->green_size != src8->green_size ||
+	    dst8->blue_size != src8->blue_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dst8->green == dst8->red   + dst8->red_size   * dw &&
+	    dst8->blue  == dst8->green + dst8->green_size * dw &&
+	    src8->green == src8->red   + src8->red_size   * sw &&
+	    src8->blue  == src8->green + src8->green_size * sw) {
+		convert_stops(dst8->red, dst_depth, src8->red, src_depth,
+		              dst8->red_size + dst8->green_size + dst8->blue_size);
+	} else {
+		convert_stops(dst8->red, dst_depth, src8->red, src_depth, dst8->red_size);
+		convert_stops(dst8->green, dst_depth, src8->green, src_depth, dst8->green_size);
+		convert_stops(dst8->blue, dst_depth, src8->blue, src_depth, dst8->blue_size);
+	}
 	return 0;
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_filter_query_t`,
- * the allocation of the record itself is not freed
- * 
- * Always call this function after failed call to `libcoopgamma_filter_query_initialise`
- * or failed call to `libcoopgamma_filter_query_unmarshal`
+ * Select one of two values depending on the sign of
+ * a third value, with bitwise operations rather than
+ * with a branch or a comparison, which the compiler
+ * may turn into a branch that stops a loop from
+ * being vectorised
  * 
- * @param  this  The record to destroy
+ * @param   s    The value whose sign bit shall be tested
+ * @param   neg  The value to return if the sign bit of `s` is set
+ * @param   pos  The value to return if the sign bit of `s` is cleared
+ * @return       `neg` or `pos`
  */
-void
-libcoopgamma_filter_query_destroy(libcoopgamma_filter_query_t *restrict this)
+static inline double
+select_by_sign(double s, double neg, double pos)
 {
-	free(this->crtc);
-	this->crtc = NULL;
+	uint64_t sbits, nbits, pbits, mask;
+	memcpy(&sbits, &s, sizeof(sbits));
+	memcpy(&nbits, &neg, sizeof(nbits));
+	memcpy(&pbits, &pos, sizeof(pbits));
+	mask = 0 - (sbits >> 63);
+	pbits = (nbits & mask) | (pbits & ~mask);
+	memcpy(&pos, &pbits, sizeof(pos));
+	return pos;
 }
 
 
 /**
- * Marshal a `libcoopgamma_filter_query_t` into a buffer
+ * Calculate an approximation of the binary logarithm of a
+ * number, without calling `log2`, so that it can be vectorised
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * The absolute error is less than 10^-14
+ * 
+ * @param   x  The number, must be positive, finite, and normal
+ *             for the result to be meaningful, but the result
+ *             is finite for any value but NaN
+ * @return     The binary logarithm of `x`
  */
-size_t
-libcoopgamma_filter_query_marshal(const libcoopgamma_filter_query_t *restrict this, void* restrict vbuf)
+static inline double
+approx_log2(double x)
 {
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_FILTER_QUERY_VERSION);
-	marshal_string(this->crtc);
-	marshal_prim(this->coalesce, int);
-	marshal_prim(this->high_priority, int64_t);
-	marshal_prim(this->low_priority, int64_t);
-	MARSHAL_EPILOGUE;
+	uint64_t bits, ebits;
+	double e, m, s, s2, r;
+
+	/* Split `x` into 2^e m, where m is in [sqrt(1/2), sqrt(2)), without
+	 * branches; the exponent is taken from `x` after moving
+	 * the bits of sqrt(1/2) to those of 1, so that it is rounded */
+	memcpy(&bits, &x, sizeof(bits));
+	ebits = (bits + (UINT64_C(0x3FF0000000000000) - UINT64_C(0x3FE6A09E667F3BCD))) >> 52;
+	bits -= (ebits << 52) - UINT64_C(0x3FF0000000000000);
+	memcpy(&m, &bits, sizeof(m));
+
+	/* Get the exponent as a double without an int64_t-to-double
+	 * conversion, which cannot be vectorised on most CPUs */
+	ebits |= UINT64_C(0x4330000000000000);
+	memcpy(&e, &ebits, sizeof(e));
+	e -= 0x1p52 + 1023;
+
+	/* log2(m) = 2 artanh((m - 1) / (m + 1)) / ln 2, where |s| < 0.1716 */
+	s = (m - 1) / (m + 1);
+	s2 = s * s;
+	r = 1. / 15;
+	r = r * s2 + 1. / 13;
+	r = r * s2 + 1. / 11;
+	r = r * s2 + 1. / 9;
+	r = r * s2 + 1. / 7;
+	r = r * s2 + 1. / 5;
+	r = r * s2 + 1. / 3;
+	r = r * s2 + 1;
+	return e + s * r * 2.8853900817779268;
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_filter_query_t` from a buffer
+ * Calculate an approximation of two raised to a power,
+ * without calling `exp2`, so that it can be vectorised
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * The relative error is less than 10^-14
+ * 
+ * @param   y  The power, results below 2^-1022 are
+ *             rounded up to 2^-1022, and results above
+ *             2^1023 are rounded down to 2^1023
+ * @return     2 raised to the power of `y`
  */
-int
-libcoopgamma_filter_query_unmarshal(libcoopgamma_filter_query_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+static inline double
+approx_exp2(double y)
 {
-	UNMARSHAL_PROLOGUE;
-	this->crtc = NULL;
-	unmarshal_version(LIBCOOPGAMMA_FILTER_QUERY_VERSION);
-	unmarshal_string(this->crtc);
-	unmarshal_prim(this->coalesce, int);
-	unmarshal_prim(this->high_priority, int64_t);
-	unmarshal_prim(this->low_priority, int64_t);
-	UNMARSHAL_EPILOGUE;
+	uint64_t bits;
+	double t, n, f, r;
+
+	y = select_by_sign(y + 1022, -1022, y);
+	y = select_by_sign(1023 - y, 1023, y);
+
+	/* Round to nearest integer, the integer is
+	 * stored in the low bits of `t` */
+	t = y + 0x1.8p52;
+	n = t - 0x1.8p52;
+
+	/* 2^f = e^(f ln 2), where |f ln 2| < 0.3466 */
+	f = (y - n) * 0.69314718055994531;
+	r = 1. / 39916800;
+	r = r * f + 1. / 3628800;
+	r = r * f + 1. / 362880;
+	r = r * f + 1. / 40320;
+	r = r * f + 1. / 5040;
+	r = r * f + 1. / 720;
+	r = r * f + 1. / 120;
+	r = r * f + 1. / 24;
+	r = r * f + 1. / 6;
+	r = r * f + 1. / 2;
+	r = r * f + 1;
+	r = r * f + 1;
+
+	memcpy(&bits, &t, sizeof(bits));
+	bits = (bits + 1023) << 52;
+	memcpy(&t, &bits, sizeof(t));
+	return r * t;
 }
 
 
-
 /**
- * Initialise a `libcoopgamma_queried_filter_t`
+ * Calculate an approximation of a number raised to a power,
+ * without calling `pow`, so that it can be vectorised
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * @param   x  The number
+ * @param   y  The power
+ * @return     `x` raised to the power of `y`, 0 if `x` is not positive
  */
-int
-libcoopgamma_queried_filter_initialise(libcoopgamma_queried_filter_t *restrict this)
+static inline double
+approx_pow(double x, double y)
 {
-	memset(this, 0, sizeof(*this));
-	return 0;
+	uint64_t xbits, rbits;
+	double r = approx_exp2(approx_log2(x) * y);
+	memcpy(&xbits, &x, sizeof(xbits));
+	memcpy(&rbits, &r, sizeof(rbits));
+	/* The top bit of `-xbits & ~xbits` is set iff the sign bit of
+	 * `x` is cleared and `x` is not +0, that is, iff `x` is positive;
+	 * see `select_by_sign` for why this is not a comparison */
+	rbits &= 0 - (((0 - xbits) & ~xbits) >> 63);
+	memcpy(&r, &rbits, sizeof(r));
+	return r;
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_queried_filter_t`,
- * the allocation of the record itself is not freed
- * 
- * Always call this function after failed call to `libcoopgamma_queried_filter_initialise`
- * or failed call to `libcoopgamma_queried_filter_unmarshal`
- * 
- * @param  this  The record to destroy
+ * Operations that can be applied to the stops of gamma ramps,
+ * each operation takes two parameters, `p[0]` and `p[1]`
  */
-void
-libcoopgamma_queried_filter_destroy(libcoopgamma_queried_filter_t *restrict this)
-{
-	free(this->class);
-	this->class = NULL;
-	libcoopgamma_ramps_destroy(&this->ramps.u8);
-}
+enum ramp_op {
+	/**
+	 * Set each stop to its position in the ramp, mapped
+	 * to [0, 1]; `p[0]` is 1 divided by the number of stops
+	 * less one, and `p[1]` is the index of the first stop
+	 */
+	RAMP_OP_IDENTITY,
+
+	/**
+	 * Multiply each stop by `p[0]` and add `p[1]`
+	 */
+	RAMP_OP_AFFINE,
+
+	/**
+	 * Raise each stop to the power of `p[0]`, zero
+	 * and negative stops are set to zero; `p[1]` is 0
+	 */
+	RAMP_OP_POWER
+};
 
 
 /**
- * Marshal a `libcoopgamma_queried_filter_t` into a buffer
+ * The number of ramp stops `apply_ramp_op` processes
+ * at a time when the ramps are not `double`
+ */
+#define RAMP_BLOCK 256
+
+/**
+ * Define a function, `NAME`, that implements an operation in
+ * `enum ramp_op`; it takes the stops, the number of stops, and
+ * the parameters of the operation
  * 
- * @param   this   The record to marshal
- * @param   vbuf   The output buffer, `NULL` to only measure
- *                 how large this buffer has to be
- * @param   depth  The type used of ramp stops
- * @return         The number of marshalled bytes, or if `buf == NULL`,
- *                 how many bytes would be marshalled if `buf != NULL`
+ * @param  NAME:identifier  The name of the function
+ * @param  ATTR:token-seq   Attributes for the function
+ * @param  EXPR             The new value of the stop `x[k]`,
+ *                          using the parameters `p`
  */
-size_t
-libcoopgamma_queried_filter_marshal(const libcoopgamma_queried_filter_t *restrict this,
-                                    void *restrict vbuf, libcoopgamma_depth_t depth)
-{
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_QUERIED_FILTER_VERSION);
-	marshal_prim(this->priority, int64_t);
-	marshal_string(this->class);
-	switch (depth) {
-	case LIBCOOPGAMMA_UINT8:  off += libcoopgamma_ramps_marshal(&this->ramps.u8,  SUBBUF); break;
-	case LIBCOOPGAMMA_UINT16: off += libcoopgamma_ramps_marshal(&this->ramps.u16, SUBBUF); break;
-	case LIBCOOPGAMMA_UINT32: off += libcoopgamma_ramps_marshal(&this->ramps.u32, SUBBUF); break;
-	case LIBCOOPGAMMA_UINT64: off += libcoopgamma_ramps_marshal(&this->ramps.u64, SUBBUF); break;
-	case LIBCOOPGAMMA_FLOAT:  off += libcoopgamma_ramps_marshal(&this->ramps.f,   SUBBUF); break;
-	case LIBCOOPGAMMA_DOUBLE: off += libcoopgamma_ramps_marshal(&this->ramps.d,   SUBBUF); break;
-	default:
-		break;
+#define RAMP_OP_KERNEL(NAME, ATTR, EXPR)\
+	ATTR static void\
+	NAME(double *restrict x, size_t n, const double *restrict p)\
+	{\
+		size_t i, j, k;\
+		for (i = 0; n - i >= CONVERT_BLOCK; i += CONVERT_BLOCK) {\
+			for (j = 0; j < CONVERT_BLOCK; j++) {\
+				k = i + j;\
+				x[k] = (EXPR);\
+			}\
+		}\
+		for (k = i; k < n; k++)\
+			x[k] = (EXPR);\
 	}
-	MARSHAL_EPILOGUE;
-}
 
+/**
+ * Define the functions that implement `enum ramp_op`
+ * 
+ * @param  SFX:token-seq   The suffix of the functions' names
+ * @param  ATTR:token-seq  Attributes for the functions
+ */
+#define RAMP_OPS(SFX, ATTR)\
+	RAMP_OP_KERNEL(ramp_op_identity##SFX, ATTR, ((double)(int)k + p[1]) * p[0])\
+	RAMP_OP_KERNEL(ramp_op_affine##SFX, ATTR, x[k] * p[0] + p[1])\
+	RAMP_OP_KERNEL(ramp_op_power##SFX, ATTR, approx_pow(x[k], p[0]))
+
+RAMP_OPS(,)
 
 /**
- * Unmarshal a `libcoopgamma_queried_filter_t` from a buffer
+ * The functions that implement `enum ramp_op`,
+ * indexed by the operation
+ */
+static void (*const ramp_ops[])(double *restrict, size_t, const double *restrict) = {
+	ramp_op_identity, ramp_op_affine, ramp_op_power
+};
+
+#if defined(HAVE_AVX2_TARGET)
+RAMP_OPS(_avx2, __attribute__((__target__("avx2"))))
+
+/**
+ * Like `ramp_ops`, but using AVX2
+ */
+static void (*const ramp_ops_avx2[])(double *restrict, size_t, const double *restrict) = {
+	ramp_op_identity_avx2, ramp_op_affine_avx2, ramp_op_power_avx2
+};
+#endif
+
+
+/**
+ * Apply an operation to each of the ramps in a gamma ramp triplet
  * 
- * @param   this   The output parameter for unmarshalled record
- * @param   vbuf   The buffer with the marshalled record
- * @param   np     Output parameter for the number of unmarshalled bytes, undefined on failure
- * @param   depth  The type used of ramp stops
- * @return         `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                 `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * The stops are processed in blocks that are converted to `double`,
+ * processed, and converted back, unless they already are `double`;
+ * so the operation is vectorised for all types, and integer stops
+ * are clamped to the range of their type
+ * 
+ * @param   ramps   The gamma ramps, `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`,
+ *                  `libcoopgamma_ramps32_t`, `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`,
+ *                  or `libcoopgamma_rampsd_t`
+ * @param   depth   The data type and bit-depth of the ramp stops
+ * @param   op      The operation
+ * @param   params  The parameters of the operation for each ramp; for
+ *                  operations other than `RAMP_OP_IDENTITY`, ramps whose
+ *                  parameters are `{1, 0}` are skipped
+ * @return          Zero on success, -1 on error
  */
-int libcoopgamma_queried_filter_unmarshal(libcoopgamma_queried_filter_t *restrict this, const void *restrict vbuf,
-                                          size_t *restrict np, libcoopgamma_depth_t depth)
+static int
+apply_ramp_op(void *restrict ramps, libcoopgamma_depth_t depth, enum ramp_op op, const double params[3][2])
 {
-	int r = LIBCOOPGAMMA_SUCCESS;
-	size_t n = 0;
-	UNMARSHAL_PROLOGUE;
-	memset(this, 0, sizeof(*this));
-	unmarshal_version(LIBCOOPGAMMA_QUERIED_FILTER_VERSION);
-	unmarshal_prim(this->priority, int64_t);
-	unmarshal_string(this->class);
-	switch (depth) {
-	case LIBCOOPGAMMA_UINT8:  r = libcoopgamma_ramps_unmarshal(&this->ramps.u8,  NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT16: r = libcoopgamma_ramps_unmarshal(&this->ramps.u16, NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT32: r = libcoopgamma_ramps_unmarshal(&this->ramps.u32, NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_UINT64: r = libcoopgamma_ramps_unmarshal(&this->ramps.u64, NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_FLOAT:  r = libcoopgamma_ramps_unmarshal(&this->ramps.f,   NNSUBBUF, &n); break;
-	case LIBCOOPGAMMA_DOUBLE: r = libcoopgamma_ramps_unmarshal(&this->ramps.d,   NNSUBBUF, &n); break;
-	default:
-		break;
+	libcoopgamma_ramps8_t *restrict ramps8 = ramps;
+	void (*fun)(double *restrict, size_t, const double *restrict) = ramp_ops[op];
+	double buf[RAMP_BLOCK], p[2];
+	char *stops[3];
+	size_t sizes[3], width, i, n;
+	int c;
+
+	if (depth_index(depth, &width) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+#if defined(HAVE_AVX2_TARGET)
+	if (have_avx2())
+		fun = ramp_ops_avx2[op];
+#endif
+
+	stops[0] = (char *)ramps8->red;
+	stops[1] = (char *)ramps8->green;
+	stops[2] = (char *)ramps8->blue;
+	sizes[0] = ramps8->red_size;
+	sizes[1] = ramps8->green_size;
+	sizes[2] = ramps8->blue_size;
+
+	for (c = 0; c < 3; c++) {
+		p[0] = params[c][0];
+		p[1] = params[c][1];
+		if (op == RAMP_OP_IDENTITY)
+			p[0] = sizes[c] > 1 ? 1 / (double)(sizes[c] - 1) : 0;
+		else if (p[0] == 1 && p[1] == 0)
+			continue;
+		for (i = 0; i < sizes[c]; i += n) {
+			n = sizes[c] - i < RAMP_BLOCK ? sizes[c] - i : RAMP_BLOCK;
+			if (op == RAMP_OP_IDENTITY)
+				p[1] = (double)i;
+			if (depth == LIBCOOPGAMMA_DOUBLE) {
+				fun((double *)(void *)stops[c] + i, n, p);
+			} else {
+				if (op != RAMP_OP_IDENTITY)
+					convert_stops(buf, LIBCOOPGAMMA_DOUBLE, &stops[c][i * width], depth, n);
+				fun(buf, n, p);
+				convert_stops(&stops[c][i * width], depth, buf, LIBCOOPGAMMA_DOUBLE, n);
+			}
+		}
 	}
-	if (r != LIBCOOPGAMMA_SUCCESS)
-		return r;
-	off += n;
-	UNMARSHAL_EPILOGUE;
-}
 
+	return 0;
+}
 
 
 /**
- * Initialise a `libcoopgamma_filter_table_t`
+ * Set gamma ramps to the identity mapping, that is, each
+ * stop is set to its position in its ramp; this is the
+ * starting point for the other ramp generators
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * @param   ramps  The gamma ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @return         Zero on success, -1 on error
  */
 int
-libcoopgamma_filter_table_initialise(libcoopgamma_filter_table_t *restrict this)
+libcoopgamma_ramps_identity(void *restrict ramps, libcoopgamma_depth_t depth)
 {
-	memset(this, 0, sizeof(*this));
-	return 0;
+	static const double params[3][2] = {{0, 0}, {0, 0}, {0, 0}};
+	return apply_ramp_op(ramps, depth, RAMP_OP_IDENTITY, params);
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_filter_table_t`,
- * the allocation of the record itself is not freed
- * 
- * Always call this function after failed call to `libcoopgamma_filter_table_initialise`
- * or failed call to `libcoopgamma_filter_table_unmarshal`
+ * Apply gamma correction to gamma ramps, each stop
+ * is raised to the power of the reciprocal of the
+ * gamma of its ramp
  * 
- * @param  this  The record to destroy
+ * @param   ramps  The gamma ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The gamma for the red ramp, must be positive
+ * @param   green  The gamma for the green ramp, must be positive
+ * @param   blue   The gamma for the blue ramp, must be positive
+ * @return         Zero on success, -1 on error
  */
-void
-libcoopgamma_filter_table_destroy(libcoopgamma_filter_table_t *restrict this)
+int
+libcoopgamma_ramps_gamma(void *restrict ramps, libcoopgamma_depth_t depth, double red, double green, double blue)
 {
-	while (this->filter_count)
-		libcoopgamma_queried_filter_destroy(this->filters + --this->filter_count);
-	free(this->filters);
-	this->filters = NULL;
+	double params[3][2] = {{1 / red, 0}, {1 / green, 0}, {1 / blue, 0}};
+	if (!(red > 0) || !(green > 0) || !(blue > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return apply_ramp_op(ramps, depth, RAMP_OP_POWER, params);
 }
 
 
 /**
- * Marshal a `libcoopgamma_filter_table_t` into a buffer
+ * Adjust the brightness of gamma ramps, each
+ * stop is multiplied by the brightness of its ramp
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * @param   ramps  The gamma ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The brightness for the red ramp
+ * @param   green  The brightness for the green ramp
+ * @param   blue   The brightness for the blue ramp
+ * @return         Zero on success, -1 on error
  */
-size_t
-libcoopgamma_filter_table_marshal(const libcoopgamma_filter_table_t *restrict this, void *restrict vbuf)
+int
+libcoopgamma_ramps_brightness(void *restrict ramps, libcoopgamma_depth_t depth, double red, double green, double blue)
 {
-	size_t i;
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_FILTER_TABLE_VERSION);
-	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	marshal_prim(this->depth, libcoopgamma_depth_t);
-	marshal_prim(this->red_size, size_t);
-	marshal_prim(this->green_size, size_t);
-	marshal_prim(this->blue_size, size_t);
-	marshal_prim(this->filter_count, size_t);
-	for (i = 0; i < this->filter_count; i++)
-		off += libcoopgamma_queried_filter_marshal(&this->filters[i], SUBBUF, this->depth);
-	MARSHAL_EPILOGUE;
+	double params[3][2] = {{red, 0}, {green, 0}, {blue, 0}};
+	return apply_ramp_op(ramps, depth, RAMP_OP_AFFINE, params);
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_filter_table_t` from a buffer
+ * Adjust the contrast of gamma ramps, the distance
+ * between each stop and 1/2 is multiplied by the
+ * contrast of its ramp
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param   ramps  The gamma ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The contrast for the red ramp
+ * @param   green  The contrast for the green ramp
+ * @param   blue   The contrast for the blue ramp
+ * @return         Zero on success, -1 on error
  */
 int
-libcoopgamma_filter_table_unmarshal(libcoopgamma_filter_table_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+libcoopgamma_ramps_contrast(void *restrict ramps, libcoopgamma_depth_t depth, double red, double green, double blue)
 {
-	size_t i, n, fn;
-	int r;
-	UNMARSHAL_PROLOGUE;
-	this->filter_count = 0;
-	this->filters = NULL;
-	unmarshal_version(LIBCOOPGAMMA_FILTER_TABLE_VERSION);
-	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
-	unmarshal_prim(this->depth, libcoopgamma_depth_t);
-	unmarshal_prim(this->red_size, size_t);
-	unmarshal_prim(this->green_size, size_t);
-	unmarshal_prim(this->blue_size, size_t);
-	unmarshal_prim(fn, size_t);
-	this->filters = malloc(fn * sizeof(*this->filters));
-	if (!this->filters)
-		return LIBCOOPGAMMA_ERRNO_SET;
-	for (i = 0; i < fn; i++) {
-		r = libcoopgamma_queried_filter_unmarshal(&this->filters[i], NNSUBBUF, &n, this->depth);
-		if (r != LIBCOOPGAMMA_SUCCESS)
-			return r;
-		off += n;
-		this->filter_count += 1;
-	}
-	UNMARSHAL_EPILOGUE;
+	double params[3][2] = {{red, (1 - red) / 2}, {green, (1 - green) / 2}, {blue, (1 - blue) / 2}};
+	return apply_ramp_op(ramps, depth, RAMP_OP_AFFINE, params);
 }
 
 
-
 /**
- * Initialise a `libcoopgamma_error_t`
+ * Limit the output range of gamma ramps, [0, 1] is
+ * mapped to [minimum, maximum] in each ramp
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * @param   ramps      The gamma ramps
+ * @param   depth      The data type and bit-depth of the ramp stops
+ * @param   red_min    The value 0 shall have in the red ramp
+ * @param   red_max    The value 1 shall have in the red ramp
+ * @param   green_min  The value 0 shall have in the green ramp
+ * @param   green_max  The value 1 shall have in the green ramp
+ * @param   blue_min   The value 0 shall have in the blue ramp
+ * @param   blue_max   The value 1 shall have in the blue ramp
+ * @return             Zero on success, -1 on error
  */
 int
-libcoopgamma_error_initialise(libcoopgamma_error_t *restrict this)
+libcoopgamma_ramps_limits(void *restrict ramps, libcoopgamma_depth_t depth, double red_min, double red_max,
+                          double green_min, double green_max, double blue_min, double blue_max)
 {
-	this->number = 0;
-	this->custom = 0;
-	this->description = NULL;
-	return 0;
+	double params[3][2] = {{red_max - red_min, red_min},
+	                       {green_max - green_min, green_min},
+	                       {blue_max - blue_min, blue_min}};
+	return apply_ramp_op(ramps, depth, RAMP_OP_AFFINE, params);
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_error_t`,
- * the allocation of the record itself is not freed
+ * Invert gamma ramps, each stop is subtracted from 1
  * 
- * Always call this function after failed call to `libcoopgamma_error_initialise`
- * or failed call to `libcoopgamma_error_unmarshal`
- * 
- * @param  this  The record to destroy
+ * @param   ramps  The gamma ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    Whether to invert the red ramp
+ * @param   green  Whether to invert the green ramp
+ * @param   blue   Whether to invert the blue ramp
+ * @return         Zero on success, -1 on error
  */
-void
-libcoopgamma_error_destroy(libcoopgamma_error_t *restrict this)
+int
+libcoopgamma_ramps_negative(void *restrict ramps, libcoopgamma_depth_t depth, int red, int green, int blue)
 {
-	free(this->description);
-	this->description = NULL;
+	double params[3][2] = {{red ? -1 : 1, !!red}, {green ? -1 : 1, !!green}, {blue ? -1 : 1, !!blue}};
+	return apply_ramp_op(ramps, depth, RAMP_OP_AFFINE, params);
 }
 
 
 /**
- * Marshal a `libcoopgamma_error_t` into a buffer
+ * Calculate the colour of a black body, using
+ * Tanner Helland's approximation of the CIE 1964
+ * 10-degree colour matching functions
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * @param  kelvin  The temperature, in kelvins, [1000, 40000]
+ * @param  rgb     Output parameter for the red, green, and blue
+ *                 values, not normalised, and not clamped
  */
-size_t
-libcoopgamma_error_marshal(const libcoopgamma_error_t *restrict this, void *restrict vbuf)
+static void
+blackbody(double kelvin, double rgb[3])
 {
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_ERROR_VERSION);
-	marshal_prim(this->number, uint64_t);
-	marshal_prim(this->custom, int);
-	marshal_prim(this->server_side, int);
-	marshal_string(this->description);
-	MARSHAL_EPILOGUE;
+	double t = kelvin / 100;
+	const double ln2 = 0.69314718055994531;
+	if (t <= 66) {
+		rgb[0] = 255;
+		rgb[1] = 99.4708025861 * approx_log2(t) * ln2 - 161.1195681661;
+	} else {
+		rgb[0] = 329.698727446 * approx_exp2(approx_log2(t - 60) * -0.1332047592);
+		rgb[1] = 288.1221695283 * approx_exp2(approx_log2(t - 60) * -0.0755148492);
+	}
+	if (t >= 66)
+		rgb[2] = 255;
+	else if (t <= 19)
+		rgb[2] = 0;
+	else
+		rgb[2] = 138.5177312231 * approx_log2(t - 10) * ln2 - 305.0447927307;
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_error_t` from a buffer
+ * Adjust the white point of gamma ramps to the colour of
+ * a black body, normalised so that 6500 K does not change
+ * the ramps, and scaled so that no ramp is amplified
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param   ramps   The gamma ramps
+ * @param   depth   The data type and bit-depth of the ramp stops
+ * @param   kelvin  The temperature, in kelvins, values outside
+ *                  [1000, 40000] are clamped to that range
+ * @return          Zero on success, -1 on error
  */
 int
-libcoopgamma_error_unmarshal(libcoopgamma_error_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+libcoopgamma_ramps_temperature(void *restrict ramps, libcoopgamma_depth_t depth, double kelvin)
 {
-	UNMARSHAL_PROLOGUE;
-	this->description = NULL;
-	unmarshal_version(LIBCOOPGAMMA_ERROR_VERSION);
-	unmarshal_prim(this->number, uint64_t);
-	unmarshal_prim(this->custom, int);
-	unmarshal_prim(this->server_side, int);
-	unmarshal_string(this->description);
-	UNMARSHAL_EPILOGUE;
+	double params[3][2], rgb[3], d65[3], max;
+	int c;
+
+	if (kelvin != kelvin) {
+		errno = EINVAL;
+		return -1;
+	}
+	kelvin = kelvin > 1000 ? kelvin : 1000;
+	kelvin = kelvin < 40000 ? kelvin : 40000;
+
+	blackbody(kelvin, rgb);
+	blackbody(6500, d65);
+	for (max = 0, c = 0; c < 3; c++) {
+		rgb[c] = rgb[c] > 0 ? rgb[c] / d65[c] : 0;
+		max = rgb[c] > max ? rgb[c] : max;
+	}
+	for (c = 0; c < 3; c++) {
+		params[c][0] = rgb[c] / max;
+		params[c][1] = 0;
+	}
+
+	return apply_ramp_op(ramps, depth, RAMP_OP_AFFINE, params);
 }
 
 
+/**
+ * The maximum number of weight tables
+ * a `libcoopgamma_resampler_t` caches
+ */
+#define RESAMPLER_CACHE_SIZE 8
+
 
 /**
- * Initialise a `libcoopgamma_context_t`
+ * Define the functions that interpolate output stops from the
+ * input stops `y`, and for `LIBCOOPGAMMA_MONOTONE_CUBIC` their
+ * slopes `m`, using the `index` and `weights` (each array `w`
+ * apart) of a `libcoopgamma_resample_table_t`
  * 
- * @param   this  The record to initialise
- * @return        Zero on success, -1 on error
+ * @param  SFX:token-seq   The suffix of the functions' names
+ * @param  ATTR:token-seq  Attributes for the functions
+ */
+#define RESAMPLE_KERNELS(SFX, ATTR)\
+	ATTR static void\
+	resample_linear##SFX(double *restrict x, size_t n, const double *restrict y, const double *restrict m,\
+	                     const size_t *restrict index, const double *restrict weights, size_t w)\
+	{\
+		size_t i, j, k;\
+		(void) m;\
+		for (i = 0; n - i >= CONVERT_BLOCK; i += CONVERT_BLOCK) {\
+			for (j = 0; j < CONVERT_BLOCK; j++) {\
+				k = i + j;\
+				x[k] = weights[k] * y[index[k]] + weights[w + k] * y[index[k] + 1];\
+			}\
+		}\
+		for (k = i; k < n; k++)\
+			x[k] = weights[k] * y[index[k]] + weights[w + k] * y[index[k] + 1];\
+	}\
+	\
+	ATTR static void\
+	resample_cubic##SFX(double *restrict x, size_t n, const double *restrict y, const double *restrict m,\
+	                    const size_t *restrict index, const double *restrict weights, size_t w)\
+	{\
+		size_t i, j, k;\
+		for (i = 0; n - i >= CONVERT_BLOCK; i += CONVERT_BLOCK) {\
+			for (j = 0; j < CONVERT_BLOCK; j++) {\
+				k = i + j;\
+				x[k] = weights[k] * y[index[k]] + weights[w + k] * y[index[k] + 1] +\
+				       weights[2 * w + k] * m[index[k]] + weights[3 * w + k] * m[index[k] + 1];\
+			}\
+		}\
+		for (k = i; k < n; k++)\
+			x[k] = weights[k] * y[index[k]] + weights[w + k] * y[index[k] + 1] +\
+			       weights[2 * w + k] * m[index[k]] + weights[3 * w + k] * m[index[k] + 1];\
+	}
+
+RESAMPLE_KERNELS(,)
+
+#if defined(HAVE_AVX2_TARGET)
+RESAMPLE_KERNELS(_avx2, __attribute__((__target__("avx2"))))
+#endif
+
+
+/**
+ * Initialise a `libcoopgamma_resampler_t`
+ * 
+ * @param   this    The record to initialise
+ * @param   method  The method of interpolation
+ * @return          Zero on success, -1 on error
  */
 int
-libcoopgamma_context_initialise(libcoopgamma_context_t *restrict this)
+libcoopgamma_resampler_initialise(libcoopgamma_resampler_t *restrict this, libcoopgamma_interpolation_t method)
 {
 	memset(this, 0, sizeof(*this));
-	this->fd = -1;
-	this->blocking = 1;
+	if (method != LIBCOOPGAMMA_LINEAR && method != LIBCOOPGAMMA_MONOTONE_CUBIC) {
+		errno = EINVAL;
+		return -1;
+	}
+	this->method = method;
 	return 0;
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_context_t`,
+ * Release all resources allocated to a `libcoopgamma_resampler_t`,
  * the allocation of the record itself is not freed
  * 
- * Always call this function after failed call to `libcoopgamma_context_initialise`
- * or failed call to `libcoopgamma_context_unmarshal`
- * 
- * @param  this        The record to destroy
- * @param  disconnect  Disconnect from the server?
+ * @param  this  The record to destroy
  */
 void
-libcoopgamma_context_destroy(libcoopgamma_context_t *restrict this, int disconnect)
+libcoopgamma_resampler_destroy(libcoopgamma_resampler_t *restrict this)
 {
-	if (disconnect && this->fd >= 0) {
-		shutdown(this->fd, SHUT_RDWR);
-		close(this->fd);
+	size_t i;
+	for (i = 0; i < this->table_count; i++) {
+		free(this->tables[i].index);
+		free(this->tables[i].weights);
 	}
-	this->fd = -1;
-	libcoopgamma_error_destroy(&this->error);
-	free(this->outbound);
-	free(this->inbound);
-	this->outbound = NULL;
-	this->inbound = NULL;
+	free(this->tables);
+	free(this->buffer);
+	memset(this, 0, sizeof(*this));
 }
 
 
 /**
- * Marshal a `libcoopgamma_context_t` into a buffer
+ * Get the weight table for resampling a ramp from
+ * one size to another, from the cache of a resampler
+ * or by creating it
  * 
- * @param   this  The record to marshal
- * @param   vbuf  The output buffer, `NULL` to only measure
- *                how large this buffer has to be
- * @return        The number of marshalled bytes, or if `buf == NULL`,
- *                how many bytes would be marshalled if `buf != NULL`
+ * @param   this      The resampler
+ * @param   src_size  The number of stops in the input ramp, positive
+ * @param   dst_size  The number of stops in the output ramp, positive
+ * @return            The table, `NULL` on error
  */
-size_t
-libcoopgamma_context_marshal(const libcoopgamma_context_t *restrict this, void *restrict vbuf)
+static const libcoopgamma_resample_table_t *
+get_resample_table(libcoopgamma_resampler_t *restrict this, size_t src_size, size_t dst_size)
 {
-	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_CONTEXT_VERSION);
-	marshal_prim(this->fd, int);
-	off += libcoopgamma_error_marshal(&this->error, SUBBUF);
-	marshal_prim(this->message_id, uint32_t);
-	marshal_prim(this->outbound_head - this->outbound_tail, size_t);
-	marshal_buffer(this->outbound + this->outbound_tail, this->outbound_head - this->outbound_tail);
-	marshal_prim(this->inbound_head - this->inbound_tail, size_t);
-	marshal_buffer(this->inbound + this->inbound_tail, this->inbound_head - this->inbound_tail);
-	marshal_prim(this->length, size_t);
-	marshal_prim(this->curline, size_t);
-	marshal_prim(this->in_response_to, uint32_t);
-	marshal_prim(this->have_all_headers, int);
-	marshal_prim(this->bad_message, int);
-	marshal_prim(this->blocking, int);
-	MARSHAL_EPILOGUE;
+	libcoopgamma_resample_table_t table, *old;
+	size_t i, j, nweights = this->method == LIBCOOPGAMMA_MONOTONE_CUBIC ? 4 : 2;
+	double x, t, scale;
+
+	for (i = 0; i < this->table_count; i++) {
+		if (this->tables[i].src_size == src_size && this->tables[i].dst_size == dst_size) {
+			table = this->tables[i];
+			memmove(&this->tables[1], &this->tables[0], i * sizeof(*this->tables));
+			this->tables[0] = table;
+			return &this->tables[0];
+		}
+	}
+
+	if (!this->tables) {
+		this->tables = malloc(RESAMPLER_CACHE_SIZE * sizeof(*this->tables));
+		if (!this->tables)
+			return NULL;
+	}
+
+	table.src_size = src_size;
+	table.dst_size = dst_size;
+	if (dst_size > SIZE_MAX / nweights / sizeof(double)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	table.index = malloc(dst_size * sizeof(*table.index));
+	table.weights = malloc(dst_size * nweights * sizeof(*table.weights));
+	if (!table.index || !table.weights) {
+		free(table.index);
+		free(table.weights);
+		return NULL;
+	}
+
+	/* The input ramp is extended with a copy of its last
+	 * stop, so stop `index + 1` exists even at the end */
+	scale = dst_size > 1 ? (double)(src_size - 1) / (double)(dst_size - 1) : 0;
+	for (i = 0; i < dst_size; i++) {
+		x = (double)i * scale;
+		j = (size_t)x;
+		j = j < src_size - 1 ? j : src_size - 1;
+		t = x - (double)j;
+		table.index[i] = j;
+		if (nweights == 2) {
+			table.weights[i] = 1 - t;
+			table.weights[dst_size + i] = t;
+		} else {
+			table.weights[i] = (2 * t - 3) * t * t + 1;
+			table.weights[dst_size + i] = (3 - 2 * t) * t * t;
+			table.weights[2 * dst_size + i] = ((t - 2) * t + 1) * t;
+			table.weights[3 * dst_size + i] = (t - 1) * t * t;
+		}
+	}
+
+	if (this->table_count == RESAMPLER_CACHE_SIZE) {
+		old = &this->tables[--this->table_count];
+		free(old->index);
+		free(old->weights);
+	}
+	memmove(&this->tables[1], &this->tables[0], this->table_count++ * sizeof(*this->tables));
+	this->tables[0] = table;
+	return &this->tables[0];
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_context_t` from a buffer
+ * Calculate the slopes at the stops of a ramp for monotone
+ * cubic Hermite interpolation, using the harmonic mean of
+ * the slopes of the adjacent segments, as in PCHIP, so that
+ * the interpolation never overshoots
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   vbuf  The buffer with the marshalled record
- * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param  m  Output parameter for the slopes, `n + 1` elements
+ * @param  y  The stops, `n + 1` elements, where the last is
+ *            a copy of the one before it
+ * @param  n  The number of stops, positive
+ */
+static void
+monotone_slopes(double *restrict m, const double *restrict y, size_t n)
+{
+	double d0, d1;
+	size_t i;
+
+	m[0] = y[1] - y[0];
+	m[n] = 0;
+	if (n == 1)
+		return;
+	m[n - 1] = y[n - 1] - y[n - 2];
+	for (i = 1; i < n - 1; i++) {
+		d0 = y[i] - y[i - 1];
+		d1 = y[i + 1] - y[i];
+		m[i] = d0 * d1 > 0 ? 2 * d0 * d1 / (d0 + d1) : 0;
+	}
+}
+
+
+/**
+ * Resample gamma ramps to other sizes, for example to the sizes
+ * reported in a `libcoopgamma_crtc_info_t`, and convert them to
+ * another type of ramp stops
+ * 
+ * @param   resampler  The resampler
+ * @param   dst        The output ramps, must already be initialised
+ * @param   dst_depth  The data type and bit-depth of the ramp stops in `dst`
+ * @param   src        The input ramps
+ * @param   src_depth  The data type and bit-depth of the ramp stops in `src`
+ * @return             Zero on success, -1 on error
  */
 int
-libcoopgamma_context_unmarshal(libcoopgamma_context_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+libcoopgamma_ramps_resample(libcoopgamma_resampler_t *restrict resampler, void *restrict dst,
+                            libcoopgamma_depth_t dst_depth, const void *restrict src,
+                            libcoopgamma_depth_t src_depth)
 {
-	size_t n;
-	int r;
-	UNMARSHAL_PROLOGUE;
-	memset(this, 0, sizeof(*this));
-	unmarshal_version(LIBCOOPGAMMA_CONTEXT_VERSION);
-	unmarshal_prim(this->fd, int);
-	r = libcoopgamma_error_unmarshal(&this->error, NNSUBBUF, &n);
-	if (r != LIBCOOPGAMMA_SUCCESS)
-		return r;
-	off += n;
-	unmarshal_prim(this->message_id, uint32_t);
-	unmarshal_prim(this->outbound_head, size_t);
-	this->outbound_size = this->outbound_head;
-	unmarshal_buffer(this->outbound, this->outbound_head);
-	unmarshal_prim(this->inbound_head, size_t);
-	this->inbound_size = this->inbound_head;
-	unmarshal_buffer(this->inbound, this->inbound_head);
-	unmarshal_prim(this->length, size_t);
-	unmarshal_prim(this->curline, size_t);
-	unmarshal_prim(this->in_response_to, uint32_t);
-	unmarshal_prim(this->have_all_headers, int);
-	unmarshal_prim(this->bad_message, int);
-	unmarshal_prim(this->blocking, int);
-	UNMARSHAL_EPILOGUE;
+	libcoopgamma_ramps8_t *restrict dst8 = dst;
+	const libcoopgamma_ramps8_t *restrict src8 = src;
+	void (*fun)(double *restrict, size_t, const double *restrict, const double *restrict,
+	            const size_t *restrict, const double *restrict, size_t);
+	const libcoopgamma_resample_table_t *table;
+	char *dst_stops[3];
+	const char *src_stops[3];
+	size_t dst_sizes[3], src_sizes[3], dw, sw, need, i, n;
+	double *y, *m, *x, *new;
+	int c;
+
+	if (depth_index(dst_depth, &dw) < 0 || depth_index(src_depth, &sw) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fun = resampler->method == LIBCOOPGAMMA_MONOTONE_CUBIC ? resample_cubic : resample_linear;
+#if defined(HAVE_AVX2_TARGET)
+	if (have_avx2())
+		fun = resampler->method == LIBCOOPGAMMA_MONOTONE_CUBIC ? resample_cubic_avx2 : resample_linear_avx2;
+#endif
+
+	dst_stops[0] = (char *)dst8->red;
+	dst_stops[1] = (char *)dst8->green;
+	dst_stops[2] = (char *)dst8->blue;
+	src_stops[0] = (const char *)src8->red;
+	src_stops[1] = (const char *)src8->green;
+	src_stops[2] = (const char *)src8->blue;
+	dst_sizes[0] = dst8->red_size;
+	dst_sizes[1] = dst8->green_size;
+	dst_sizes[2] = dst8->blue_size;
+	src_sizes[0] = src8->red_size;
+	src_sizes[1] = src8->green_size;
+	src_sizes[2] = src8->blue_size;
+
+	for (c = 0; c < 3; c++) {
+		if (!dst_sizes[c])
+			continue;
+		if (!src_sizes[c]) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		need = 2 * (src_sizes[c] + 1) + RAMP_BLOCK;
+		if (src_sizes[c] > (SIZE_MAX / sizeof(double) - RAMP_BLOCK) / 2 - 1) {
+			errno = ENOMEM;
+			return -1;
+		}
+		if (resampler->buffer_size < need) {
+			new = realloc(resampler->buffer, need * sizeof(*new));
+			if (!new)
+				return -1;
+			resampler->buffer = new;
+			resampler->buffer_size = need;
+		}
+		y = resampler->buffer;
+		m = &y[src_sizes[c] + 1];
+		x = &m[src_sizes[c] + 1];
+
+		table = get_resample_table(resampler, src_sizes[c], dst_sizes[c]);
+		if (!table)
+			return -1;
+
+		convert_stops(y, LIBCOOPGAMMA_DOUBLE, src_stops[c], src_depth, src_sizes[c]);
+		y[src_sizes[c]] = y[src_sizes[c] - 1];
+		if (resampler->method == LIBCOOPGAMMA_MONOTONE_CUBIC)
+			monotone_slopes(m, y, src_sizes[c]);
+
+		for (i = 0; i < dst_sizes[c]; i += n) {
+			n = dst_sizes[c] - i < RAMP_BLOCK ? dst_sizes[c] - i : RAMP_BLOCK;
+			if (dst_depth == LIBCOOPGAMMA_DOUBLE) {
+				fun((double *)(void *)dst_stops[c] + i, n, y, m,
+				    &table->index[i], &table->weights[i], dst_sizes[c]);
+			} else {
+				fun(x, n, y, m, &table->index[i], &table->weights[i], dst_sizes[c]);
+				convert_stops(&dst_stops[c][i * dw], dst_depth, x, LIBCOOPGAMMA_DOUBLE, n);
+			}
+		}
+	}
+
+	return 0;
 }
 
 
 
 /**
- * Initialise a `libcoopgamma_async_context_t`
+ * Initialise a `libcoopgamma_filter_t`
  * 
  * @param   this  The record to initialise
  * @return        Zero on success, -1 on error
  */
 int
-libcoopgamma_async_context_initialise(libcoopgamma_async_context_t *restrict this)
+libcoopgamma_filter_initialise(libcoopgamma_filter_t *restrict this)
 {
-	this->message_id = 0;
-	this->coalesce = 0;
+	memset(this, 0, sizeof(*this));
 	return 0;
 }
 
 
 /**
- * Release all resources allocated to  a `libcoopgamma_async_context_t`,
+ * Release all resources allocated to  a `libcoopgamma_filter_t`,
  * the allocation of the record itself is not freed
  * 
- * Always call this function after failed call to `libcoopgamma_async_context_initialise`
- * or failed call to `libcoopgamma_async_context_unmarshal`
+ * Always call this function after failed call to `libcoopgamma_filter_initialise`
+ * or failed call to `libcoopgamma_filter_unmarshal`
  * 
  * @param  this  The record to destroy
  */
 void
-libcoopgamma_async_context_destroy(libcoopgamma_async_context_t *restrict this)
+libcoopgamma_filter_destroy(libcoopgamma_filter_t *restrict this)
 {
-	(void) this;
+	free(this->crtc);
+	free(this->class);
+	free(this->ramps.u8.red);
+	memset(this, 0, sizeof(*this));
 }
 
 
 /**
- * Marshal a `libcoopgamma_async_context_t` into a buffer
+ * Marshal a `libcoopgamma_filter_t` into a buffer
  * 
  * @param   this  The record to marshal
  * @param   vbuf  The output buffer, `NULL` to only measure
@@ -965,18 +1539,33 @@ libcoopgamma_async_context_destroy(libcoopgamma_async_context_t *restrict this)
  *                how many bytes would be marshalled if `buf != NULL`
  */
 size_t
-libcoopgamma_async_context_marshal(const libcoopgamma_async_context_t *restrict this, void *restrict vbuf)
+libcoopgamma_filter_marshal(const libcoopgamma_filter_t *restrict this, void *restrict vbuf)
 {
 	MARSHAL_PROLOGUE;
-	marshal_version(LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION);
-	marshal_prim(this->message_id, uint32_t);
-	marshal_prim(this->coalesce, int);
+	marshal_version(LIBCOOPGAMMA_FILTER_VERSION);
+	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	marshal_version(LIBCOOPGAMMA_LIFESPAN_VERSION);
+	marshal_prim(this->depth, libcoopgamma_depth_t);
+	marshal_prim(this->priority, int64_t);
+	marshal_string(this->crtc);
+	marshal_string(this->class);
+	marshal_prim(this->lifespan, libcoopgamma_lifespan_t);
+	switch (this->depth) {
+	case LIBCOOPGAMMA_UINT8:  off += libcoopgamma_ramps_marshal(&this->ramps.u8,  SUBBUF); break;
+	case LIBCOOPGAMMA_UINT16: off += libcoopgamma_ramps_marshal(&this->ramps.u16, SUBBUF); break;
+	case LIBCOOPGAMMA_UINT32: off += libcoopgamma_ramps_marshal(&this->ramps.u32, SUBBUF); break;
+	case LIBCOOPGAMMA_UINT64: off += libcoopgamma_ramps_marshal(&this->ramps.u64, SUBBUF); break;
+	case LIBCOOPGAMMA_FLOAT:  off += libcoopgamma_ramps_marshal(&this->ramps.f,   SUBBUF); break;
+	case LIBCOOPGAMMA_DOUBLE: off += libcoopgamma_ramps_marshal(&this->ramps.d,   SUBBUF); break;
+	default:
+		break;
+	}
 	MARSHAL_EPILOGUE;
 }
 
 
 /**
- * Unmarshal a `libcoopgamma_async_context_t` from a buffer
+ * Unmarshal a `libcoopgamma_filter_t` from a buffer
  * 
  * @param   this  The output parameter for unmarshalled record
  * @param   vbuf  The buffer with the marshalled record
@@ -985,738 +1574,5122 @@ libcoopgamma_async_context_marshal(const libcoopgamma_async_context_t *restrict
  *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
  */
 int
-libcoopgamma_async_context_unmarshal(libcoopgamma_async_context_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+libcoopgamma_filter_unmarshal(libcoopgamma_filter_t *restrict this, const void *restrict vbuf, size_t *restrict np)
 {
+	int r = LIBCOOPGAMMA_SUCCESS;
+	size_t n = 0;
 	UNMARSHAL_PROLOGUE;
-	unmarshal_version(LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION);
-	unmarshal_prim(this->message_id, uint32_t);
-	unmarshal_prim(this->coalesce, int);
+	memset(this, 0, sizeof(*this));
+	unmarshal_version(LIBCOOPGAMMA_FILTER_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_LIFESPAN_VERSION);
+	unmarshal_prim(this->depth, libcoopgamma_depth_t);
+	unmarshal_prim(this->priority, int64_t);
+	unmarshal_string(this->crtc);
+	unmarshal_string(this->class);
+	unmarshal_prim(this->lifespan, libcoopgamma_lifespan_t);
+	switch (this->depth) {
+	case LIBCOOPGAMMA_UINT8:  r = libcoopgamma_ramps_unmarshal(&(this->ramps.u8),  NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT16: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u16), NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT32: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u32), NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT64: r = libcoopgamma_ramps_unmarshal(&(this->ramps.u64), NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_FLOAT:  r = libcoopgamma_ramps_unmarshal(&(this->ramps.f),   NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_DOUBLE: r = libcoopgamma_ramps_unmarshal(&(this->ramps.d),   NNSUBBUF, &n); break;
+	default:
+		break;
+	}
+	if (r != LIBCOOPGAMMA_SUCCESS)
+		return r;
+	off += n;
 	UNMARSHAL_EPILOGUE;
 }
 
 
 
 /**
- * List all recognised adjustment method
- * 
- * SIGCHLD must not be ignored or blocked
+ * Initialise a `libcoopgamma_crtc_info_t`
  * 
- * @return  A `NULL`-terminated list of names. You should only free
- *          the outer pointer, inner pointers are subpointers of the
- *          outer pointer and cannot be freed. `NULL` on error.
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
  */
-char **
-libcoopgamma_get_methods(void)
+int
+libcoopgamma_crtc_info_initialise(libcoopgamma_crtc_info_t *restrict this)
 {
-	char num[5]; /* The size is base on the fact that we have limited `n` in the loop below */
-	char **methods = NULL;
+	memset(this, 0, sizeof(*this));
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_crtc_info_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_crtc_info_initialise`
+ * or failed call to `libcoopgamma_crtc_info_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_crtc_info_destroy(libcoopgamma_crtc_info_t *restrict this)
+{
+	(void) this;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_crtc_info_t` into a buffer
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_crtc_info_marshal(const libcoopgamma_crtc_info_t *restrict this, void *restrict vbuf)
+{
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_CRTC_INFO_VERSION);
+	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	marshal_version(LIBCOOPGAMMA_SUPPORT_VERSION);
+	marshal_version(LIBCOOPGAMMA_COLOURSPACE_VERSION);
+	marshal_prim(this->cooperative, int);
+	marshal_prim(this->depth, libcoopgamma_depth_t);
+	marshal_prim(this->red_size, size_t);
+	marshal_prim(this->green_size, size_t);
+	marshal_prim(this->blue_size, size_t);
+	marshal_prim(this->supported, libcoopgamma_support_t);
+	marshal_prim(this->colourspace, libcoopgamma_colourspace_t);
+	marshal_prim(this->have_gamut, int);
+	marshal_prim(this->red_x, unsigned);
+	marshal_prim(this->red_y, unsigned);
+	marshal_prim(this->green_x, unsigned);
+	marshal_prim(this->green_y, unsigned);
+	marshal_prim(this->blue_x, unsigned);
+	marshal_prim(this->blue_y, unsigned);
+	marshal_prim(this->white_x, unsigned);
+	marshal_prim(this->white_y, unsigned);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_crtc_info_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_crtc_info_unmarshal(libcoopgamma_crtc_info_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	UNMARSHAL_PROLOGUE;
+	unmarshal_version(LIBCOOPGAMMA_CRTC_INFO_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_SUPPORT_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_COLOURSPACE_VERSION);
+	unmarshal_prim(this->cooperative, int);
+	unmarshal_prim(this->depth, libcoopgamma_depth_t);
+	unmarshal_prim(this->red_size, size_t);
+	unmarshal_prim(this->green_size, size_t);
+	unmarshal_prim(this->blue_size, size_t);
+	unmarshal_prim(this->supported, libcoopgamma_support_t);
+	unmarshal_prim(this->colourspace, libcoopgamma_colourspace_t);
+	unmarshal_prim(this->have_gamut, int);
+	unmarshal_prim(this->red_x, unsigned);
+	unmarshal_prim(this->red_y, unsigned);
+	unmarshal_prim(this->green_x, unsigned);
+	unmarshal_prim(this->green_y, unsigned);
+	unmarshal_prim(this->blue_x, unsigned);
+	unmarshal_prim(this->blue_y, unsigned);
+	unmarshal_prim(this->white_x, unsigned);
+	unmarshal_prim(this->white_y, unsigned);
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Initialise a `libcoopgamma_filter_query_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_filter_query_initialise(libcoopgamma_filter_query_t *restrict this)
+{
+	this->crtc = NULL;
+	this->coalesce = 0;
+	this->high_priority = INT64_MAX;
+	this->low_priority = INT64_MIN;
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_filter_query_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_filter_query_initialise`
+ * or failed call to `libcoopgamma_filter_query_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_filter_query_destroy(libcoopgamma_filter_query_t *restrict this)
+{
+	free(this->crtc);
+	this->crtc = NULL;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_filter_query_t` into a buffer
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_filter_query_marshal(const libcoopgamma_filter_query_t *restrict this, void* restrict vbuf)
+{
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_FILTER_QUERY_VERSION);
+	marshal_string(this->crtc);
+	marshal_prim(this->coalesce, int);
+	marshal_prim(this->high_priority, int64_t);
+	marshal_prim(this->low_priority, int64_t);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_filter_query_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_filter_query_unmarshal(libcoopgamma_filter_query_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	UNMARSHAL_PROLOGUE;
+	this->crtc = NULL;
+	unmarshal_version(LIBCOOPGAMMA_FILTER_QUERY_VERSION);
+	unmarshal_string(this->crtc);
+	unmarshal_prim(this->coalesce, int);
+	unmarshal_prim(this->high_priority, int64_t);
+	unmarshal_prim(this->low_priority, int64_t);
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Initialise a `libcoopgamma_queried_filter_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_queried_filter_initialise(libcoopgamma_queried_filter_t *restrict this)
+{
+	memset(this, 0, sizeof(*this));
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_queried_filter_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_queried_filter_initialise`
+ * or failed call to `libcoopgamma_queried_filter_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_queried_filter_destroy(libcoopgamma_queried_filter_t *restrict this)
+{
+	free(this->class);
+	this->class = NULL;
+	libcoopgamma_ramps_destroy(&this->ramps.u8);
+}
+
+
+/**
+ * Marshal a `libcoopgamma_queried_filter_t` into a buffer
+ * 
+ * @param   this   The record to marshal
+ * @param   vbuf   The output buffer, `NULL` to only measure
+ *                 how large this buffer has to be
+ * @param   depth  The type used of ramp stops
+ * @return         The number of marshalled bytes, or if `buf == NULL`,
+ *                 how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_queried_filter_marshal(const libcoopgamma_queried_filter_t *restrict this,
+                                    void *restrict vbuf, libcoopgamma_depth_t depth)
+{
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_QUERIED_FILTER_VERSION);
+	marshal_prim(this->priority, int64_t);
+	marshal_string(this->class);
+	switch (depth) {
+	case LIBCOOPGAMMA_UINT8:  off += libcoopgamma_ramps_marshal(&this->ramps.u8,  SUBBUF); break;
+	case LIBCOOPGAMMA_UINT16: off += libcoopgamma_ramps_marshal(&this->ramps.u16, SUBBUF); break;
+	case LIBCOOPGAMMA_UINT32: off += libcoopgamma_ramps_marshal(&this->ramps.u32, SUBBUF); break;
+	case LIBCOOPGAMMA_UINT64: off += libcoopgamma_ramps_marshal(&this->ramps.u64, SUBBUF); break;
+	case LIBCOOPGAMMA_FLOAT:  off += libcoopgamma_ramps_marshal(&this->ramps.f,   SUBBUF); break;
+	case LIBCOOPGAMMA_DOUBLE: off += libcoopgamma_ramps_marshal(&this->ramps.d,   SUBBUF); break;
+	default:
+		break;
+	}
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_queried_filter_t` from a buffer
+ * 
+ * @param   this   The output parameter for unmarshalled record
+ * @param   vbuf   The buffer with the marshalled record
+ * @param   np     Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @param   depth  The type used of ramp stops
+ * @return         `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                 `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int libcoopgamma_queried_filter_unmarshal(libcoopgamma_queried_filter_t *restrict this, const void *restrict vbuf,
+                                          size_t *restrict np, libcoopgamma_depth_t depth)
+{
+	int r = LIBCOOPGAMMA_SUCCESS;
+	size_t n = 0;
+	UNMARSHAL_PROLOGUE;
+	memset(this, 0, sizeof(*this));
+	unmarshal_version(LIBCOOPGAMMA_QUERIED_FILTER_VERSION);
+	unmarshal_prim(this->priority, int64_t);
+	unmarshal_string(this->class);
+	switch (depth) {
+	case LIBCOOPGAMMA_UINT8:  r = libcoopgamma_ramps_unmarshal(&this->ramps.u8,  NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT16: r = libcoopgamma_ramps_unmarshal(&this->ramps.u16, NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT32: r = libcoopgamma_ramps_unmarshal(&this->ramps.u32, NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_UINT64: r = libcoopgamma_ramps_unmarshal(&this->ramps.u64, NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_FLOAT:  r = libcoopgamma_ramps_unmarshal(&this->ramps.f,   NNSUBBUF, &n); break;
+	case LIBCOOPGAMMA_DOUBLE: r = libcoopgamma_ramps_unmarshal(&this->ramps.d,   NNSUBBUF, &n); break;
+	default:
+		break;
+	}
+	if (r != LIBCOOPGAMMA_SUCCESS)
+		return r;
+	off += n;
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Initialise a `libcoopgamma_filter_table_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_filter_table_initialise(libcoopgamma_filter_table_t *restrict this)
+{
+	memset(this, 0, sizeof(*this));
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_filter_table_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_filter_table_initialise`
+ * or failed call to `libcoopgamma_filter_table_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_filter_table_destroy(libcoopgamma_filter_table_t *restrict this)
+{
+	while (this->filter_count)
+		libcoopgamma_queried_filter_destroy(this->filters + --this->filter_count);
+	free(this->filters);
+	this->filters = NULL;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_filter_table_t` into a buffer
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_filter_table_marshal(const libcoopgamma_filter_table_t *restrict this, void *restrict vbuf)
+{
+	size_t i;
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_FILTER_TABLE_VERSION);
+	marshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	marshal_prim(this->depth, libcoopgamma_depth_t);
+	marshal_prim(this->red_size, size_t);
+	marshal_prim(this->green_size, size_t);
+	marshal_prim(this->blue_size, size_t);
+	marshal_prim(this->filter_count, size_t);
+	for (i = 0; i < this->filter_count; i++)
+		off += libcoopgamma_queried_filter_marshal(&this->filters[i], SUBBUF, this->depth);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_filter_table_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_filter_table_unmarshal(libcoopgamma_filter_table_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	size_t i, n, fn;
+	int r;
+	UNMARSHAL_PROLOGUE;
+	this->filter_count = 0;
+	this->filters = NULL;
+	unmarshal_version(LIBCOOPGAMMA_FILTER_TABLE_VERSION);
+	unmarshal_version(LIBCOOPGAMMA_DEPTH_VERSION);
+	unmarshal_prim(this->depth, libcoopgamma_depth_t);
+	unmarshal_prim(this->red_size, size_t);
+	unmarshal_prim(this->green_size, size_t);
+	unmarshal_prim(this->blue_size, size_t);
+	unmarshal_prim(fn, size_t);
+	this->filters = malloc(fn * sizeof(*this->filters));
+	if (!this->filters)
+		return LIBCOOPGAMMA_ERRNO_SET;
+	for (i = 0; i < fn; i++) {
+		r = libcoopgamma_queried_filter_unmarshal(&this->filters[i], NNSUBBUF, &n, this->depth);
+		if (r != LIBCOOPGAMMA_SUCCESS)
+			return r;
+		off += n;
+		this->filter_count += 1;
+	}
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Initialise a `libcoopgamma_error_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_error_initialise(libcoopgamma_error_t *restrict this)
+{
+	this->number = 0;
+	this->custom = 0;
+	this->description = NULL;
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_error_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_error_initialise`
+ * or failed call to `libcoopgamma_error_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_error_destroy(libcoopgamma_error_t *restrict this)
+{
+	free(this->description);
+	this->description = NULL;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_error_t` into a buffer
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_error_marshal(const libcoopgamma_error_t *restrict this, void *restrict vbuf)
+{
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_ERROR_VERSION);
+	marshal_prim(this->number, uint64_t);
+	marshal_prim(this->custom, int);
+	marshal_prim(this->server_side, int);
+	marshal_string(this->description);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_error_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_error_unmarshal(libcoopgamma_error_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	UNMARSHAL_PROLOGUE;
+	this->description = NULL;
+	unmarshal_version(LIBCOOPGAMMA_ERROR_VERSION);
+	unmarshal_prim(this->number, uint64_t);
+	unmarshal_prim(this->custom, int);
+	unmarshal_prim(this->server_side, int);
+	unmarshal_string(this->description);
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Allocate a buffer for `libcoopgamma_context_t.inbound`
+ * 
+ * Where supported, the buffer is a ring buffer whose memory
+ * is mapped twice, directly after each other, so that any
+ * `size` consecutive bytes starting within the first
+ * mapping can be accessed contiguously, otherwise it is
+ * a regular buffer
+ * 
+ * @param   sizep      Pointer to the minimum size of the buffer,
+ *                     will be set to the actual size of the buffer
+ * @param   mirroredp  Output parameter for whether the buffer
+ *                     is a mirrored ring buffer
+ * @return             The buffer, `NULL` on error
+ */
+static char *
+inbound_allocate(size_t *restrict sizep, int *restrict mirroredp)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	long int page = sysconf(_SC_PAGESIZE);
+	size_t size = *sizep;
+	char *base;
+	int fd, saved_errno;
+
+	if (page > 0) {
+		size = (size + (size_t)page - 1) & ~((size_t)page - 1);
+		fd = memfd_create("libcoopgamma", MFD_CLOEXEC);
+		if (fd >= 0) {
+			base = MAP_FAILED;
+			if (!ftruncate(fd, (off_t)size))
+				base = mmap(NULL, size << 1, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (base != MAP_FAILED) {
+				if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+				    mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+					close(fd);
+					*sizep = size;
+					*mirroredp = 1;
+					return base;
+				}
+				saved_errno = errno;
+				munmap(base, size << 1);
+				errno = saved_errno;
+			}
+			saved_errno = errno;
+			close(fd);
+			errno = saved_errno;
+		}
+	}
+#endif
+	*mirroredp = 0;
+	return malloc(*sizep);
+}
+
+
+/**
+ * Deallocate a buffer allocated with `inbound_allocate`
+ * 
+ * @param  buf       The buffer, may be `NULL`
+ * @param  size      The size of the buffer
+ * @param  mirrored  Whether the buffer is a mirrored ring buffer
+ */
+static void
+inbound_free(char *buf, size_t size, int mirrored)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	if (mirrored) {
+		munmap(buf, size << 1);
+		return;
+	}
+#else
+	(void) size;
+	(void) mirrored;
+#endif
+	free(buf);
+}
+
+
+
+/**
+ * Set-gamma request that was replaced by a newer
+ * request, see `libcoopgamma_set_coalescing`
+ */
+struct libcoopgamma_superseded {
+	/**
+	 * The message ID of the replaced request
+	 */
+	uint32_t id;
+
+	/**
+	 * The message ID of the request that replaced it
+	 */
+	uint32_t by;
+};
+
+
+/**
+ * Initialise a `libcoopgamma_context_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_context_initialise(libcoopgamma_context_t *restrict this)
+{
+	memset(this, 0, sizeof(*this));
+	this->fd = -1;
+	this->blocking = 1;
+	this->timeout = -1;
+	return 0;
+}
+
+
+static void connection_free(libcoopgamma_context_t *restrict);
+static void submissions_free(libcoopgamma_context_t *restrict);
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_context_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_context_initialise`
+ * or failed call to `libcoopgamma_context_unmarshal`
+ * 
+ * @param  this        The record to destroy
+ * @param  disconnect  Disconnect from the server?
+ */
+void
+libcoopgamma_context_destroy(libcoopgamma_context_t *restrict this, int disconnect)
+{
+	if (disconnect && this->fd >= 0) {
+		shutdown(this->fd, SHUT_RDWR);
+		close(this->fd);
+	}
+	this->fd = -1;
+	libcoopgamma_error_destroy(&this->error);
+	free(this->outbound);
+	inbound_free(this->inbound, this->inbound_size, this->inbound_mirrored);
+	free(this->inflight);
+	free(this->coalescable);
+	free(this->superseded);
+	connection_free(this);
+	submissions_free(this);
+	libcoopgamma_set_io_uring(this, 0);
+	this->outbound = NULL;
+	this->inbound = NULL;
+	this->inflight = NULL;
+	this->inflight_mask = 0;
+	this->coalescable = NULL;
+	this->coalescable_count = this->coalescable_size = 0;
+	this->superseded = NULL;
+	this->superseded_count = this->superseded_size = 0;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_context_t` into a buffer
+ * 
+ * Must not be used while `libcoopgamma_synchronise` is receiving
+ * a response directly into ramps registered with
+ * `libcoopgamma_async_context_set_ramps`
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_context_marshal(const libcoopgamma_context_t *restrict this, void *restrict vbuf)
+{
+	size_t i;
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_CONTEXT_VERSION);
+	marshal_prim(this->fd, int);
+	off += libcoopgamma_error_marshal(&this->error, SUBBUF);
+	marshal_prim(this->message_id, uint32_t);
+	marshal_prim(this->outbound_head - this->outbound_tail, size_t);
+	marshal_buffer(this->outbound + this->outbound_tail, this->outbound_head - this->outbound_tail);
+	marshal_prim(this->inbound_size, size_t);
+	marshal_prim(this->inbound_tail, size_t);
+	marshal_prim(this->inbound_head - this->inbound_tail, size_t);
+	marshal_buffer(this->inbound + this->inbound_tail, this->inbound_head - this->inbound_tail);
+	marshal_prim(this->length, size_t);
+	marshal_prim(this->curline, size_t);
+	marshal_prim(this->headers_end, size_t);
+	marshal_buffer(this->headers, sizeof(this->headers));
+	marshal_prim(this->duplicate_headers, uint32_t);
+	marshal_prim(this->in_response_to, uint32_t);
+	marshal_prim(this->have_all_headers, int);
+	marshal_prim(this->bad_message, int);
+	marshal_prim(this->blocking, int);
+	marshal_prim(this->corked, int);
+	marshal_prim(this->timeout, int);
+	marshal_prim(this->coalescing, int);
+	marshal_prim(this->redelivering, int);
+	marshal_prim(this->actual_response_to, uint32_t);
+	marshal_prim(this->superseded_count, size_t);
+	for (i = 0; i < this->superseded_count; i++) {
+		marshal_prim(this->superseded[i].id, uint32_t);
+		marshal_prim(this->superseded[i].by, uint32_t);
+	}
+	marshal_prim(this->outbound_low, size_t);
+	marshal_prim(this->outbound_high, size_t);
+	marshal_prim(this->throttled, int);
+	marshal_prim(this->inbound_max, size_t);
+	marshal_prim(this->inbound_baseline, size_t);
+	marshal_prim(this->discard, size_t);
+	marshal_prim(this->oversized, int);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_context_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_context_unmarshal(libcoopgamma_context_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	size_t n;
+	int r;
+	UNMARSHAL_PROLOGUE;
+	memset(this, 0, sizeof(*this));
+	unmarshal_version(LIBCOOPGAMMA_CONTEXT_VERSION);
+	unmarshal_prim(this->fd, int);
+	r = libcoopgamma_error_unmarshal(&this->error, NNSUBBUF, &n);
+	if (r != LIBCOOPGAMMA_SUCCESS)
+		return r;
+	off += n;
+	unmarshal_prim(this->message_id, uint32_t);
+	unmarshal_prim(this->outbound_head, size_t);
+	this->outbound_size = this->outbound_head;
+	unmarshal_buffer(this->outbound, this->outbound_head);
+	unmarshal_prim(this->inbound_size, size_t);
+	unmarshal_prim(this->inbound_tail, size_t);
+	unmarshal_prim(n, size_t);
+	this->inbound_head = this->inbound_tail + n;
+	if (this->inbound_size < this->inbound_head)
+		this->inbound_size = this->inbound_head;
+	if (this->inbound_size) {
+		this->inbound = inbound_allocate(&this->inbound_size, &this->inbound_mirrored);
+		if (!this->inbound)
+			return LIBCOOPGAMMA_ERRNO_SET;
+		if (this->inbound_mirrored && this->inbound_tail >= this->inbound_size) {
+			this->inbound_tail -= this->inbound_size;
+			this->inbound_head -= this->inbound_size;
+		}
+		memcpy(this->inbound + this->inbound_tail, &buf[off], n);
+		off += n;
+	}
+	unmarshal_prim(this->length, size_t);
+	unmarshal_prim(this->curline, size_t);
+	unmarshal_prim(this->headers_end, size_t);
+	memcpy(this->headers, &buf[off], sizeof(this->headers));
+	off += sizeof(this->headers);
+	unmarshal_prim(this->duplicate_headers, uint32_t);
+	unmarshal_prim(this->in_response_to, uint32_t);
+	unmarshal_prim(this->have_all_headers, int);
+	unmarshal_prim(this->bad_message, int);
+	unmarshal_prim(this->blocking, int);
+	unmarshal_prim(this->corked, int);
+	unmarshal_prim(this->timeout, int);
+	unmarshal_prim(this->coalescing, int);
+	unmarshal_prim(this->redelivering, int);
+	unmarshal_prim(this->actual_response_to, uint32_t);
+	unmarshal_prim(n, size_t);
+	if (n) {
+		this->superseded = malloc(n * sizeof(*this->superseded));
+		if (!this->superseded)
+			return LIBCOOPGAMMA_ERRNO_SET;
+		this->superseded_size = n;
+	}
+	for (; this->superseded_count < n; this->superseded_count++) {
+		unmarshal_prim(this->superseded[this->superseded_count].id, uint32_t);
+		unmarshal_prim(this->superseded[this->superseded_count].by, uint32_t);
+	}
+	unmarshal_prim(this->outbound_low, size_t);
+	unmarshal_prim(this->outbound_high, size_t);
+	unmarshal_prim(this->throttled, int);
+	unmarshal_prim(this->inbound_max, size_t);
+	unmarshal_prim(this->inbound_baseline, size_t);
+	unmarshal_prim(this->discard, size_t);
+	unmarshal_prim(this->oversized, int);
+	UNMARSHAL_EPILOGUE;
+}
+
+
+
+/**
+ * Initialise a `libcoopgamma_async_context_t`
+ * 
+ * @param   this  The record to initialise
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_async_context_initialise(libcoopgamma_async_context_t *restrict this)
+{
+	this->message_id = 0;
+	this->coalesce = 0;
+	this->ramps = NULL;
+	this->ramps_size = 0;
+	this->output_depth = 0;
+	return 0;
+}
+
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_async_context_t`,
+ * the allocation of the record itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_async_context_initialise`
+ * or failed call to `libcoopgamma_async_context_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+void
+libcoopgamma_async_context_destroy(libcoopgamma_async_context_t *restrict this)
+{
+	(void) this;
+}
+
+
+/**
+ * Marshal a `libcoopgamma_async_context_t` into a buffer
+ * 
+ * @param   this  The record to marshal
+ * @param   vbuf  The output buffer, `NULL` to only measure
+ *                how large this buffer has to be
+ * @return        The number of marshalled bytes, or if `buf == NULL`,
+ *                how many bytes would be marshalled if `buf != NULL`
+ */
+size_t
+libcoopgamma_async_context_marshal(const libcoopgamma_async_context_t *restrict this, void *restrict vbuf)
+{
+	MARSHAL_PROLOGUE;
+	marshal_version(LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION);
+	marshal_prim(this->message_id, uint32_t);
+	marshal_prim(this->coalesce, int);
+	marshal_prim(this->output_depth, libcoopgamma_depth_t);
+	MARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Unmarshal a `libcoopgamma_async_context_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   vbuf  The buffer with the marshalled record
+ * @param   np    Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+int
+libcoopgamma_async_context_unmarshal(libcoopgamma_async_context_t *restrict this, const void *restrict vbuf, size_t *restrict np)
+{
+	UNMARSHAL_PROLOGUE;
+	this->ramps = NULL;
+	this->ramps_size = 0;
+	unmarshal_version(LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION);
+	unmarshal_prim(this->message_id, uint32_t);
+	unmarshal_prim(this->coalesce, int);
+	unmarshal_prim(this->output_depth, libcoopgamma_depth_t);
+	UNMARSHAL_EPILOGUE;
+}
+
+
+/**
+ * Register caller-owned gamma ramps that the response to a
+ * `libcoopgamma_get_gamma_send` request with coalesced filters
+ * shall be received directly into, rather than first being
+ * buffered in the library state and then copied into a newly
+ * allocated filter table
+ * 
+ * This function must be called before `libcoopgamma_get_gamma_send`,
+ * and the ramps are only used for the next request; they are
+ * unregistered by `libcoopgamma_get_gamma_recv`
+ * 
+ * The ramps must be laid out as by `libcoopgamma_ramps_initialise`,
+ * that is, the green ramp must directly follow the red ramp, and
+ * the blue ramp must directly follow the green ramp. They must not
+ * be freed until the response has been parsed
+ * 
+ * The ramps are only used if the response has exactly their size
+ * and type, or if `depth` was also requested with
+ * `libcoopgamma_async_context_set_depth` and the response has the
+ * same number of stops, in which case the stops are converted into
+ * the ramps; otherwise the response is received as without
+ * registered ramps
+ * 
+ * @param   this   The record to register the ramps with
+ * @param   ramps  The ramps, `NULL` to unregister any ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @return         Zero on success, -1 on error
+ */
+int
+libcoopgamma_async_context_set_ramps(libcoopgamma_async_context_t *restrict this, void *restrict ramps,
+                                     libcoopgamma_depth_t depth)
+{
+	libcoopgamma_ramps8_t *restrict ramps8 = ramps;
+	size_t width;
+
+	this->ramps = NULL;
+	this->ramps_size = 0;
+	if (!ramps)
+		return 0;
+
+	switch (depth) {
+	case LIBCOOPGAMMA_FLOAT:  width = sizeof(float);  break;
+	case LIBCOOPGAMMA_DOUBLE: width = sizeof(double); break;
+	default: INTEGRAL_DEPTHS
+		if (depth <= 0 || (depth & 7)) {
+			errno = EINVAL;
+			return -1;
+		}
+		width = (size_t)(depth / 8);
+		break;
+	}
+
+	if (!ramps8->red ||
+	    ramps8->green != ramps8->red   + ramps8->red_size   * width ||
+	    ramps8->blue  != ramps8->green + ramps8->green_size * width) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	this->ramps = ramps8->red;
+	this->ramps_size = (ramps8->red_size + ramps8->green_size + ramps8->blue_size) * width;
+	this->depth = depth;
+	return 0;
+}
+
+
+/**
+ * Request that the ramp stops in the response to a
+ * `libcoopgamma_get_gamma_send` request be converted
+ * to a specific data type and bit-depth as they are
+ * copied out of the received message
+ * 
+ * This function must be called before `libcoopgamma_get_gamma_send`
+ * 
+ * @param   this   The record to register the data type with
+ * @param   depth  The data type and bit-depth the ramp stops
+ *                 shall be converted to, 0 to return them as
+ *                 sent by the server
+ * @return         Zero on success, -1 on error
+ */
+int
+libcoopgamma_async_context_set_depth(libcoopgamma_async_context_t *restrict this, libcoopgamma_depth_t depth)
+{
+	size_t width;
+
+	if (depth && depth_index(depth, &width) < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	this->output_depth = depth;
+	return 0;
+}
+
+
+
+/**
+ * Start coopgammad without duplicating the address space
+ * of the process, as `fork` would do
+ * 
+ * @param   args      The command line arguments, the first
+ *                    shall be `COOPGAMMAD`, `NULL`-terminated
+ * @param   out       File descriptor that shall become the standard
+ *                    output of coopgammad, -1 to inherit it
+ * @param   closefd   File descriptor that shall be closed in
+ *                    coopgammad, -1 if none
+ * @param   pidp      Output parameter for the process ID of coopgammad
+ * @return            Zero on success, -1 on error
+ */
+static int
+spawn_coopgammad(const char *const *args, int out, int closefd, pid_t *restrict pidp)
+{
+	posix_spawn_file_actions_t actions;
+	int err;
+
+	err = posix_spawn_file_actions_init(&actions);
+	if (err)
+		goto fail;
+	if (closefd >= 0 && closefd != out)
+		if ((err = posix_spawn_file_actions_addclose(&actions, closefd)))
+			goto fail_actions;
+	if (out >= 0 && out != STDOUT_FILENO) {
+		if ((err = posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO)) ||
+		    (err = posix_spawn_file_actions_addclose(&actions, out)))
+			goto fail_actions;
+	}
+
+#if defined(__GNUC__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+	err = posix_spawnp(pidp, COOPGAMMAD, &actions, NULL, (char *const *)args, environ);
+#if defined(__GNUC__)
+# pragma GCC diagnostic pop
+#endif
+
+fail_actions:
+	posix_spawn_file_actions_destroy(&actions);
+fail:
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * A running coopgammad query
+ */
+struct query {
+	/**
+	 * The process ID of coopgammad
+	 */
+	pid_t pid;
+
+	/**
+	 * The read end of the pipe coopgammad writes its output to
+	 */
+	int fd;
+
+	/**
+	 * The output read so far
+	 */
+	char *msg;
+
+	/**
+	 * The number of bytes in `msg`
+	 */
+	size_t n;
+
+	/**
+	 * The allocation size of `msg`
+	 */
+	size_t size;
+};
+
+
+/**
+ * Start coopgammad with -q or -qq
+ * 
+ * @param   query   Output parameter for the query
+ * @param   method  The adjustment method, `NULL` for automatic
+ * @param   site    The site, `NULL` for automatic
+ * @param   arg     "-q" or "-qq", which shall be passed to coopgammad?
+ * @return          Zero on success, -1 on error
+ */
+static int
+query_start(struct query *restrict query, const char *restrict method, const char *restrict site, const char *restrict arg)
+{
+	const char *(args[7]) = {COOPGAMMAD, arg};
+	int pipe_rw[2], saved_errno;
+	size_t i = 2;
+
+	if (method) args[i++] = "-m", args[i++] = method;
+	if (site)   args[i++] = "-s", args[i++] = site;
+	args[i] = NULL;
+
+	if (pipe(pipe_rw) < 0)
+		return -1;
+	if (spawn_coopgammad(args, pipe_rw[1], pipe_rw[0], &query->pid)) {
+		saved_errno = errno;
+		close(pipe_rw[0]);
+		close(pipe_rw[1]);
+		errno = saved_errno;
+		return -1;
+	}
+	close(pipe_rw[1]);
+
+	query->fd = pipe_rw[0];
+	query->msg = NULL;
+	query->n = 0;
+	query->size = 0;
+	return 0;
+}
+
+
+/**
+ * Read output from coopgammad
+ * 
+ * @param   query  The query
+ * @return         1 if there may be more output, 0 on end of file, -1 on error
+ */
+static int
+query_read(struct query *restrict query)
+{
+	ssize_t got;
+	void *new;
+
+	if (query->n == query->size) {
+		new = realloc(query->msg, query->size = (query->n ? (query->n << 1) : 256));
+		if (!new)
+			return -1;
+		query->msg = new;
+	}
+	got = read(query->fd, query->msg + query->n, query->size - query->n);
+	if (got < 0)
+		return errno == EINTR ? 1 : -1;
+	query->n += (size_t)got;
+	return got > 0;
+}
+
+
+/**
+ * Abandon a query, and wait for coopgammad to exit
+ * 
+ * @param  query  The query
+ */
+static void
+query_abort(struct query *restrict query)
+{
+	int saved_errno = errno, status;
+	close(query->fd);
+	while (waitpid(query->pid, &status, 0) < 0 && errno == EINTR);
+	free(query->msg);
+	errno = saved_errno;
+}
+
+
+/**
+ * Complete a query whose output has been read
+ * in full, and wait for coopgammad to exit
+ * 
+ * @param   query  The query
+ * @return         The output of coopgammad, `NULL` on error. This
+ *                 will be NUL-terminated and will not contain any
+ *                 other `NUL` bytes.
+ */
+static char *
+query_finish(struct query *restrict query)
+{
+	char *msg = query->msg;
+	size_t n = query->n;
+	int status;
+	void *new;
+
+	close(query->fd);
+	while (waitpid(query->pid, &status, 0) < 0) {
+		if (errno == ECHILD) {
+			/* SIGCHLD is ignored, so the exit status is unknown */
+			status = 0;
+			break;
+		}
+		if (errno != EINTR)
+			goto fail;
+	}
+	if (status) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	if (n == query->size) {
+		new = realloc(msg, n + 1);
+		if (!new)
+			goto fail;
+		msg = new;
+	}
+	msg[n] = '\0';
+
+	if (strchr(msg, '\0') != msg + n) {
+		errno = EBADMSG;
+		goto fail;
+	}
+
+	return msg;
+
+fail:
+	free(msg);
+	return NULL;
+}
+
+
+/**
+ * Run coopgammad with -q or -qq and return the response,
+ * without consulting the discovery cache
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @param   arg      "-q" or "-qq", which shall be passed to coopgammad?
+ * @return           The output of coopgammad, `NULL` on error. This
+ *                   will be NUL-terminated and will not contain any
+ *                   other `NUL` bytes.
+ */
+static char *
+query_coopgammad(const char *restrict method, const char *restrict site, const char *restrict arg)
+{
+	struct query query;
+	int r;
+
+	if (query_start(&query, method, site, arg))
+		return NULL;
+	while ((r = query_read(&query)) > 0);
+	if (r < 0) {
+		query_abort(&query);
+		return NULL;
+	}
+	return query_finish(&query);
+}
+
+
+/**
+ * Cached output of coopgammad for a query
+ */
+struct discovery_entry {
+	/**
+	 * The next entry in the cache
+	 */
+	struct discovery_entry *next;
+
+	/**
+	 * The adjustment method, `NULL` for automatic
+	 */
+	char *method;
+
+	/**
+	 * The site, `NULL` for automatic
+	 */
+	char *site;
+
+	/**
+	 * "-q" or "-qq"
+	 */
+	char *arg;
+
+	/**
+	 * The output of coopgammad
+	 */
+	char *output;
+};
+
+
+/**
+ * The discovery cache
+ */
+static struct {
+	/**
+	 * Whether the cache is enabled
+	 */
+	int enabled;
+
+	/**
+	 * The file the cache is stored in, `NULL`
+	 * if the cache is only kept in memory
+	 */
+	char *file;
+
+	/**
+	 * The key, as returned by `discovery_key`,
+	 * the entries are valid for, `NULL` if unknown
+	 */
+	char *key;
+
+	/**
+	 * The cached queries
+	 */
+	struct discovery_entry *entries;
+} discovery_cache;
+
+
+/**
+ * Find the coopgammad binary the same way `execvp` does
+ * 
+ * @param   attr  Output parameter for the status of the binary
+ * @return        Zero on success, -1 on error
+ */
+static int
+stat_coopgammad(struct stat *restrict attr)
+{
+	const char *path, *end;
+	char *file;
+	size_t len;
+	int r;
+
+	if (strchr(COOPGAMMAD, '/'))
+		return stat(COOPGAMMAD, attr);
+
+	path = getenv("PATH");
+	if (!path)
+		path = "/usr/local/bin:/bin:/usr/bin";
+	file = malloc(strlen(path) + sizeof("/" COOPGAMMAD));
+	if (!file)
+		return -1;
+	for (;; path = end + 1) {
+		end = strchr(path, ':');
+		len = end ? (size_t)(end - path) : strlen(path);
+		if (len) {
+			memcpy(file, path, len);
+			stpcpy(&file[len], "/" COOPGAMMAD);
+		} else {
+			strcpy(file, COOPGAMMAD);
+		}
+		r = stat(file, attr);
+		if (!r && S_ISREG(attr->st_mode) && !access(file, X_OK))
+			break;
+		if (!end) {
+			r = -1;
+			errno = ENOENT;
+			break;
+		}
+	}
+	free(file);
+	return r;
+}
+
+
+/**
+ * Create a string that identifies the coopgammad binary and
+ * the parts of the environment that coopgammad's output
+ * depends on; cached queries are only valid as long as
+ * this string does not change
+ * 
+ * @return  The key, `NULL` on error
+ */
+static char *
+discovery_key(void)
+{
+	struct stat attr;
+	const char *display, *runtime_dir;
+	char *key;
+	int n;
+
+	if (stat_coopgammad(&attr))
+		return NULL;
+	display = getenv("DISPLAY");
+	runtime_dir = getenv("XDG_RUNTIME_DIR");
+	display = display ? display : "";
+	runtime_dir = runtime_dir ? runtime_dir : "";
+
+#define KEY_FORMAT "%ju %ju %jd.%09ld %jd %ju %zu:%s %zu:%s", (uintmax_t)attr.st_dev, (uintmax_t)attr.st_ino,\
+	(intmax_t)attr.st_mtime, ST_MTIME_NSEC(attr), (intmax_t)attr.st_size, (uintmax_t)getuid(),\
+	strlen(display), display, strlen(runtime_dir), runtime_dir
+	n = snprintf(NULL, 0, KEY_FORMAT);
+	if (n < 0)
+		return NULL;
+	key = malloc((size_t)n + 1);
+	if (!key)
+		return NULL;
+	sprintf(key, KEY_FORMAT);
+#undef KEY_FORMAT
+	return key;
+}
+
+
+/**
+ * Remove all entries from the discovery cache
+ */
+static void
+discovery_clear(void)
+{
+	struct discovery_entry *entry;
+	while ((entry = discovery_cache.entries)) {
+		discovery_cache.entries = entry->next;
+		free(entry->method);
+		free(entry->site);
+		free(entry->arg);
+		free(entry->output);
+		free(entry);
+	}
+}
+
+
+/**
+ * Compare two strings that may be `NULL`
+ * 
+ * @param   a  One of the strings
+ * @param   b  The other string
+ * @return     1 if the strings are equal, 0 otherwise
+ */
+static int
+optional_streq(const char *a, const char *b)
+{
+	return (!a || !b) ? a == b : !strcmp(a, b);
+}
+
+
+/**
+ * Add an entry to the discovery cache
+ * 
+ * @param   method      The adjustment method, `NULL` for automatic
+ * @param   method_len  The length of `method`
+ * @param   site        The site, `NULL` for automatic
+ * @param   site_len    The length of `site`
+ * @param   arg         "-q" or "-qq"
+ * @param   arg_len     The length of `arg`
+ * @param   output      The output of coopgammad
+ * @param   len         The length of `output`
+ * @return              Zero on success, -1 on error
+ */
+static int
+discovery_add(const char *method, size_t method_len, const char *site, size_t site_len,
+              const char *arg, size_t arg_len, const char *output, size_t len)
+{
+	struct discovery_entry *entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -1;
+	if ((method && !(entry->method = strndup(method, method_len))) ||
+	    (site && !(entry->site = strndup(site, site_len))) ||
+	    !(entry->arg = strndup(arg, arg_len)) ||
+	    !(entry->output = strndup(output, len))) {
+		free(entry->method);
+		free(entry->site);
+		free(entry->arg);
+		free(entry);
+		return -1;
+	}
+	entry->next = discovery_cache.entries;
+	discovery_cache.entries = entry;
+	return 0;
+}
+
+
+/**
+ * Read a length-prefixed field in the discovery cache file
+ * 
+ * @param   pp     Pointer to the read head, will be updated
+ * @param   end    The end of the file's content
+ * @param   delim  The character that terminates the length
+ * @param   lenp   Output parameter for the length of the field
+ * @return         Zero on success, -1 if the file is corrupt
+ */
+static int
+discovery_read_length(const char **restrict pp, const char *end, char delim, size_t *restrict lenp)
+{
+	const char *p = *pp;
+	size_t len = 0;
+	if (p == end || *p < '0' || *p > '9')
+		return -1;
+	for (; p != end && '0' <= *p && *p <= '9'; p++) {
+		if (len > (SIZE_MAX - 9) / 10)
+			return -1;
+		len = len * 10 + (size_t)(*p & 15);
+	}
+	if (p == end || *p++ != delim)
+		return -1;
+	*pp = p;
+	*lenp = len;
+	return 0;
+}
+
+
+/**
+ * Load the discovery cache from its file; the file
+ * is ignored if it is stale, corrupt, or missing
+ */
+static void
+discovery_load(void)
+{
+	static const char magic[] = DISCOVERY_MAGIC;
+	char *data = NULL;
+	const char *p, *end, *method, *site, *arg, *output;
+	size_t size = 0, n = 0, len, method_len, site_len, arg_len, output_len, flags;
+	ssize_t got;
+	void *new;
+	int fd;
+
+	fd = open(discovery_cache.file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	for (;;) {
+		if (n == size) {
+			new = realloc(data, size = (n ? (n << 1) : 1024));
+			if (!new)
+				goto out;
+			data = new;
+		}
+		got = read(fd, data + n, size - n);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			goto out;
+		} else if (got == 0) {
+			break;
+		}
+		n += (size_t)got;
+	}
+
+	p = data;
+	end = data + n;
+	if (n < sizeof(magic) - 1 || memcmp(p, magic, sizeof(magic) - 1))
+		goto out;
+	p += sizeof(magic) - 1;
+	if (discovery_read_length(&p, end, '\n', &len) || len != strlen(discovery_cache.key))
+		goto out;
+	if ((size_t)(end - p) < len + 1 || memcmp(p, discovery_cache.key, len) || p[len] != '\n')
+		goto out;
+	p += len + 1;
+
+	while (p != end) {
+		if (discovery_read_length(&p, end, ' ', &flags) || flags > 3 ||
+		    discovery_read_length(&p, end, ' ', &method_len) ||
+		    discovery_read_length(&p, end, ' ', &site_len) ||
+		    discovery_read_length(&p, end, ' ', &arg_len) ||
+		    discovery_read_length(&p, end, '\n', &output_len))
+			goto corrupt;
+		if (method_len > (size_t)(end - p))
+			goto corrupt;
+		method = p, p += method_len;
+		if (site_len > (size_t)(end - p))
+			goto corrupt;
+		site = p, p += site_len;
+		if (arg_len > (size_t)(end - p))
+			goto corrupt;
+		arg = p, p += arg_len;
+		if (output_len > (size_t)(end - p) || memchr(output = p, '\0', output_len))
+			goto corrupt;
+		p += output_len;
+		if (discovery_add((flags & 1) ? method : NULL, method_len, (flags & 2) ? site : NULL, site_len,
+		                  arg, arg_len, output, output_len))
+			goto corrupt;
+	}
+	goto out;
+
+corrupt:
+	discovery_clear();
+out:
+	free(data);
+	close(fd);
+}
+
+
+/**
+ * Write a field to the discovery cache file
+ * 
+ * @param   f      The file
+ * @param   field  The field, `NULL` is treated as the empty string
+ * @return         Zero on success, -1 on error
+ */
+static int
+discovery_write_field(FILE *f, const char *field)
+{
+	size_t len = field ? strlen(field) : 0;
+	return fwrite(field ? field : "", 1, len, f) == len ? 0 : -1;
+}
+
+
+/**
+ * Save the discovery cache to its file
+ * 
+ * The file is replaced atomically, so concurrent
+ * processes will never see a partial file
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int
+discovery_save(void)
+{
+	struct discovery_entry *entry;
+	char *temp;
+	FILE *f = NULL;
+	int fd, saved_errno;
+
+	temp = malloc(strlen(discovery_cache.file) + sizeof(".XXXXXX"));
+	if (!temp)
+		return -1;
+	stpcpy(stpcpy(temp, discovery_cache.file), ".XXXXXX");
+	fd = mkstemp(temp);
+	if (fd < 0)
+		goto fail;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto fail_unlink;
+	}
+
+	if (fprintf(f, DISCOVERY_MAGIC "%zu\n%s\n", strlen(discovery_cache.key), discovery_cache.key) < 0)
+		goto fail_unlink;
+	for (entry = discovery_cache.entries; entry; entry = entry->next) {
+		if (fprintf(f, "%i %zu %zu %zu %zu\n", (entry->method ? 1 : 0) | (entry->site ? 2 : 0),
+		            entry->method ? strlen(entry->method) : 0, entry->site ? strlen(entry->site) : 0,
+		            strlen(entry->arg), strlen(entry->output)) < 0 ||
+		    discovery_write_field(f, entry->method) ||
+		    discovery_write_field(f, entry->site) ||
+		    discovery_write_field(f, entry->arg) ||
+		    discovery_write_field(f, entry->output))
+			goto fail_unlink;
+	}
+	if (fclose(f)) {
+		f = NULL;
+		goto fail_unlink;
+	}
+	f = NULL;
+	if (rename(temp, discovery_cache.file))
+		goto fail_unlink;
+
+	free(temp);
+	return 0;
+
+fail_unlink:
+	saved_errno = errno;
+	if (f)
+		fclose(f);
+	unlink(temp);
+	errno = saved_errno;
+fail:
+	saved_errno = errno;
+	free(temp);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Make sure the discovery cache is up to date, before it is used
+ * 
+ * @return  Zero if the cache can be used, -1 if it is disabled
+ *          or if the key for the cache cannot be determined
+ */
+static int
+discovery_refresh(void)
+{
+	char *key;
+
+	if (!discovery_cache.enabled)
+		return -1;
+
+	key = discovery_key();
+	if (!key)
+		return -1;
+	if (!discovery_cache.key || strcmp(key, discovery_cache.key)) {
+		discovery_clear();
+		free(discovery_cache.key);
+		discovery_cache.key = key;
+		if (discovery_cache.file)
+			discovery_load();
+	} else {
+		free(key);
+	}
+	return 0;
+}
+
+
+/**
+ * Look up a query in the discovery cache
+ * 
+ * @param   method  The adjustment method, `NULL` for automatic
+ * @param   site    The site, `NULL` for automatic
+ * @param   arg     "-q" or "-qq"
+ * @return          The cached output of coopgammad, `NULL` if not cached
+ */
+static const char *
+discovery_find(const char *restrict method, const char *restrict site, const char *restrict arg)
+{
+	struct discovery_entry *entry;
+	for (entry = discovery_cache.entries; entry; entry = entry->next)
+		if (!strcmp(entry->arg, arg) && optional_streq(entry->method, method) && optional_streq(entry->site, site))
+			return entry->output;
+	return NULL;
+}
+
+
+/**
+ * Add the output of a query to the discovery cache,
+ * and save the cache to its file, if it has one
+ * 
+ * The cache must be enabled and `discovery_refresh`
+ * must have been called
+ * 
+ * @param  method  The adjustment method, `NULL` for automatic
+ * @param  site    The site, `NULL` for automatic
+ * @param  arg     "-q" or "-qq"
+ * @param  output  The output of coopgammad
+ */
+static void
+discovery_store(const char *restrict method, const char *restrict site, const char *restrict arg, const char *restrict output)
+{
+	int saved_errno = errno;
+	if (!discovery_add(method, method ? strlen(method) : 0, site, site ? strlen(site) : 0,
+	                   arg, strlen(arg), output, strlen(output)) && discovery_cache.file)
+		discovery_save();
+	errno = saved_errno;
+}
+
+
+/**
+ * Run coopgammad with -q or -qq and return the response,
+ * or take the response from the discovery cache if it is
+ * enabled and contains the response
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @param   arg      "-q" or "-qq", which shall be passed to coopgammad?
+ * @return           The output of coopgammad, `NULL` on error. This
+ *                   will be NUL-terminated and will not contain any
+ *                   other `NUL` bytes.
+ */
+static char *
+libcoopgamma_query(const char *restrict method, const char *restrict site, const char *restrict arg)
+{
+	const char *cached;
+	char *output;
+
+	if (discovery_refresh())
+		return query_coopgammad(method, site, arg);
+
+	cached = discovery_find(method, site, arg);
+	if (cached)
+		return strdup(cached);
+
+	output = query_coopgammad(method, site, arg);
+	if (output)
+		discovery_store(method, site, arg, output);
+	return output;
+}
+
+
+/**
+ * Enable the discovery cache
+ * 
+ * While the cache is enabled, the output of coopgammad is remembered
+ * by `libcoopgamma_get_methods`, `libcoopgamma_get_method_and_site`,
+ * `libcoopgamma_get_pid_file`, and `libcoopgamma_get_socket_file`, so
+ * that coopgammad need not be run again for the same query. Cached
+ * output is discarded when the coopgammad binary is replaced, or when
+ * the user or the display or runtime directory in the environment changes.
+ * 
+ * This function, and the functions that use the cache, are not
+ * thread-safe while the cache is enabled
+ * 
+ * @param   file  The pathname of the file the cache shall be stored in,
+ *                so that it is shared with other processes, `NULL` to
+ *                only keep the cache in memory
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_enable_discovery_cache(const char *restrict file)
+{
+	char *copy = NULL;
+
+	if (file && !(copy = strdup(file)))
+		return -1;
+
+	libcoopgamma_disable_discovery_cache();
+	discovery_cache.enabled = 1;
+	discovery_cache.file = copy;
+	return 0;
+}
+
+
+/**
+ * Disable the discovery cache and forget its content,
+ * the cache file, if any, is left unmodified
+ */
+void
+libcoopgamma_disable_discovery_cache(void)
+{
+	discovery_clear();
+	free(discovery_cache.key);
+	discovery_cache.key = NULL;
+	free(discovery_cache.file);
+	discovery_cache.file = NULL;
+	discovery_cache.enabled = 0;
+}
+
+
+/**
+ * The maximum number of coopgammad processes
+ * `libcoopgamma_get_methods` runs at the same time
+ */
+#define METHOD_PROBES_IN_FLIGHT 8
+
+
+/**
+ * Store the result of a method probe in `libcoopgamma_get_methods`
+ * 
+ * @param   raw      The output of coopgammad for the probe
+ * @param   num      The method index the probe was for, as a string
+ * @param   index    The method index the probe was for
+ * @param   methods  The list of found methods
+ * @param   end      The lowest method index known not to
+ *                   denote a method, will be updated
+ * @return           Zero on success, -1 on error
+ */
+static int
+store_method(const char *raw, const char *num, int index, char **methods, int *end)
+{
+	const char *p = strchr(raw, '\n');
+	if (!p) {
+		errno = EBADMSG;
+		return -1;
+	}
+	if ((size_t)(p - raw) == strlen(num) && !memcmp(raw, num, (size_t)(p - raw))) {
+		if (index < *end)
+			*end = index;
+		return 0;
+	}
+	methods[index] = strndup(raw, (size_t)(p - raw));
+	return methods[index] ? 0 : -1;
+}
+
+
+/**
+ * List all recognised adjustment method
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @return  A `NULL`-terminated list of names. You should only free
+ *          the outer pointer, inner pointers are subpointers of the
+ *          outer pointer and cannot be freed. `NULL` on error.
+ */
+char **
+libcoopgamma_get_methods(void)
+{
+	char num[3 * sizeof(int) + 2];
+	struct query queries[METHOD_PROBES_IN_FLIGHT];
+	int indices[METHOD_PROBES_IN_FLIGHT];
+	struct pollfd fds[METHOD_PROBES_IN_FLIGHT];
+	size_t running = 0, i, size = 0;
+	int n = 0, new_n, next = 0, end = 10000 /* just to be safe */;
+	int cache, cache_modified = 0, r, index, saved_errno;
+	char **methods = NULL;
+	const char *cached;
+	char **rc;
+	char *buffer, *raw;
+	void *new;
+
+	cache = !discovery_refresh();
+
+	for (;;) {
+		while (running < METHOD_PROBES_IN_FLIGHT && next < end) {
+			if (next == n) {
+				new_n = n ? n << 1 : 8;
+				new = realloc(methods, (size_t)new_n * sizeof(*methods));
+				if (!new)
+					goto fail;
+				methods = new;
+				n = new_n;
+				memset(&methods[next], 0, (size_t)(n - next) * sizeof(*methods));
+			}
+			sprintf(num, "%i", next);
+			cached = cache ? discovery_find(num, NULL, "-q") : NULL;
+			if (cached) {
+				if (store_method(cached, num, next, methods, &end))
+					goto fail;
+			} else {
+				if (query_start(&queries[running], num, NULL, "-q"))
+					goto fail;
+				indices[running] = next;
+				fds[running].fd = queries[running].fd;
+				fds[running].events = POLLIN;
+				running += 1;
+			}
+			next += 1;
+		}
+
+		if (!running)
+			break;
+
+		if (poll(fds, (nfds_t)running, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+
+		for (i = running; i--;) {
+			if (!fds[i].revents)
+				continue;
+			r = query_read(&queries[i]);
+			if (r > 0)
+				continue;
+			if (r < 0)
+				goto fail;
+			running -= 1;
+			index = indices[i];
+			raw = query_finish(&queries[i]);
+			queries[i] = queries[running];
+			indices[i] = indices[running];
+			fds[i] = fds[running];
+			if (!raw)
+				goto fail;
+			sprintf(num, "%i", index);
+			r = store_method(raw, num, index, methods, &end);
+			if (!r && cache && !discovery_add(num, strlen(num), NULL, 0, "-q", 2, raw, strlen(raw)))
+				cache_modified = 1;
+			free(raw);
+			if (r)
+				goto fail;
+		}
+	}
+
+	if (cache_modified && discovery_cache.file)
+		discovery_save();
+
+	for (i = 0; i < (size_t)end; i++)
+		size += strlen(methods[i]) + 1;
+	rc = malloc((size_t)(end + 1) * sizeof(char *) + size);
+	if (!rc)
+		goto fail;
+	buffer = ((char *)rc) + (size_t)(end + 1) * sizeof(char *);
+	rc[end] = NULL;
+	for (i = 0; i < (size_t)end; i++) {
+		rc[i] = buffer;
+		buffer = stpcpy(buffer, methods[i]) + 1;
+	}
+	while (n--)
+		free(methods[n]);
+	free(methods);
+
+	return rc;
+
+fail:
+	saved_errno = errno;
+	while (running--)
+		query_abort(&queries[running]);
+	while (n--)
+		free(methods[n]);
+	free(methods);
+	errno = saved_errno;
+	return NULL;
+}
+
+
+/**
+ * Get the adjustment method and site
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @param   methodp  Output pointer for the selected adjustment method,
+ *                   which cannot be `NULL`. It is safe to call
+ *                   this function with this parameter set to `NULL`.
+ * @param   sitep    Output pointer for the selected site, which will
+ *                   be `NULL` the method only supports one site or if
+ *                   `site == NULL` and no site can be selected
+ *                   automatically. It is safe to call this function
+ *                   with this parameter set to `NULL`.
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_get_method_and_site(const char *restrict method, const char *restrict site,
+                                 char **restrict methodp, char **restrict sitep)
+{
+	int saved_errno;
+	char *raw;
+	char *p;
+	char *q;
+
+	raw = libcoopgamma_query(method, site, "-q");
+	if (!raw)
+		return -1;
+
+	if (methodp) *methodp = NULL;
+	if (sitep)   *sitep   = NULL;
+
+	p = strchr(raw, '\n');
+	if (!p) {
+		errno = EBADMSG;
+		goto fail;
+	}
+	*p++ = '\0';
+
+	if (methodp) {
+		*methodp = malloc(strlen(raw) + 1);
+		if (!*methodp)
+			goto fail;
+		strcpy(*methodp, raw);
+	}
+
+	if (site && *(q = strchr(p, '\0') - 1)) {
+		if (*q != '\n') {
+			errno = EBADMSG;
+			goto fail;
+		}
+		*q = '\0';
+		*sitep = malloc(strlen(p) + 1);
+		if (!*sitep)
+			goto fail;
+		strcpy(*sitep, p);
+	}
+
+	free(raw);
+	return 0;
+
+fail:
+	saved_errno = errno;
+	if (methodp) {
+		free(*methodp);
+		*methodp = NULL;
+	}
+	free(raw);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Get the PID file of the coopgamma server
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @return           The pathname of the server's PID file, `NULL` on error
+ *                   or if there server does not use PID files. The later
+ *                   case is detected by checking that `errno` is set to 0.
+ */
+char *
+libcoopgamma_get_pid_file(const char *restrict method, const char *restrict site)
+{
+	char *path;
+	size_t n;
+
+	path = libcoopgamma_get_socket_file(method, site);
+	if (!path)
+		return NULL;
+
+	n = strlen(path);
+	if (n < 7 || strcmp(path + n - 7, ".socket")) {
+		free(path);
+		errno = EBADMSG;
+		return NULL;
+	}
+
+	strcpy(path + n - 7, ".pid");
+	return path;
+}
+
+
+/**
+ * Parse the output of coopgammad for -qq
+ * 
+ * @param   raw  The output of coopgammad, will be freed on error
+ * @return       The pathname of the server's socket, `raw`
+ *               itself; `NULL` on error
+ */
+static char *
+parse_socket_file(char *raw)
+{
+	char *p;
+
+	p = strchr(raw, '\0') - 1;
+	if (p < raw || *p != '\n') {
+		errno = EBADMSG;
+		goto fail;
+	}
+	*p = '\0';
+	if (!*raw) {
+		errno = EBADMSG;
+		goto fail;
+	}
+
+	return raw;
+fail:
+	free(raw);
+	return NULL;
+}
+
+
+/**
+ * Get the socket file of the coopgamma server
+ * 
+ * SIGCHLD must not be ignored or blocked
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @return           The pathname of the server's socket, `NULL` on error
+ *                   or if there server does have its own socket. The later
+ *                   case is detected by checking that `errno` is set to 0,
+ *                   and is the case when communicating with a server in a
+ *                   multi-server display server like mds.
+ */
+char *
+libcoopgamma_get_socket_file(const char *restrict method, const char *restrict site)
+{
+	char *raw = libcoopgamma_query(method, site, "-qq");
+	return raw ? parse_socket_file(raw) : NULL;
+}
+
+
+
+/**
+ * The stages of `libcoopgamma_connect_start`
+ */
+enum connect_state {
+	/**
+	 * Waiting for coopgammad to print the pathname of the socket
+	 */
+	CONNECT_QUERYING,
+
+	/**
+	 * Waiting for the connection to the socket to be established
+	 */
+	CONNECT_CONNECTING,
+
+	/**
+	 * Waiting for coopgammad to start the server
+	 */
+	CONNECT_STARTING
+};
+
+
+/**
+ * The state of a connection being established
+ * with `libcoopgamma_connect_start`
+ */
+struct libcoopgamma_connection {
+	/**
+	 * The current stage, a value of `enum connect_state`
+	 */
+	int state;
+
+	/**
+	 * Whether an attempt to start the server has been made
+	 */
+	int started;
+
+	/**
+	 * File descriptor that becomes readable when the server
+	 * has been started, -1 if not `CONNECT_STARTING`
+	 */
+	int pidfd;
+
+	/**
+	 * The process ID of coopgammad if `CONNECT_STARTING`
+	 */
+	pid_t pid;
+
+	/**
+	 * The query for the socket if `CONNECT_QUERYING`
+	 */
+	struct query query;
+
+	/**
+	 * The adjustment method, `NULL` for automatic
+	 */
 	char *method;
-	char **rc;
-	char *buffer;
-	int n = 0;
-	size_t size = 0;
-	void *new;
 
-	methods = malloc(4 * sizeof(*methods));
-	if (!methods)
-		goto fail;
+	/**
+	 * The site, `NULL` for automatic
+	 */
+	char *site;
+
+	/**
+	 * The address of the server's socket
+	 */
+	struct sockaddr_un address;
+};
+
+
+/**
+ * Get a file descriptor that becomes readable when a process exits
+ * 
+ * @param   pid  The process ID of a child process
+ * @return       The file descriptor, -1 on error
+ */
+static int
+open_pidfd(pid_t pid)
+{
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void) pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Wait for a child process to exit
+ * 
+ * The process is considered successful if it has already been
+ * reaped because SIGCHLD is ignored
+ * 
+ * @param   pid  The process ID of the child process
+ * @return       Zero if the process exited successfully, -1 otherwise,
+ *               `errno` is set to 0 if the process failed
+ */
+static int
+reap_child(pid_t pid)
+{
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno == ECHILD)
+			return 0;
+		if (errno != EINTR)
+			return -1;
+	}
+	if (status) {
+		errno = 0;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * Release the state of a connection being established
+ * 
+ * @param  ctx  The state of the library
+ */
+static void
+connection_free(libcoopgamma_context_t *restrict ctx)
+{
+	struct libcoopgamma_connection *conn = ctx->connection;
+	int saved_errno = errno;
+	if (!conn)
+		return;
+	if (conn->state == CONNECT_QUERYING) {
+		query_abort(&conn->query);
+	} else if (conn->state == CONNECT_STARTING) {
+		if (conn->pidfd >= 0)
+			close(conn->pidfd);
+		reap_child(conn->pid);
+	}
+	free(conn->method);
+	free(conn->site);
+	free(conn);
+	ctx->connection = NULL;
+	errno = saved_errno;
+}
+
+
+/**
+ * Abandon a connection being established
+ * 
+ * @param   ctx  The state of the library
+ * @return       -1
+ */
+static int
+connection_fail(libcoopgamma_context_t *restrict ctx)
+{
+	int saved_errno = errno;
+	connection_free(ctx);
+	if (ctx->fd >= 0)
+		close(ctx->fd);
+	ctx->fd = -1;
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Try to connect to the server's socket, and start
+ * the server if it is not running
+ * 
+ * @param   ctx      The state of the library
+ * @param   fdp      Output parameter for the file descriptor to wait on
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ * @return           Zero when connected, -1 on error or if
+ *                   the connection is still in progress, `errno`
+ *                   is set to EAGAIN if the attempt shall be
+ *                   retried later
+ */
+static int
+connection_attempt(libcoopgamma_context_t *restrict ctx, int *restrict fdp, int *restrict eventsp)
+{
+	struct libcoopgamma_connection *conn = ctx->connection;
+	const char *(args[6]) = {COOPGAMMAD};
+	size_t i = 1;
+	int flags;
+
+retry:
+	if (!connect(ctx->fd, (struct sockaddr *)&conn->address, (socklen_t)sizeof(conn->address)) || errno == EISCONN) {
+		flags = fcntl(ctx->fd, F_GETFL);
+		if (flags == -1 || fcntl(ctx->fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+			return connection_fail(ctx);
+		connection_free(ctx);
+		return 0;
+	}
+
+	if (errno == EAGAIN) {
+		/* The server's listen queue is full, the socket is
+		 * not connecting, so it cannot be polled for POLLOUT */
+		conn->state = CONNECT_CONNECTING;
+		*fdp = -1;
+		*eventsp = 0;
+		return -1;
+	}
+
+	if (errno == EINPROGRESS || errno == EALREADY || errno == EINTR) {
+		conn->state = CONNECT_CONNECTING;
+		*fdp = ctx->fd;
+		*eventsp = POLLOUT;
+		errno = EINPROGRESS;
+		return -1;
+	}
+
+	if ((errno != ECONNREFUSED && errno != ENOENT && errno != ENOTDIR) || conn->started)
+		return connection_fail(ctx);
+
+	if (conn->method) args[i++] = "-m", args[i++] = conn->method;
+	if (conn->site)   args[i++] = "-s", args[i++] = conn->site;
+	args[i] = NULL;
+
+	conn->started = 1;
+	if (spawn_coopgammad(args, -1, ctx->fd, &conn->pid))
+		return connection_fail(ctx);
+	conn->state = CONNECT_STARTING;
+	conn->pidfd = open_pidfd(conn->pid);
+	if (conn->pidfd < 0) {
+		conn->state = CONNECT_CONNECTING;
+		if (reap_child(conn->pid))
+			return connection_fail(ctx);
+		goto retry;
+	}
+	*fdp = conn->pidfd;
+	*eventsp = POLLIN;
+	errno = EINPROGRESS;
+	return -1;
+}
+
+
+/**
+ * Create the socket for a connection, once the
+ * pathname of the server's socket is known
+ * 
+ * @param   ctx      The state of the library
+ * @param   path     The pathname of the server's socket, will be freed
+ * @param   fdp      Output parameter for the file descriptor to wait on
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ * @return           Zero when connected, -1 on error or if
+ *                   the connection is still in progress
+ */
+static int
+connection_open(libcoopgamma_context_t *restrict ctx, char *path, int *restrict fdp, int *restrict eventsp)
+{
+	struct libcoopgamma_connection *conn = ctx->connection;
+	int flags;
+
+	conn->state = CONNECT_CONNECTING;
+
+	if (strlen(path) >= sizeof(conn->address.sun_path)) {
+		free(path);
+		errno = ENAMETOOLONG;
+		return connection_fail(ctx);
+	}
+	conn->address.sun_family = AF_UNIX;
+	strcpy(conn->address.sun_path, path);
+	free(path);
+
+	if ((ctx->fd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
+		return connection_fail(ctx);
+	flags = fcntl(ctx->fd, F_GETFL);
+	if (flags == -1 || fcntl(ctx->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return connection_fail(ctx);
+
+	return connection_attempt(ctx, fdp, eventsp);
+}
+
+
+/**
+ * Start connecting to a coopgamma server, and start it if necessary,
+ * without blocking
+ * 
+ * Use `libcoopgamma_context_destroy` to disconnect, or to abandon
+ * the connection attempt
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @param   ctx      The state of the library, must be initialised
+ * @param   fdp      Output parameter for the file descriptor to wait
+ *                   on if the connection is in progress
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ *                   on `*fdp` if the connection is in progress
+ * @return           Zero on success, -1 on error. If the connection
+ *                   is in progress `errno` is set to EINPROGRESS; wait
+ *                   for `*eventsp` on `*fdp` and then call
+ *                   `libcoopgamma_connect_continue`. If the server is
+ *                   not accepting connections at the moment, `errno` is
+ *                   set to EAGAIN and `*fdp` to -1; call
+ *                   `libcoopgamma_connect_continue` again later. On error,
+ *                   `errno` is set to 0 if the server could not be initialised,
+ *                   and to EALREADY if a connection is already in progress.
+ */
+int
+libcoopgamma_connect_start(const char *restrict method, const char *restrict site, libcoopgamma_context_t *restrict ctx,
+                           int *restrict fdp, int *restrict eventsp)
+{
+	struct libcoopgamma_connection *conn;
+	const char *cached;
+
+	if (ctx->connection) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	ctx->blocking = 1;
+	ctx->fd = -1;
+
+	conn = ctx->connection = calloc(1, sizeof(*conn));
+	if (!conn)
+		return -1;
+	conn->state = CONNECT_CONNECTING;
+	conn->pidfd = -1;
+	if ((method && !(conn->method = strdup(method))) || (site && !(conn->site = strdup(site))))
+		return connection_fail(ctx);
+
+	cached = discovery_refresh() ? NULL : discovery_find(method, site, "-qq");
+	if (cached) {
+		char *raw = strdup(cached);
+		if (!raw || !(raw = parse_socket_file(raw)))
+			return connection_fail(ctx);
+		return connection_open(ctx, raw, fdp, eventsp);
+	}
+
+	if (query_start(&conn->query, method, site, "-qq"))
+		return connection_fail(ctx);
+	conn->state = CONNECT_QUERYING;
+	*fdp = conn->query.fd;
+	*eventsp = POLLIN;
+	errno = EINPROGRESS;
+	return -1;
+}
+
+
+/**
+ * Continue connecting to a coopgamma server after
+ * `libcoopgamma_connect_start` or `libcoopgamma_connect_continue`
+ * failed with `errno` set to EINPROGRESS
+ * 
+ * @param   ctx      The state of the library
+ * @param   fdp      Output parameter for the file descriptor to wait
+ *                   on if the connection is in progress
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ *                   on `*fdp` if the connection is in progress
+ * @return           Zero on success, -1 on error. If the connection
+ *                   is still in progress `errno` is set to EINPROGRESS;
+ *                   wait for `*eventsp` on `*fdp` and then call this
+ *                   function again. If the server is not accepting
+ *                   connections at the moment, `errno` is set to EAGAIN
+ *                   and `*fdp` to -1; call this function again later.
+ *                   On error, `errno` is set to 0 if the server could
+ *                   not be initialised.
+ */
+int
+libcoopgamma_connect_continue(libcoopgamma_context_t *restrict ctx, int *restrict fdp, int *restrict eventsp)
+{
+	struct libcoopgamma_connection *conn = ctx->connection;
+	socklen_t len;
+	char *raw;
+	int r, err;
+
+	if (!conn) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (conn->state) {
+	case CONNECT_QUERYING:
+		r = query_read(&conn->query);
+		if (r < 0)
+			return connection_fail(ctx);
+		if (r > 0) {
+			*fdp = conn->query.fd;
+			*eventsp = POLLIN;
+			errno = EINPROGRESS;
+			return -1;
+		}
+		conn->state = CONNECT_CONNECTING;
+		raw = query_finish(&conn->query);
+		if (!raw)
+			return connection_fail(ctx);
+		if (!discovery_refresh())
+			discovery_store(conn->method, conn->site, "-qq", raw);
+		raw = parse_socket_file(raw);
+		if (!raw)
+			return connection_fail(ctx);
+		return connection_open(ctx, raw, fdp, eventsp);
+
+	case CONNECT_CONNECTING:
+		len = (socklen_t)sizeof(err);
+		if (getsockopt(ctx->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+			return connection_fail(ctx);
+		if (err) {
+			errno = err;
+			return connection_fail(ctx);
+		}
+		return connection_attempt(ctx, fdp, eventsp);
+
+	default:
+		close(conn->pidfd);
+		conn->pidfd = -1;
+		conn->state = CONNECT_CONNECTING;
+		if (reap_child(conn->pid))
+			return connection_fail(ctx);
+		return connection_attempt(ctx, fdp, eventsp);
+	}
+}
+
+
+/**
+ * The number of milliseconds `libcoopgamma_connect` waits
+ * before it tries again to connect to a server that is not
+ * accepting connections at the moment
+ */
+#define CONNECT_RETRY_DELAY 10
+
+
+/**
+ * Connect to a coopgamma server, and start it if necessary
+ * 
+ * Use `libcoopgamma_context_destroy` to disconnect
+ * 
+ * @param   method  The adjustment method, `NULL` for automatic
+ * @param   site    The site, `NULL` for automatic
+ * @param   ctx     The state of the library, must be initialised
+ * @return          Zero on success, -1 on error. On error, `errno` is set
+ *                  to 0 if the server could not be initialised.
+ */
+int
+libcoopgamma_connect(const char *restrict method, const char *restrict site, libcoopgamma_context_t *restrict ctx)
+{
+	struct pollfd pfd;
+	int r, events;
+
+	r = libcoopgamma_connect_start(method, site, ctx, &pfd.fd, &events);
+	while (r < 0 && (errno == EINPROGRESS || (errno == EAGAIN && ctx->connection))) {
+		pfd.events = (short)events;
+		if (poll(&pfd, pfd.fd < 0 ? 0 : 1, pfd.fd < 0 ? CONNECT_RETRY_DELAY : -1) < 0) {
+			if (errno == EINTR) {
+				errno = EINPROGRESS;
+				continue;
+			}
+			return connection_fail(ctx);
+		}
+		r = libcoopgamma_connect_continue(ctx, &pfd.fd, &events);
+	}
+	return r;
+}
+
+
+/**
+ * By default communication is blocking, this function
+ * can be used to switch between blocking and nonblocking
+ * 
+ * After setting the communication to nonblocking,
+ * `libcoopgamma_flush`, `libcoopgamma_synchronise` and
+ * and request-sending functions can fail with EAGAIN and
+ * EWOULDBLOCK. It is safe to continue with `libcoopgamma_flush`
+ * (for `libcoopgamma_flush` it selfand equest-sending functions)
+ * or `libcoopgamma_synchronise` just like EINTR failure.
+ * 
+ * @param   ctx          The state of the library, must be connected
+ * @param   nonblocking  Nonblocking mode?
+ * @return               Zero on success, -1 on error
+ */
+int
+libcoopgamma_set_nonblocking(libcoopgamma_context_t *restrict ctx, int nonblocking)
+{
+	int flags = fcntl(ctx->fd, F_GETFL);
+	if (flags == -1)
+		return -1;
+	if (nonblocking)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+	if (fcntl(ctx->fd, F_SETFL, flags) == -1)
+		return -1;
+	ctx->blocking = !nonblocking;
+	return 0;
+}
+
+
+/**
+ * Limit the time blocking communication may block
+ * 
+ * The limit applies to the total time spent in a call to
+ * `libcoopgamma_flush`, `libcoopgamma_synchronise`,
+ * `libcoopgamma_synchronise_tracked`, a request-sending
+ * function, or a synchronous function. When the limit is
+ * reached, the function fails with ETIMEDOUT; it is safe
+ * to continue with `libcoopgamma_flush` or
+ * `libcoopgamma_synchronise` just like EINTR failure
+ * 
+ * @param   ctx      The state of the library
+ * @param   timeout  The limit in milliseconds, -1 for no limit
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_set_timeout(libcoopgamma_context_t *restrict ctx, int timeout)
+{
+	if (timeout < -1 || (timeout >= 0 && ctx->threadsafe)) {
+		errno = EINVAL;
+		return -1;
+	}
+	ctx->timeout = timeout;
+	return 0;
+}
+
+
+/**
+ * Start measuring the time spent in a call that is limited
+ * by `ctx->timeout`, unless an enclosing call already does
+ * 
+ * @param   ctx  The state of the library
+ * @return       Whether `deadline_disarm` shall stop
+ *               the measurement when the call returns
+ */
+static int
+deadline_arm(libcoopgamma_context_t *restrict ctx)
+{
+	if (ctx->timeout < 0 || ctx->deadline_armed)
+		return 0;
+	if (clock_gettime(CLOCK_MONOTONIC, &ctx->deadline))
+		return 0;
+	ctx->deadline.tv_sec += ctx->timeout / 1000;
+	ctx->deadline.tv_nsec += (long int)(ctx->timeout % 1000) * 1000000L;
+	if (ctx->deadline.tv_nsec >= 1000000000L) {
+		ctx->deadline.tv_sec += 1;
+		ctx->deadline.tv_nsec -= 1000000000L;
+	}
+	ctx->deadline_armed = 1;
+	return 1;
+}
+
+
+/**
+ * Stop measuring the time spent in a call
+ * 
+ * @param  ctx    The state of the library
+ * @param  armed  The return value of `deadline_arm`
+ */
+static void
+deadline_disarm(libcoopgamma_context_t *restrict ctx, int armed)
+{
+	if (armed)
+		ctx->deadline_armed = 0;
+}
+
+
+/**
+ * Wait until the connection is ready for I/O, or
+ * until the time limit of the current call expires
+ * 
+ * @param   ctx     The state of the library, must be connected
+ *                  and communication must be blocking
+ * @param   events  The `poll` events to wait for
+ * @return          Zero on success, -1 on error; ETIMEDOUT
+ *                  if the time limit expired
+ */
+static int
+wait_ready(libcoopgamma_context_t *restrict ctx, short events)
+{
+	struct pollfd pollfd;
+	struct timespec now;
+	int timeout = -1, r;
+	intmax_t left;
+
+	if (ctx->deadline_armed) {
+		if (clock_gettime(CLOCK_MONOTONIC, &now))
+			return -1;
+		left = (intmax_t)(ctx->deadline.tv_sec - now.tv_sec) * 1000;
+		left += (ctx->deadline.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+		timeout = left < 0 ? 0 : left > INT_MAX ? INT_MAX : (int)left;
+	}
+
+	pollfd.fd = ctx->fd;
+	pollfd.events = events;
+	pollfd.revents = 0;
+	r = poll(&pollfd, (nfds_t)1, timeout);
+	if (r < 0)
+		return -1;
+	if (!r) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+
+#if defined(HAVE_IO_URING)
+
+/**
+ * The `user_data` of cancellation requests
+ * submitted by `uring_run`
+ */
+# define URING_CANCEL_TAG UINT64_MAX
+
+
+/**
+ * An io_uring instance used to communicate
+ * with the server, see `libcoopgamma_set_io_uring`
+ */
+struct libcoopgamma_uring {
+	/**
+	 * The io_uring file descriptor
+	 */
+	int fd;
+
+	/**
+	 * The number of submitted requests that
+	 * has not been completed
+	 */
+	unsigned outstanding;
+
+	/**
+	 * Bitmask of the `user_data` values of the queued
+	 * requests, other than cancellations, that have
+	 * not been completed
+	 */
+	unsigned incomplete;
+
+	/**
+	 * The mapping of the submission queue ring
+	 */
+	void *sq_ring;
+
+	/**
+	 * The size of `sq_ring`
+	 */
+	size_t sq_ring_size;
+
+	/**
+	 * The mapping of the completion queue ring,
+	 * may be the same as `sq_ring`
+	 */
+	void *cq_ring;
+
+	/**
+	 * The size of `cq_ring`
+	 */
+	size_t cq_ring_size;
+
+	/**
+	 * The submission queue entries
+	 */
+	struct io_uring_sqe *sqes;
+
+	/**
+	 * The size of `sqes`
+	 */
+	size_t sqes_size;
+
+	/**
+	 * The head of the submission queue, updated by the kernel
+	 */
+	unsigned *sq_head;
+
+	/**
+	 * The tail of the submission queue
+	 */
+	unsigned *sq_tail;
+
+	/**
+	 * The mask for indices into the submission queue
+	 */
+	unsigned *sq_mask;
+
+	/**
+	 * The indices of the submitted elements in `sqes`
+	 */
+	unsigned *sq_array;
+
+	/**
+	 * The head of the completion queue
+	 */
+	unsigned *cq_head;
+
+	/**
+	 * The tail of the completion queue, updated by the kernel
+	 */
+	unsigned *cq_tail;
+
+	/**
+	 * The mask for indices into the completion queue
+	 */
+	unsigned *cq_mask;
+
+	/**
+	 * The completion queue entries
+	 */
+	struct io_uring_cqe *cqes;
+};
+
+
+/**
+ * Release an io_uring instance
+ * 
+ * @param  uring  The instance, may be `NULL`
+ */
+static void
+uring_close(struct libcoopgamma_uring *uring)
+{
+	if (!uring)
+		return;
+	if (uring->sqes)
+		munmap(uring->sqes, uring->sqes_size);
+	if (uring->cq_ring && uring->cq_ring != uring->sq_ring)
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	if (uring->sq_ring)
+		munmap(uring->sq_ring, uring->sq_ring_size);
+	if (uring->fd >= 0)
+		close(uring->fd);
+	free(uring);
+}
+
+
+/**
+ * Create an io_uring instance, and check that the kernel
+ * supports everything the library needs
+ * 
+ * @return  The instance, `NULL` on error
+ */
+static struct libcoopgamma_uring *
+uring_open(void)
+{
+	struct libcoopgamma_uring *uring;
+	struct io_uring_params params;
+	struct io_uring_probe *probe;
+	size_t probe_size;
+	char *sq, *cq;
+	int saved_errno, supported;
+
+	uring = calloc(1, sizeof(*uring));
+	if (!uring)
+		return NULL;
+	memset(&params, 0, sizeof(params));
+	uring->fd = (int)syscall(__NR_io_uring_setup, 4U, &params);
+	if (uring->fd < 0)
+		goto fail;
+	if (!(params.features & IORING_FEAT_NODROP)) {
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	probe_size = sizeof(*probe) + 256 * sizeof(probe->ops[0]);
+	probe = calloc(1, probe_size);
+	if (!probe)
+		goto fail;
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PROBE, probe, 256U) < 0) {
+		free(probe);
+		goto fail;
+	}
+	supported = probe->last_op >= IORING_OP_SEND && probe->last_op >= IORING_OP_RECV &&
+	            probe->last_op >= IORING_OP_ASYNC_CANCEL &&
+	            (probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED) &&
+	            (probe->ops[IORING_OP_RECV].flags & IO_URING_OP_SUPPORTED) &&
+	            (probe->ops[IORING_OP_ASYNC_CANCEL].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	if (!supported) {
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring->cq_ring_size > uring->sq_ring_size)
+			uring->sq_ring_size = uring->cq_ring_size;
+		uring->cq_ring_size = uring->sq_ring_size;
+	}
+	sq = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	          uring->fd, (off_t)IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto fail;
+	uring->sq_ring = sq;
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		          uring->fd, (off_t)IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto fail;
+	}
+	uring->cq_ring = cq;
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                   uring->fd, (off_t)IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		goto fail;
+	}
+
+	uring->sq_head  = (unsigned *)(void *)(sq + params.sq_off.head);
+	uring->sq_tail  = (unsigned *)(void *)(sq + params.sq_off.tail);
+	uring->sq_mask  = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+	uring->cq_head  = (unsigned *)(void *)(cq + params.cq_off.head);
+	uring->cq_tail  = (unsigned *)(void *)(cq + params.cq_off.tail);
+	uring->cq_mask  = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+	uring->cqes     = (struct io_uring_cqe *)(void *)(cq + params.cq_off.cqes);
+	return uring;
+
+fail:
+	saved_errno = errno;
+	uring_close(uring);
+	errno = saved_errno;
+	return NULL;
+}
+
+
+/**
+ * Queue a request on an io_uring instance, it will
+ * be submitted by the next call to `uring_run`
+ * 
+ * @param   uring      The instance
+ * @param   opcode     The operation
+ * @param   fd         The file descriptor to operate on
+ * @param   buf        The buffer to operate on
+ * @param   len        The size of `buf`
+ * @param   user_data  The index of the result for `uring_run`
+ * @return             The request, so that the caller can set
+ *                     any additional fields
+ */
+static struct io_uring_sqe *
+uring_queue(struct libcoopgamma_uring *restrict uring, int opcode, int fd, const void *buf, size_t len, uint64_t user_data)
+{
+	unsigned tail = *uring->sq_tail;
+	unsigned index = tail & *uring->sq_mask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (uint8_t)opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = (uint32_t)len;
+	sqe->user_data = user_data;
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->outstanding += 1;
+	if (user_data != URING_CANCEL_TAG)
+		uring->incomplete |= 1U << user_data;
+	return sqe;
+}
+
+
+/**
+ * Queue cancellation of all requests on an io_uring
+ * instance that have not been completed
+ * 
+ * @param  uring  The instance
+ */
+static void
+uring_cancel(struct libcoopgamma_uring *restrict uring)
+{
+	unsigned i;
+	for (i = 0; uring->incomplete >> i; i++)
+		if ((uring->incomplete >> i) & 1)
+			uring_queue(uring, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, URING_CANCEL_TAG)->addr = i;
+}
+
+
+/**
+ * Submit the queued requests on an io_uring instance
+ * and wait for all of them to complete
+ * 
+ * If the wait is interrupted by a signal, the requests
+ * are cancelled, but requests that complete before
+ * they are cancelled report their results as usual
+ * 
+ * If the kernel fails to take the requests, they are
+ * cancelled, and the function does not return until
+ * all of them have completed. If that is impossible,
+ * the io_uring file descriptor is closed, and set to
+ * -1, so that the caller can release the instance,
+ * which terminates the requests
+ * 
+ * @param   uring    The instance
+ * @param   results  Output parameter for the results of the
+ *                   requests, indexed by their `user_data`
+ * @return           1 if interrupted, 0 if not, -1 on error
+ */
+static int
+uring_run(struct libcoopgamma_uring *restrict uring, int32_t *restrict results)
+{
+	struct io_uring_cqe *cqe;
+	unsigned head, submit;
+	long int r;
+	int interrupted = 0, cancelled = 0, error = 0, stalled = 0, reaped;
+
+	while (uring->outstanding) {
+		submit = *uring->sq_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+		r = syscall(__NR_io_uring_enter, uring->fd, submit, 1U, IORING_ENTER_GETEVENTS, NULL, (size_t)0);
+		if (r < 0 && errno != EINTR) {
+			if (!error) {
+				error = errno;
+			} else if (stalled++) {
+				close(uring->fd);
+				uring->fd = -1;
+				uring->outstanding = 0;
+				uring->incomplete = 0;
+				errno = error;
+				return -1;
+			}
+		}
+
+		reaped = 0;
+		head = *uring->cq_head;
+		while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &uring->cqes[head & *uring->cq_mask];
+			if (cqe->user_data != URING_CANCEL_TAG) {
+				results[cqe->user_data] = cqe->res;
+				uring->incomplete &= ~(1U << cqe->user_data);
+			}
+			uring->outstanding -= 1;
+			reaped = 1;
+			head += 1;
+		}
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+		if (reaped)
+			stalled = 0;
+
+		/* If requests were submitted, and the wait is then interrupted,
+		 * the kernel returns the number of submitted requests rather
+		 * than failing with EINTR */
+		if (r < 0 ? errno == EINTR : (!reaped && (unsigned long int)r == submit))
+			interrupted = 1;
+		if ((interrupted || error) && !cancelled) {
+			cancelled = 1;
+			uring_cancel(uring);
+		}
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return interrupted;
+}
+
+
+/**
+ * Receive data from the server using io_uring,
+ * waiting until at least one byte is available
+ * 
+ * @param   uring  The instance
+ * @param   fd     The socket
+ * @param   buf    The buffer to receive data into
+ * @param   size   The size of `buf`
+ * @return         The number of received bytes, -1 on error
+ */
+static ssize_t
+uring_recv(struct libcoopgamma_uring *restrict uring, int fd, void *buf, size_t size)
+{
+	int32_t result;
+	int r;
+
+	uring_queue(uring, IORING_OP_RECV, fd, buf, size, 0);
+	r = uring_run(uring, &result);
+	if (r < 0)
+		return -1;
+	if (result < 0) {
+		errno = (r && result == -ECANCELED) ? EINTR : -result;
+		return -1;
+	}
+	return (ssize_t)result;
+}
+
+
+/**
+ * Send data to the server using io_uring, buffers
+ * are sent with linked requests, so they are sent
+ * in order with a single system call
+ * 
+ * @param   uring  The instance
+ * @param   fd     The socket
+ * @param   iov    The buffers to send
+ * @param   n      The number of elements in `iov`, at most 2
+ * @return         The number of sent bytes, -1 on error
+ */
+static ssize_t
+uring_send(struct libcoopgamma_uring *restrict uring, int fd, const struct iovec *iov, size_t n)
+{
+	struct io_uring_sqe *sqe;
+	int32_t results[2];
+	size_t i, sent = 0;
+	int r;
+
+	for (i = 0; i < n; i++) {
+		sqe = uring_queue(uring, IORING_OP_SEND, fd, iov[i].iov_base, iov[i].iov_len, i);
+		sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		if (i + 1 < n)
+			sqe->flags = IOSQE_IO_LINK;
+	}
+	r = uring_run(uring, results);
+	if (r < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (results[i] < 0) {
+			if (sent)
+				break;
+			errno = (results[i] == -ECANCELED) ? EINTR : -results[i];
+			return -1;
+		}
+		sent += (size_t)results[i];
+		if ((size_t)results[i] < iov[i].iov_len)
+			break;
+	}
+	return (ssize_t)sent;
+}
+
+
+/**
+ * Stop using io_uring if `uring_run` had to abandon
+ * the instance, the context then continues to use
+ * `poll`, `send` and `recv`
+ * 
+ * @param  ctx  The state of the library, must use io_uring
+ */
+static void
+uring_check(libcoopgamma_context_t *restrict ctx)
+{
+	int saved_errno;
+	if (ctx->uring->fd < 0) {
+		saved_errno = errno;
+		uring_close(ctx->uring);
+		ctx->uring = NULL;
+		errno = saved_errno;
+	}
+}
+
+#endif
+
+
+/**
+ * Use, or stop using, io_uring to communicate with the server
+ * 
+ * When io_uring is used, blocking communication waits for and
+ * transfers data with a single system call per transfer, and
+ * the header and payload of a request are sent with linked
+ * requests. io_uring is not used for nonblocking communication
+ * or while the time limit set with `libcoopgamma_set_timeout`
+ * is in effect.
+ * 
+ * @param   ctx     The state of the library
+ * @param   enable  Whether io_uring shall be used
+ * @return          Zero on success, -1 on error. If io_uring
+ *                  is unavailable, `errno` is set to ENOSYS,
+ *                  or another value reported by the kernel,
+ *                  and the context continues to use `poll`,
+ *                  `send` and `recv`
+ */
+int
+libcoopgamma_set_io_uring(libcoopgamma_context_t *restrict ctx, int enable)
+{
+#if defined(HAVE_IO_URING)
+	if (!enable) {
+		uring_close(ctx->uring);
+		ctx->uring = NULL;
+	} else if (ctx->threadsafe) {
+		errno = EINVAL;
+		return -1;
+	} else if (!ctx->uring) {
+		ctx->uring = uring_open();
+		if (!ctx->uring)
+			return -1;
+	}
+	return 0;
+#else
+	if (!enable)
+		return 0;
+	(void) ctx;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Receive data from the server
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   buf       The buffer to receive data into
+ * @param   size      The size of `buf`
+ * @param   dontwait  Fail with EAGAIN rather than wait for data to be
+ *                    received, even if the communication is blocking
+ * @return            The number of received bytes, -1 on error
+ */
+static ssize_t
+receive(libcoopgamma_context_t *restrict ctx, void *buf, size_t size, int dontwait)
+{
+	ssize_t got;
+
+	if (ctx->blocking && !dontwait) {
+#if defined(HAVE_IO_URING)
+		if (ctx->uring && !ctx->deadline_armed) {
+			got = uring_recv(ctx->uring, ctx->fd, buf, size);
+			uring_check(ctx);
+			goto out;
+		}
+#endif
+		if (wait_ready(ctx, POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI) < 0)
+			return -1;
+	}
+	got = recv(ctx->fd, buf, size, dontwait ? MSG_DONTWAIT : 0);
+
+#if defined(HAVE_IO_URING)
+out:
+#endif
+	if (!got) {
+		errno = ECONNRESET;
+		return -1;
+	}
+	return got;
+}
+
+
+/**
+ * Send data to the server
+ * 
+ * @param   ctx    The state of the library, must be connected
+ * @param   iov    The buffers to send
+ * @param   n      The number of elements in `iov`, at most 2
+ * @param   timed  Whether the call is limited by `ctx->timeout`
+ *                 and the communication is blocking
+ * @return         The number of sent bytes, -1 on error
+ */
+static ssize_t
+transmit(libcoopgamma_context_t *restrict ctx, struct iovec *iov, size_t n, int timed)
+{
+	struct msghdr hdr;
+
+#if defined(HAVE_IO_URING)
+	ssize_t sent;
+	if (ctx->uring && ctx->blocking && !ctx->deadline_armed) {
+		sent = uring_send(ctx->uring, ctx->fd, iov, n);
+		uring_check(ctx);
+		return sent;
+	}
+#endif
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = iov;
+	hdr.msg_iovlen = n;
+	return sendmsg(ctx->fd, &hdr, MSG_NOSIGNAL | (timed ? MSG_DONTWAIT : 0));
+}
+
+
+/**
+ * Send all data in `ctx->outbound`
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       Zero on success, -1 on error
+ */
+static int
+flush_outbound(libcoopgamma_context_t *restrict ctx)
+{
+	struct iovec iov;
+	ssize_t sent;
+	size_t chunksize = ctx->outbound_head - ctx->outbound_tail;
+	size_t sendsize;
+	int armed = deadline_arm(ctx);
+	int timed = ctx->deadline_armed && ctx->blocking;
+
+	while (ctx->outbound_tail < ctx->outbound_head) {
+		if (timed && wait_ready(ctx, POLLOUT) < 0)
+			goto fail;
+		sendsize = ctx->outbound_head - ctx->outbound_tail;
+		sendsize = sendsize < chunksize ? sendsize : chunksize;
+		iov.iov_base = ctx->outbound + ctx->outbound_tail;
+		iov.iov_len = sendsize;
+		sent = transmit(ctx, &iov, 1, timed);
+		if (sent < 0) {
+			if (errno == EPIPE)
+				errno = ECONNRESET;
+			if (timed && (errno == EAGAIN || errno == EWOULDBLOCK))
+				continue;
+			if (errno != EMSGSIZE)
+				goto fail;
+			if (!(chunksize >>= 1))
+				goto fail;
+			continue;
+		}
+
+#ifdef DEBUG_MODE
+		fprintf(stderr, "\033[31m");
+		fwrite(ctx->outbound + ctx->outbound_tail, (size_t)sent, 1, stderr);
+		fprintf(stderr, "\033[m");
+		fflush(stderr);
+#endif
+
+		ctx->outbound_tail += (size_t)sent;
+	}
+
+	deadline_disarm(ctx, armed);
+	return 0;
+
+fail:
+	deadline_disarm(ctx, armed);
+	return -1;
+}
+
+
+static int submissions_flush(libcoopgamma_context_t *restrict, int);
+
+
+/**
+ * Send all pending outbound data
+ * 
+ * If this function or another function that sends a request
+ * to the server fails with EINTR, call this function to
+ * complete the transfer. The `async` parameter will always
+ * be in a properly configured state if a function fails
+ * with EINTR.
+ * 
+ * In thread-safe mode, this function fails with EAGAIN
+ * if another thread is already sending; that thread
+ * will also try to send the requests queued before this call.
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       Zero on success, -1 on error
+ */
+int
+libcoopgamma_flush(libcoopgamma_context_t *restrict ctx)
+{
+	if (ctx->threadsafe)
+		return submissions_flush(ctx, 1);
+	return flush_outbound(ctx);
+}
+
+
+/**
+ * Stop sending requests to the server immediately,
+ * and instead queue them until `libcoopgamma_uncork`
+ * has been called once for every call to this function
+ * 
+ * @param  ctx  The state of the library
+ */
+void
+libcoopgamma_cork(libcoopgamma_context_t *restrict ctx)
+{
+	ctx->corked += 1;
+}
+
+
+/**
+ * Undo one call to `libcoopgamma_cork`, and if
+ * it was the last unmatched call, send all
+ * queued requests
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       Zero on success, -1 on error
+ */
+int
+libcoopgamma_uncork(libcoopgamma_context_t *restrict ctx)
+{
+	if (ctx->corked && --ctx->corked)
+		return 0;
+	return libcoopgamma_flush(ctx);
+}
+
+
+/**
+ * Limit the amount of data that may be queued for sending
+ * 
+ * @param   ctx   The state of the library
+ * @param   low   The number of queued bytes at or below which
+ *                requests are accepted again
+ * @param   high  The number of queued bytes at or above which
+ *                requests are refused, 0 for no limit
+ * @return        Zero on success, -1 on error
+ */
+int
+libcoopgamma_set_watermarks(libcoopgamma_context_t *restrict ctx, size_t low, size_t high)
+{
+	if (high && low > high) {
+		errno = EINVAL;
+		return -1;
+	}
+	ctx->outbound_low = low;
+	ctx->outbound_high = high;
+	ctx->throttled = 0;
+	return 0;
+}
+
+
+/**
+ * Check whether requests are refused because too
+ * much data is queued, and update `ctx->throttled`
+ * 
+ * @param   ctx  The state of the library
+ * @return       Whether requests are refused
+ */
+static int
+outbound_throttled(libcoopgamma_context_t *restrict ctx)
+{
+	size_t queued;
+	if (!ctx->outbound_high || ctx->threadsafe)
+		return 0;
+	queued = ctx->outbound_head - ctx->outbound_tail;
+	if (queued <= ctx->outbound_low)
+		ctx->throttled = 0;
+	else if (queued >= ctx->outbound_high)
+		ctx->throttled = 1;
+	return ctx->throttled;
+}
+
+
+/**
+ * Check whether a request would be accepted, or refused
+ * because of the limit set with `libcoopgamma_set_watermarks`
+ * 
+ * @param   ctx  The state of the library
+ * @return       1 if a request would be accepted, 0 otherwise
+ */
+int
+libcoopgamma_writable(libcoopgamma_context_t *restrict ctx)
+{
+	return !outbound_throttled(ctx);
+}
+
+
+/**
+ * Find the first LF or NUL byte in a buffer
+ * 
+ * @param   s  The buffer, not NUL-terminated
+ * @param   n  The size of `s`
+ * @return     The offset of the first LF or NUL byte
+ *             in `s`, `n` if there is none
+ */
+static size_t
+find_special_scalar(const char *s, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n && s[i] != '\n' && s[i]; i++);
+	return i;
+}
+
+
+#if defined(HAVE_SIMD_SCAN)
+
+/**
+ * Find the first LF or NUL byte in a buffer, using SSE2
+ * 
+ * @param   s  The buffer, not NUL-terminated
+ * @param   n  The size of `s`
+ * @return     The offset of the first LF or NUL byte
+ *             in `s`, `n` if there is none
+ */
+static size_t
+find_special_sse2(const char *s, size_t n)
+{
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i nul = _mm_setzero_si128();
+	__m128i v;
+	size_t i;
+	int mask;
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const void *)&s[i]);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, nul)));
+		if (mask)
+			return i + (size_t)__builtin_ctz((unsigned)mask);
+	}
+	return i + find_special_scalar(&s[i], n - i);
+}
+
+
+/**
+ * Find the first LF or NUL byte in a buffer, using AVX2
+ * 
+ * @param   s  The buffer, not NUL-terminated
+ * @param   n  The size of `s`
+ * @return     The offset of the first LF or NUL byte
+ *             in `s`, `n` if there is none
+ */
+__attribute__((__target__("avx2")))
+static size_t
+find_special_avx2(const char *s, size_t n)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i nul = _mm256_setzero_si256();
+	__m256i v;
+	size_t i;
+	int mask;
+	for (i = 0; i + 32 <= n; i += 32) {
+		v = _mm256_loadu_si256((const void *)&s[i]);
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, nul)));
+		if (mask)
+			return i + (size_t)__builtin_ctz((unsigned)mask);
+	}
+	return i + find_special_sse2(&s[i], n - i);
+}
+
+#endif
+
+
+/**
+ * Find the first LF or NUL byte in a buffer, using the
+ * fastest implementation supported by the CPU
+ * 
+ * @param   s  The buffer, not NUL-terminated
+ * @param   n  The size of `s`
+ * @return     The offset of the first LF or NUL byte
+ *             in `s`, `n` if there is none
+ */
+static size_t
+find_special(const char *s, size_t n)
+{
+#if defined(HAVE_SIMD_SCAN)
+	return have_avx2() ? find_special_avx2(s, n) : find_special_sse2(s, n);
+#else
+	return find_special_scalar(s, n);
+#endif
+}
+
+
+/**
+ * Parse the value of a numerical header
+ * 
+ * The value must be the canonical decimal representation
+ * of a non-negative integer: no sign, no leading zeroes
+ * (except in "0"), and no surrounding whitespace. The
+ * conversion, the overflow check, and the validation
+ * are done in a single pass over the string.
+ * 
+ * @param   s    The string to parse, NUL-terminated
+ * @param   max  The greatest acceptable value
+ * @param   out  Output parameter for the value,
+ *               unmodified on failure
+ * @return       Zero on success, -1 if the string is
+ *               not the canonical representation of an
+ *               integer in [0, `max`]
+ */
+static int
+parse_uint(const char *restrict s, uintmax_t max, uintmax_t *restrict out)
+{
+	uintmax_t value = 0, digit;
+	if (*s == '0')
+		return s[1] ? -1 : (*out = 0, 0);
+	if (!*s)
+		return -1;
+	for (; *s; s++) {
+		digit = (uintmax_t)(*s - '0');
+		if (digit > 9 || value > (max - digit) / 10)
+			return -1;
+		value = value * 10 + digit;
+	}
+	*out = value;
+	return 0;
+}
+
+
+/**
+ * Parse the value of a 'Depth' header
+ * 
+ * @param   s    The string to parse, NUL-terminated
+ * @param   out  Output parameter for the data type and
+ *               bit-depth, unmodified on failure
+ * @return       Zero on success, -1 if the string is
+ *               not a recognised depth
+ */
+static int
+parse_depth(const char *restrict s, libcoopgamma_depth_t *restrict out)
+{
+	if      (!strcmp(s, "8"))  *out = LIBCOOPGAMMA_UINT8;
+	else if (!strcmp(s, "16")) *out = LIBCOOPGAMMA_UINT16;
+	else if (!strcmp(s, "32")) *out = LIBCOOPGAMMA_UINT32;
+	else if (!strcmp(s, "64")) *out = LIBCOOPGAMMA_UINT64;
+	else if (!strcmp(s, "f"))  *out = LIBCOOPGAMMA_FLOAT;
+	else if (!strcmp(s, "d"))  *out = LIBCOOPGAMMA_DOUBLE;
+	else
+		return -1;
+	return 0;
+}
+
+
+/**
+ * Headers, in inbound messages, that are recognised
+ * by the library; the value of each constant is the
+ * header's index in `libcoopgamma_context_t.headers`
+ * and is the perfect hash of the header's name
+ * calculated by `header_hash`
+ */
+enum header {
+	HEADER_ERROR          = 0,
+	HEADER_COOPERATIVE    = 1,
+	HEADER_COLOUR_SPACE   = 2,
+	HEADER_BLUE_SIZE      = 4,
+	HEADER_IN_RESPONSE_TO = 5,
+	HEADER_BLUE_Y         = 6,
+	HEADER_BLUE_X         = 7,
+	HEADER_LENGTH         = 10,
+	HEADER_RED_SIZE       = 14,
+	HEADER_COMMAND        = 15,
+	HEADER_RED_Y          = 16,
+	HEADER_RED_X          = 17,
+	HEADER_GREEN_SIZE     = 19,
+	HEADER_TABLES         = 20,
+	HEADER_GREEN_Y        = 21,
+	HEADER_GREEN_X        = 22,
+	HEADER_GAMMA_SUPPORT  = 24,
+	HEADER_DEPTH          = 25,
+	HEADER_WHITE_Y        = 29,
+	HEADER_WHITE_X        = 30
+};
+
+/**
+ * The name of each header in `enum header`,
+ * indexed by the header's hash
+ */
+static const struct {
+	const char *name;
+	size_t len;
+} header_names[32] = {
+#define X(ENUM, NAME) [ENUM] = {NAME, sizeof(NAME) - 1}
+	X(HEADER_ERROR,          "Error"),
+	X(HEADER_COOPERATIVE,    "Cooperative"),
+	X(HEADER_COLOUR_SPACE,   "Colour space"),
+	X(HEADER_BLUE_SIZE,      "Blue size"),
+	X(HEADER_IN_RESPONSE_TO, "In response to"),
+	X(HEADER_BLUE_Y,         "Blue y"),
+	X(HEADER_BLUE_X,         "Blue x"),
+	X(HEADER_LENGTH,         "Length"),
+	X(HEADER_RED_SIZE,       "Red size"),
+	X(HEADER_COMMAND,        "Command"),
+	X(HEADER_RED_Y,          "Red y"),
+	X(HEADER_RED_X,          "Red x"),
+	X(HEADER_GREEN_SIZE,     "Green size"),
+	X(HEADER_TABLES,         "Tables"),
+	X(HEADER_GREEN_Y,        "Green y"),
+	X(HEADER_GREEN_X,        "Green x"),
+	X(HEADER_GAMMA_SUPPORT,  "Gamma support"),
+	X(HEADER_DEPTH,          "Depth"),
+	X(HEADER_WHITE_Y,        "White y"),
+	X(HEADER_WHITE_X,        "White x")
+#undef X
+};
+
+/**
+ * Values associated with the first and last character
+ * of header names by `header_hash`
+ */
+static const unsigned char header_asso[256] = {
+	['B'] = 25, ['C'] = 20, ['D'] = 7, ['E'] = 5, ['G'] = 7,
+	['I'] = 9, ['L'] = 23, ['R'] = 4, ['T'] = 6, ['W'] = 15,
+	['d'] = 20, ['e'] = 2, ['h'] = 13, ['o'] = 14, ['r'] = 22,
+	['s'] = 8, ['t'] = 4, ['x'] = 8, ['y'] = 7
+};
+
+
+/**
+ * Calculate the hash of a header name, the hash
+ * is perfect for the headers in `enum header`
+ * 
+ * @param   name  The name of the header, not NUL-terminated
+ * @param   len   The length of `name`, must be positive
+ * @return        The hash of the name, less than 32
+ */
+static inline size_t
+header_hash(const char *name, size_t len)
+{
+	return (len + header_asso[(unsigned char)name[0]] + header_asso[(unsigned char)name[len - 1]]) & 31;
+}
+
+
+/**
+ * Add a header line of the inbound message to the index
+ * of headers, the line is ignored if it is not a header
+ * in `enum header`
+ * 
+ * @param  ctx   The state of the library, must be connected
+ * @param  line  The header line, NUL-terminated
+ */
+static void
+index_header(libcoopgamma_context_t *restrict ctx, char *line)
+{
+	char *colon = strchr(line, ':');
+	size_t len, hash;
+	if (!colon || colon == line || colon[1] != ' ')
+		return;
+	len = (size_t)(colon - line);
+	hash = header_hash(line, len);
+	if (header_names[hash].len != len || memcmp(header_names[hash].name, line, len))
+		return;
+	if (ctx->headers[hash])
+		ctx->duplicate_headers |= (uint32_t)1 << hash;
+	else
+		ctx->headers[hash] = (size_t)(colon + 2 - (ctx->inbound + ctx->inbound_tail));
+}
+
+
+/**
+ * Get the value of a header in the inbound message
+ * 
+ * @param   ctx     The state of the library, must be connected
+ *                  and have read all headers of the inbound message
+ * @param   header  The header
+ * @return          The value of the first occurrence of the header,
+ *                  `NULL` if the header is missing
+ */
+static inline char *
+header_value(libcoopgamma_context_t *restrict ctx, enum header header)
+{
+	if (!ctx->headers[header])
+		return NULL;
+	return ctx->inbound + ctx->inbound_tail + ctx->headers[header];
+}
+
+
+/**
+ * Get the number of occurrences of a header in the inbound message
+ * 
+ * @param   ctx     The state of the library, must be connected
+ *                  and have read all headers of the inbound message
+ * @param   header  The header
+ * @return          0 if the header is missing, 1 if it occurred
+ *                  once, 2 if it occurred more than once
+ */
+static inline int
+header_count(libcoopgamma_context_t *restrict ctx, enum header header)
+{
+	return !!ctx->headers[header] + (int)((ctx->duplicate_headers >> header) & 1);
+}
+
+
+/**
+ * Forget the headers of the inbound message, this
+ * is done when the entire message has been read
+ * 
+ * @param  ctx  The state of the library
+ */
+static void
+clear_headers(libcoopgamma_context_t *restrict ctx)
+{
+	ctx->have_all_headers = 0;
+	ctx->length = 0;
+	ctx->headers_end = 0;
+	memset(ctx->headers, 0, sizeof(ctx->headers));
+	ctx->duplicate_headers = 0;
+	ctx->oversized = 0;
+}
+
+
+/**
+ * Start receiving the payload of the inbound message directly
+ * into caller-owned memory, the part of the payload that has
+ * already been received is moved there from `ctx->inbound`
+ * 
+ * @param  ctx   The state of the library, must be connected
+ *               and have read all headers of the inbound message
+ * @param  dest  The memory to receive the payload into, must
+ *               have room for `ctx->length` bytes
+ */
+static void
+divert_payload(libcoopgamma_context_t *restrict ctx, void *dest)
+{
+	size_t have = ctx->inbound_head - ctx->curline;
+	have = have < ctx->length ? have : ctx->length;
+	memcpy(dest, ctx->inbound + ctx->curline, have);
+	memmove(ctx->inbound + ctx->curline, ctx->inbound + ctx->curline + have, ctx->inbound_head - ctx->curline - have);
+	ctx->inbound_head -= have;
+	ctx->divert = dest;
+	ctx->diverted = have;
+}
+
+
+/**
+ * The number of consecutive elements in `ctx->inflight`,
+ * starting at the element indexed by the lowest bits of
+ * a message ID, in which the request with that message
+ * ID can be stored
+ */
+#define INFLIGHT_PROBES 8
+
+
+/**
+ * Find the element in `ctx->inflight` for a message ID
+ * 
+ * @param   ctx  The state of the library
+ * @param   id   The message ID
+ * @return       The element, `NULL` if no request
+ *               with the message ID is registered
+ */
+static libcoopgamma_inflight_t *
+inflight_find(libcoopgamma_context_t *restrict ctx, uint32_t id)
+{
+	libcoopgamma_inflight_t *slot;
+	size_t i;
+
+	if (!ctx->inflight)
+		return NULL;
+	for (i = 0; i < INFLIGHT_PROBES; i++) {
+		slot = &ctx->inflight[(id + i) & ctx->inflight_mask];
+		if (slot->async && slot->async->message_id == id)
+			return slot;
+	}
+	return NULL;
+}
+
+
+/**
+ * Find the request that the inbound message is a response to
+ * 
+ * @param   ctx      The state of the library, must have read
+ *                   all headers of the inbound message
+ * @param   pending  Information for each pending request,
+ *                   `NULL` to use requests registered with
+ *                   `libcoopgamma_track`
+ * @param   n        The number of elements in `pending`
+ * @param   indexp   Output parameter for the index of the
+ *                   request in `pending`, or in `ctx->inflight`
+ *                   if `pending` is `NULL`
+ * @return           The request, `NULL` if not found
+ */
+static libcoopgamma_async_context_t *
+find_request(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict pending,
+             size_t n, size_t *restrict indexp)
+{
+	libcoopgamma_inflight_t *slot;
+	size_t i;
+
+	if (!pending) {
+		slot = inflight_find(ctx, ctx->in_response_to);
+		if (!slot)
+			return NULL;
+		*indexp = (size_t)(slot - ctx->inflight);
+		return slot->async;
+	}
 
-	for (n = 0; n < 10000 /* just to be safe */; n++) {
-		if (n >= 4 && (n & -n) == n) {
-			new = realloc(methods, (size_t)(n << 1) * sizeof(*methods));
-			if (!new)
-				goto fail;
-			methods = new;
+	for (i = 0; i < n; i++) {
+		if (pending[i].message_id == ctx->in_response_to) {
+			*indexp = i;
+			return &pending[i];
 		}
-		sprintf(num, "%i", n);
-		if (libcoopgamma_get_method_and_site(num, NULL, &method, NULL))
-			goto fail;
-		if (!strcmp(method, num)) {
-			free(method);
-			break;
+	}
+	return NULL;
+}
+
+
+static int submissions_adopt(libcoopgamma_context_t *restrict);
+
+
+/**
+ * Select the request that the received message is a response to
+ * 
+ * A response to a set-gamma request is first delivered as
+ * the response to each request that the request replaced,
+ * see `libcoopgamma_set_coalescing`; the message is not
+ * discarded until it has been delivered as the response to
+ * the request it actually is a response to
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   pending   See `synchronise`
+ * @param   n         See `synchronise`
+ * @param   selected  See `synchronise`
+ * @return            Zero on success, -1 with `errno` set to 0
+ *                    if the message was ignored
+ */
+static int
+deliver(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict pending,
+        size_t n, size_t *restrict selected)
+{
+	uint32_t id = ctx->redelivering ? ctx->actual_response_to : ctx->in_response_to;
+	size_t i;
+
+	ctx->redelivering = 0;
+	for (i = ctx->superseded_count; i--;) {
+		if (ctx->superseded[i].by != id)
+			continue;
+		ctx->in_response_to = ctx->superseded[i].id;
+		ctx->superseded[i] = ctx->superseded[--ctx->superseded_count];
+		if (find_request(ctx, pending, n, selected)) {
+			ctx->redelivering = 1;
+			ctx->actual_response_to = id;
+			return 0;
 		}
-		methods[n] = method;
-		size += strlen(method) + 1;
 	}
 
-	rc = malloc((size_t)(n + 1) * sizeof(char *) + size);
-	if (!rc)
-		goto fail;
-	buffer = ((char *)rc) + (size_t)(n + 1) * sizeof(char *);
-	rc[n] = NULL;
-	while (n--) {
-		rc[n] = buffer;
-		buffer = stpcpy(buffer, methods[n]) + 1;
-		free(methods[n]);
+	ctx->in_response_to = id;
+	if (find_request(ctx, pending, n, selected))
+		return 0;
+	*selected = 0;
+	ctx->bad_message = 0;
+	clear_headers(ctx);
+	ctx->inbound_tail = ctx->curline;
+	errno = 0;
+	return -1;
+}
+
+
+/**
+ * Arrange for the message last selected by `deliver`
+ * to be selected again by the next synchronisation,
+ * without it being consumed in the meantime
+ * 
+ * @param  ctx  The state of the library, `deliver` must
+ *              have selected a request for the message
+ */
+static void
+defer_delivery(libcoopgamma_context_t *restrict ctx)
+{
+	if (ctx->redelivering) {
+		/* `deliver` removed the replaced request from `ctx->superseded`,
+		 * which therefore has room for it to be put back */
+		ctx->superseded[ctx->superseded_count].id = ctx->in_response_to;
+		ctx->superseded[ctx->superseded_count].by = ctx->actual_response_to;
+		ctx->superseded_count += 1;
+	} else {
+		ctx->redelivering = 1;
+		ctx->actual_response_to = ctx->in_response_to;
 	}
-	free(methods);
+}
 
-	return rc;
 
-fail:
-	while (n--)
-		free(methods[n]);
-	free(methods);
-	return NULL;
+/**
+ * The number of bytes the headers of a received message
+ * may span even if the limit set with
+ * `libcoopgamma_set_inbound_limits` is smaller
+ */
+#define INBOUND_HEADERS_MIN 4096
+
+
+/**
+ * Limit the amount of memory used for received data
+ * 
+ * @param  ctx       The state of the library
+ * @param  max       The largest payload, in bytes, that
+ *                   is received, 0 for no limit
+ * @param  baseline  The size, in bytes, to shrink the buffer
+ *                   to when it is idle, 0 to never shrink it
+ */
+void
+libcoopgamma_set_inbound_limits(libcoopgamma_context_t *restrict ctx, size_t max, size_t baseline)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	/* Round up like `inbound_allocate` does, lest
+	 * the buffer be reallocated every time it is idle */
+	long int page = sysconf(_SC_PAGESIZE);
+	if (page > 0 && baseline)
+		baseline = (baseline + (size_t)page - 1) & ~((size_t)page - 1);
+#endif
+	ctx->inbound_max = max;
+	ctx->inbound_baseline = baseline;
 }
 
 
 /**
- * Run coopgammad with -q or -qq and return the response
+ * Replace `ctx->inbound` with a buffer of
+ * `ctx->inbound_baseline` bytes, between messages
  * 
- * SIGCHLD must not be ignored or blocked
+ * Failure is ignored, the old buffer is kept
  * 
- * @param   method   The adjustment method, `NULL` for automatic
- * @param   site     The site, `NULL` for automatic
- * @param   arg      "-q" or "-qq", which shall be passed to coopgammad?
- * @return           The output of coopgammad, `NULL` on error. This
- *                   will be NUL-terminated and will not contain any
- *                   other `NUL` bytes.
+ * @param  ctx  The state of the library, no part of the next
+ *              message may have been parsed, and the unread
+ *              data must fit in `ctx->inbound_baseline` bytes
  */
-static char *
-libcoopgamma_query(const char *restrict method, const char *restrict site, const char *restrict arg)
+static void
+inbound_shrink(libcoopgamma_context_t *restrict ctx)
 {
-	const char *(args[7]) = {COOPGAMMAD, arg};
-	size_t i = 2, n = 0, size = 0;
-	int pipe_rw[2] = { -1, -1 };
-	pid_t pid;
-	int saved_errno, status;
-	char *msg = NULL;
+	size_t new_size = ctx->inbound_baseline;
+	int new_mirrored;
+	char *new;
+
+	new = inbound_allocate(&new_size, &new_mirrored);
+	if (!new)
+		return;
+	if (new_size >= ctx->inbound_size) {
+		inbound_free(new, new_size, new_mirrored);
+		return;
+	}
+	ctx->inbound_head -= ctx->inbound_tail;
+	memcpy(new, ctx->inbound + ctx->inbound_tail, ctx->inbound_head);
+	inbound_free(ctx->inbound, ctx->inbound_size, ctx->inbound_mirrored);
+	ctx->inbound = new;
+	ctx->inbound_size = new_size;
+	ctx->inbound_mirrored = new_mirrored;
+	ctx->inbound_tail = ctx->curline = 0;
+	count_allocation(ctx);
+}
+
+
+/**
+ * Discard the received part of the payload of a message
+ * that is larger than `ctx->inbound_max`
+ * 
+ * @param  ctx  The state of the library, `ctx->curline`
+ *              must be the beginning of the payload
+ */
+static void
+discard_payload(libcoopgamma_context_t *restrict ctx)
+{
+	size_t have = ctx->inbound_head - ctx->curline;
+	have = have < ctx->discard ? have : ctx->discard;
+	memmove(ctx->inbound + ctx->curline, ctx->inbound + ctx->curline + have, ctx->inbound_head - ctx->curline - have);
+	ctx->inbound_head -= have;
+	ctx->discard -= have;
+}
+
+
+/**
+ * Wait for the next message to be received
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   pending   Information for each pending request, `NULL`
+ *                    to use requests registered with `libcoopgamma_track`
+ * @param   n         The number of elements in `pending`
+ * @param   selected  The index of the element in `pending`, or in
+ *                    `ctx->inflight` if `pending` is `NULL`, which
+ *                    corresponds to the first inbound message; if
+ *                    `pending` is `NULL` it is also set on EBADMSG
+ *                    if the corrupt message identifies its request
+ * @param   dontwait  Fail with EAGAIN rather than wait for data to be
+ *                    received, even if the communication is blocking
+ * @return            Zero on success, -1 on error, see `libcoopgamma_synchronise`
+ */
+static int
+synchronise(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict pending,
+            size_t n, size_t *restrict selected, int dontwait)
+{
+	uintmax_t number;
 	ssize_t got;
-	void *new;
+	size_t i;
+	char *p;
+	char *line;
+	char *end;
+	char *value;
+	size_t new_size, free_size;
+	int new_mirrored;
+	char *new;
+	libcoopgamma_async_context_t *async;
+	libcoopgamma_depth_t depth;
 
-	if (method) args[i++] = "-m", args[i++] = method;
-	if (site)   args[i++] = "-s", args[i++] = site;
-	args[i] = NULL;
+	if (ctx->redelivering)
+		return deliver(ctx, pending, n, selected);
 
-	if (pipe(pipe_rw) < 0)
-		goto fail;
+	if (ctx->inbound_head == ctx->inbound_tail) {
+		ctx->inbound_head = ctx->inbound_tail = ctx->curline = 0;
+	} else if (ctx->inbound_mirrored && ctx->inbound_tail >= ctx->inbound_size) {
+		ctx->inbound_head -= ctx->inbound_size;
+		ctx->inbound_tail -= ctx->inbound_size;
+		ctx->curline -= ctx->inbound_size;
+	}
 
-	switch ((pid = fork())) {
-	case -1:
-		goto fail;
+	if (ctx->inbound_baseline && ctx->inbound_size > ctx->inbound_baseline &&
+	    ctx->curline == ctx->inbound_tail && ctx->inbound_head - ctx->inbound_tail < ctx->inbound_baseline)
+		inbound_shrink(ctx);
 
-	case 0:
-		/* Child */
-		close(pipe_rw[0]);
-		if (pipe_rw[1] != STDOUT_FILENO) {
-			close(STDOUT_FILENO);
-			if (dup2(pipe_rw[1], STDOUT_FILENO) < 0)
-				goto fail_child;
-			close(pipe_rw[1]);
+	if (ctx->corked && ctx->outbound_head != ctx->outbound_tail)
+		if (libcoopgamma_flush(ctx) < 0)
+			return -1;
+
+	if (ctx->inbound_head)
+		goto skip_recv;
+	for (;;) {
+		if (ctx->divert) {
+			got = receive(ctx, ctx->divert + ctx->diverted, ctx->length - ctx->diverted, dontwait);
+			if (got < 0)
+				return -1;
+			ctx->diverted += (size_t)got;
+			goto skip_recv;
 		}
-#if defined(__GNUC__)
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wcast-qual"
-#endif
-		execvp(COOPGAMMAD, (char* const*)(args));
-#if defined(__GNUC__)
-# pragma GCC diagnostic pop
+
+		if (ctx->inbound_mirrored)
+			free_size = ctx->inbound_size - (ctx->inbound_head - ctx->inbound_tail);
+		else
+			free_size = ctx->inbound_size - ctx->inbound_head;
+		if (!free_size && !ctx->inbound_mirrored && ctx->inbound_tail) {
+			memmove(ctx->inbound, ctx->inbound + ctx->inbound_tail, ctx->inbound_head -= ctx->inbound_tail);
+			ctx->curline -= ctx->inbound_tail;
+			free_size = ctx->inbound_tail;
+			ctx->inbound_tail = 0;
+		}
+		if (!free_size) {
+			new_size = ctx->inbound_size ? (ctx->inbound_size << 1) : 1024;
+			new = inbound_allocate(&new_size, &new_mirrored);
+			if (!new)
+				return -1;
+			if (ctx->inbound)
+				memcpy(new, ctx->inbound + ctx->inbound_tail, ctx->inbound_head - ctx->inbound_tail);
+			ctx->inbound_head -= ctx->inbound_tail;
+			inbound_free(ctx->inbound, ctx->inbound_size, ctx->inbound_mirrored);
+			ctx->curline -= ctx->inbound_tail;
+			ctx->inbound_tail = 0;
+			ctx->inbound = new;
+			ctx->inbound_size = new_size;
+			ctx->inbound_mirrored = new_mirrored;
+			count_allocation(ctx);
+			free_size = new_size - ctx->inbound_head;
+		}
+
+		got = receive(ctx, ctx->inbound + ctx->inbound_head, free_size, dontwait);
+		if (got < 0)
+			return -1;
+
+#ifdef DEBUG_MODE
+		fprintf(stderr, "\033[32m");
+		fwrite(ctx->inbound + ctx->inbound_head, (size_t)got, 1, stderr);
+		fprintf(stderr, "\033[m");
+		fflush(stderr);
 #endif
-	fail_child:
-		saved_errno = errno;
-		perror(NAME_OF_THE_PROCESS);
-		if (write(STDOUT_FILENO, &saved_errno, sizeof(int)) != sizeof(int))
-			perror(NAME_OF_THE_PROCESS);
-		exit(1);
 
-	default:
-		/* Parent */
-		close(pipe_rw[1]), pipe_rw[1] = -1;
-		for (;;) {
-			if (n == size) {
-				new = realloc(msg, size = (n ? (n << 1) : 256));
-				if (!new)
-					goto fail;
-				msg = new;
-			}
-			got = read(pipe_rw[0], msg + n, size - n);
-			if (got < 0) {
-				if (errno == EINTR)
-					continue;
-				goto fail;
-			} else if (got == 0) {
+		ctx->inbound_head += (size_t)got;
+
+	skip_recv:
+		if (ctx->discard && !ctx->have_all_headers) {
+			discard_payload(ctx);
+			if (ctx->discard)
+				continue;
+		}
+
+		while (!ctx->have_all_headers) {
+			line = ctx->inbound + ctx->curline;
+			end = ctx->inbound + ctx->inbound_head;
+			for (p = line; (p += find_special(p, (size_t)(end - p))) != end && !*p; p++)
+				ctx->bad_message = 1;
+			if (p == end) {
+				if (ctx->inbound_max && ctx->inbound_head - ctx->inbound_tail > INBOUND_HEADERS_MIN &&
+				    ctx->inbound_head - ctx->inbound_tail > ctx->inbound_max)
+					goto fatal;
 				break;
 			}
-			n += (size_t)got;
+			*p++ = '\0';
+			ctx->curline = (size_t)(p - ctx->inbound);
+			if (*line) {
+				index_header(ctx, line);
+				continue;
+			}
+			ctx->have_all_headers = 1;
+			ctx->headers_end = ctx->curline - ctx->inbound_tail;
+			value = header_value(ctx, HEADER_IN_RESPONSE_TO);
+			if (!value || parse_uint(value, UINT32_MAX, &number))
+				number = 0;
+			ctx->in_response_to = (uint32_t)number;
+			value = header_value(ctx, HEADER_LENGTH);
+			if (value) {
+				if (parse_uint(value, SIZE_MAX, &number))
+					goto fatal;
+				ctx->length = (size_t)number;
+			}
+			if (ctx->inbound_max && ctx->length > ctx->inbound_max) {
+				ctx->oversized = 1;
+				ctx->discard = ctx->length;
+				ctx->length = 0;
+				discard_payload(ctx);
+			}
 		}
-		close(pipe_rw[0]), pipe_rw[0] = -1;
-		if (waitpid(pid, &status, 0) < 0)
-			goto fail;
-		if (status) {
-			errno = EINVAL;
-			if (n == sizeof(int) && *(int *)msg)
-				errno = *(int*)msg;
+
+		if (ctx->have_all_headers && ctx->threadsafe && submissions_adopt(ctx) < 0)
+			return -1;
+
+		if (ctx->have_all_headers && !ctx->bad_message && !ctx->divert && ctx->length) {
+			async = find_request(ctx, pending, n, &i);
+			if (async && async->ramps && async->coalesce && async->ramps_size == ctx->length &&
+			    (value = header_value(ctx, HEADER_DEPTH)) && !parse_depth(value, &depth) &&
+			    depth == async->depth)
+				divert_payload(ctx, async->ramps);
+		}
+
+		if (ctx->divert ? ctx->diverted == ctx->length :
+		    (ctx->have_all_headers && ctx->inbound_head >= ctx->curline + ctx->length)) {
+			if (!ctx->divert)
+				ctx->curline += ctx->length;
+			if (ctx->bad_message) {
+				ctx->bad_message = 0;
+				/* Let `libcoopgamma_dispatch` fail the request, if it can be identified */
+				if (!pending && (value = header_value(ctx, HEADER_IN_RESPONSE_TO)) &&
+				    !parse_uint(value, UINT32_MAX, &number))
+					find_request(ctx, NULL, 0, selected);
+				clear_headers(ctx);
+				ctx->inbound_tail = ctx->curline;
+				errno = EBADMSG;
+				return -1;
+			}
+			return deliver(ctx, pending, n, selected);
 		}
-		break;
 	}
 
-	if (n == size) {
-		new = realloc(msg, n + 1);
-		if (!new)
-			goto fail;
-		msg = new;
+fatal:
+	errno = ENOTRECOVERABLE;
+	return -1;
+}
+
+
+/**
+ * Wait for the next message to be received
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   pending   Information for each pending request
+ * @param   n         The number of elements in `pending`
+ * @param   selected  The index of the element in `pending` which corresponds
+ *                    to the first inbound message, note that this only means
+ *                    that the message is not for any of the other request,
+ *                    if the message is corrupt any of the listed requests can
+ *                    be selected even if it is not for any of the requests.
+ *                    Functions that parse the message will detect such corruption.
+ * @return            Zero on success, -1 on error. If the the message is ignored,
+ *                    which happens if corresponding `libcoopgamma_async_context_t`
+ *                    is not listed, -1 is returned and `errno` is set to 0. If -1
+ *                    is returned, `errno` is set to `ENOTRECOVERABLE` you have
+ *                    received a corrupt message and the context has been tainted
+ *                    beyond recover.
+ */
+int
+libcoopgamma_synchronise(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict pending,
+                         size_t n, size_t *restrict selected)
+{
+	static libcoopgamma_async_context_t none; /* `pending` must not be `NULL` to `synchronise` */
+	int armed = deadline_arm(ctx), r;
+	r = synchronise(ctx, pending ? pending : &none, pending ? n : 0, selected, 0);
+	deadline_disarm(ctx, armed);
+	return r;
+}
+
+
+/**
+ * The type of a request submitted with a
+ * function such as `libcoopgamma_set_gamma_submit`
+ */
+enum inflight_kind {
+	INFLIGHT_GET_CRTCS,
+	INFLIGHT_GET_GAMMA_INFO,
+	INFLIGHT_GET_GAMMA,
+	INFLIGHT_SET_GAMMA
+};
+
+
+/**
+ * The largest number of elements `ctx->inflight` is grown to
+ */
+#define INFLIGHT_MAX_SIZE 16384
+
+
+/**
+ * Rebuild `ctx->inflight` with a new size
+ * 
+ * @param   ctx   The state of the library
+ * @param   size  The new number of elements, a power of two
+ * @return        Zero on success, 1 if the registered requests
+ *                do not fit in a table of size `size`, -1 on error
+ */
+static int
+inflight_resize(libcoopgamma_context_t *restrict ctx, size_t size)
+{
+	libcoopgamma_inflight_t *new, *slot;
+	uint32_t id;
+	size_t i, j;
+
+	new = calloc(size, sizeof(*new));
+	if (!new)
+		return -1;
+	for (i = 0; ctx->inflight && i <= ctx->inflight_mask; i++) {
+		if (!ctx->inflight[i].async)
+			continue;
+		id = ctx->inflight[i].async->message_id;
+		for (j = 0; new[(id + j) & (size - 1)].async; j++) {
+			if (j + 1 == INFLIGHT_PROBES) {
+				free(new);
+				return 1;
+			}
+		}
+		slot = &new[(id + j) & (size - 1)];
+		*slot = ctx->inflight[i];
+		if (slot->async == &ctx->inflight[i].own)
+			slot->async = &slot->own;
 	}
-	msg[n] = '\0';
 
-	if (strchr(msg, '\0') != msg + n) {
-		errno = EBADMSG;
-		goto fail;
+	free(ctx->inflight);
+	ctx->inflight = new;
+	ctx->inflight_mask = size - 1;
+	return 0;
+}
+
+
+/**
+ * Get the element in `ctx->inflight` for a message ID
+ * 
+ * Message IDs are sequential, so requests map to different
+ * elements as long as they span fewer message IDs than the
+ * size of the table. A request whose element is in use by
+ * a long-lived request is stored in one of the following
+ * `INFLIGHT_PROBES - 1` elements instead; the table is only
+ * grown, up to `INFLIGHT_MAX_SIZE` elements, when all of
+ * them are in use. Because only the lowest bits are used,
+ * wraparound of the message IDs is harmless.
+ * 
+ * @param   ctx    The state of the library
+ * @param   id     The message ID
+ * @param   async  The request that may already be using the element
+ * @return         The element, which is either unused or used by
+ *                 `async`, `NULL` on error
+ */
+static libcoopgamma_inflight_t *
+inflight_reserve(libcoopgamma_context_t *restrict ctx, uint32_t id, libcoopgamma_async_context_t *async)
+{
+	libcoopgamma_inflight_t *slot, *unused;
+	size_t i, size;
+	int r;
+
+	for (;;) {
+		if (ctx->inflight) {
+			unused = NULL;
+			for (i = 0; i < INFLIGHT_PROBES; i++) {
+				slot = &ctx->inflight[(id + i) & ctx->inflight_mask];
+				if (async && slot->async == async)
+					return slot;
+				if (!slot->async && !unused)
+					unused = slot;
+			}
+			if (unused)
+				return unused;
+		}
+		size = ctx->inflight ? (ctx->inflight_mask + 1) : 8;
+		do {
+			if (size >= INFLIGHT_MAX_SIZE) {
+				errno = ENOBUFS;
+				return NULL;
+			}
+			size <<= 1;
+		} while ((r = inflight_resize(ctx, size)) > 0);
+		if (r < 0)
+			return NULL;
 	}
+}
 
-	return msg;
 
-fail:
-	saved_errno = errno;
-	if (pipe_rw[0] >= 0)
-		close(pipe_rw[0]);
-	if (pipe_rw[1] >= 0)
-		close(pipe_rw[1]);
-	free(msg);
-	errno = saved_errno;
-	return NULL;
+/**
+ * Register a request so that `libcoopgamma_synchronise_tracked`
+ * can find it without searching
+ * 
+ * @param   ctx     The state of the library
+ * @param   async   Information about the request, must have been sent
+ * @param   cookie  User-defined data to return with `async`
+ * @return          Zero on success, -1 on error
+ */
+int
+libcoopgamma_track(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict async, void *cookie)
+{
+	libcoopgamma_inflight_t *slot = inflight_reserve(ctx, async->message_id, async);
+	if (!slot)
+		return -1;
+	slot->async = async;
+	slot->cookie = cookie;
+	slot->callback = NULL;
+	return 0;
+}
+
+
+/**
+ * Unregister a request registered with `libcoopgamma_track`
+ * 
+ * @param  ctx    The state of the library
+ * @param  async  Information about the request
+ */
+void
+libcoopgamma_untrack(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict async)
+{
+	libcoopgamma_inflight_t *slot = inflight_find(ctx, async->message_id);
+	if (slot && slot->async == async)
+		slot->async = NULL;
 }
 
 
 /**
- * Get the adjustment method and site
- * 
- * SIGCHLD must not be ignored or blocked
+ * Wait for the next message to be received, and select
+ * the request, registered with `libcoopgamma_track`,
+ * it is a response to
  * 
- * @param   method   The adjustment method, `NULL` for automatic
- * @param   site     The site, `NULL` for automatic
- * @param   methodp  Output pointer for the selected adjustment method,
- *                   which cannot be `NULL`. It is safe to call
- *                   this function with this parameter set to `NULL`.
- * @param   sitep    Output pointer for the selected site, which will
- *                   be `NULL` the method only supports one site or if
- *                   `site == NULL` and no site can be selected
- *                   automatically. It is safe to call this function
- *                   with this parameter set to `NULL`.
- * @return           Zero on success, -1 on error
+ * @param   ctx     The state of the library, must be connected
+ * @param   asyncp  Output parameter for the request the message is a response to
+ * @param   cookiep Output parameter for the cookie of the request, may be `NULL`
+ * @return          Zero on success, -1 on error, see `libcoopgamma_synchronise`
  */
 int
-libcoopgamma_get_method_and_site(const char *restrict method, const char *restrict site,
-                                 char **restrict methodp, char **restrict sitep)
+libcoopgamma_synchronise_tracked(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t **restrict asyncp,
+                                 void **restrict cookiep)
 {
-	int saved_errno;
-	char *raw;
-	char *p;
-	char *q;
+	libcoopgamma_inflight_t *slot;
+	size_t i;
+	int armed = deadline_arm(ctx), r;
 
-	raw = libcoopgamma_query(method, site, "-q");
-	if (!raw)
+	r = synchronise(ctx, NULL, 0, &i, 0);
+	deadline_disarm(ctx, armed);
+	if (r)
 		return -1;
 
-	if (methodp) *methodp = NULL;
-	if (sitep)   *sitep   = NULL;
+	slot = &ctx->inflight[i];
+	*asyncp = slot->async;
+	if (cookiep)
+		*cookiep = slot->cookie;
+	slot->async = NULL;
+	return 0;
+}
 
-	p = strchr(raw, '\n');
-	if (!p) {
-		errno = EBADMSG;
-		goto fail;
-	}
-	*p++ = '\0';
 
-	if (methodp) {
-		*methodp = malloc(strlen(raw) + 1);
-		if (!*methodp)
-			goto fail;
-		strcpy(*methodp, raw);
-	}
+/**
+ * Send a message to the server and wait for response
+ * 
+ * The message is formatted directly into `ctx->outbound`
+ * 
+ * @param  resp:char**                  Output parameter for the response,
+ *                                      will be NUL-terminated
+ * @param  ctx:libcoopgamma_context_t*  The state of the library
+ * @param  coalescable:int              Whether the message is a set-gamma request,
+ *                                      which may replace, or be replaced by, another
+ *                                      set-gamma request, see `libcoopgamma_set_coalescing`
+ * @param  payload:void*                Data to append to the end of the message,
+ *                                      it is not copied unless it cannot be sent
+ *                                      immediately
+ * @param  payload_size:size_t          Byte-size of `payload`
+ * @param  format:string-literal        Message formatting string
+ * @param  ...                          Message formatting arguments
+ * 
+ * On error, the macro goes to `fail`. If the limit set with
+ * `libcoopgamma_set_watermarks` has been reached, nothing is
+ * queued and `errno` is set to ENOBUFS.
+ */
+#define SEND_MESSAGE(ctx, coalescable, payload, payload_size, format, ...)\
+	do {\
+		size_t avail__ = (ctx)->outbound_size - (ctx)->outbound_head;\
+		int n__;\
+		if (outbound_throttled(ctx)) {\
+			errno = ENOBUFS;\
+			goto fail;\
+		}\
+		if ((ctx)->outbound_head == (ctx)->outbound_tail)\
+			avail__ = (ctx)->outbound_size;\
+		n__ = snprintf(avail__ ? &(ctx)->outbound[(ctx)->outbound_size - avail__] : NULL,\
+		               avail__, format, __VA_ARGS__);\
+		if (n__ < 0)\
+			goto fail;\
+		if ((size_t)n__ + (payload_size) >= avail__) {\
+			if (outbound_reserve((ctx), (size_t)n__ + (payload_size) + 1) < 0)\
+				goto fail;\
+			sprintf((ctx)->outbound + (ctx)->outbound_head, format, __VA_ARGS__);\
+		} else if ((ctx)->outbound_head == (ctx)->outbound_tail) {\
+			(ctx)->outbound_head = (ctx)->outbound_tail = 0;\
+			(ctx)->coalescable_count = 0;\
+		}\
+		if (send_message((ctx), (size_t)n__, (coalescable), (payload), (payload_size)) < 0)\
+			goto fail;\
+	} while (0)
 
-	if (site && *(q = strchr(p, '\0') - 1)) {
-		if (*q != '\n') {
-			errno = EBADMSG;
-			goto fail;
-		}
-		*q = '\0';
-		*sitep = malloc(strlen(p) + 1);
-		if (!*sitep)
-			goto fail;
-		strcpy(*sitep, p);
-	}
 
-	free(raw);
-	return 0;
+/**
+ * Queued set-gamma request that may be replaced by
+ * a newer request, see `libcoopgamma_set_coalescing`
+ */
+struct libcoopgamma_coalescable {
+	/**
+	 * The offset of the request in `ctx->outbound`
+	 */
+	size_t start;
+
+	/**
+	 * The length of the request, including the payload
+	 */
+	size_t length;
+
+	/**
+	 * The offset, from `start`, of the request's
+	 * 'CRTC' and 'Class' headers
+	 */
+	size_t key;
+
+	/**
+	 * The length of the request's 'CRTC' and 'Class' headers
+	 */
+	size_t key_length;
+
+	/**
+	 * The message ID of the request
+	 */
+	uint32_t id;
+};
 
-fail:
-	saved_errno = errno;
-	if (methodp) {
-		free(*methodp);
-		*methodp = NULL;
+
+/**
+ * Forget the queued set-gamma requests
+ * that have begun being sent
+ * 
+ * @param  ctx  The state of the library
+ */
+static void
+coalescing_prune(libcoopgamma_context_t *restrict ctx)
+{
+	size_t i = 0;
+	while (i < ctx->coalescable_count && ctx->coalescable[i].start < ctx->outbound_tail)
+		i++;
+	if (i) {
+		ctx->coalescable_count -= i;
+		memmove(ctx->coalescable, &ctx->coalescable[i], ctx->coalescable_count * sizeof(*ctx->coalescable));
 	}
-	free(raw);
-	errno = saved_errno;
-	return -1;
 }
 
 
 /**
- * Get the PID file of the coopgamma server
+ * Make sure that there is room for at least a specific
+ * number of bytes after the end of `ctx->outbound`
  * 
- * SIGCHLD must not be ignored or blocked
+ * Queued data is moved to the beginning of the buffer
+ * if that creates enough room, otherwise the buffer is
+ * grown; it is never shrunk, so that a program that
+ * sends messages of a similar size reaches a steady
+ * state where no more allocations are made
  * 
- * @param   method   The adjustment method, `NULL` for automatic
- * @param   site     The site, `NULL` for automatic
- * @return           The pathname of the server's PID file, `NULL` on error
- *                   or if there server does not use PID files. The later
- *                   case is detected by checking that `errno` is set to 0.
+ * @param   ctx  The state of the library
+ * @param   n    The number of bytes required
+ * @return       Zero on success, -1 on error
  */
-char *
-libcoopgamma_get_pid_file(const char *restrict method, const char *restrict site)
+static int
+outbound_reserve(libcoopgamma_context_t *restrict ctx, size_t n)
 {
-	char *path;
-	size_t n;
+	size_t queued = ctx->outbound_head - ctx->outbound_tail;
+	size_t new_size, i;
+	void *new;
 
-	path = libcoopgamma_get_socket_file(method, site);
-	if (!path)
-		return NULL;
+	if (ctx->outbound_size - ctx->outbound_head >= n)
+		return 0;
 
-	n = strlen(path);
-	if (n < 7 || strcmp(path + n - 7, ".socket")) {
-		free(path);
-		errno = EBADMSG;
-		return NULL;
+	if (ctx->outbound_size - queued < n) {
+		new_size = ctx->outbound_size ? ctx->outbound_size : 1024;
+		while (new_size - queued < n)
+			new_size <<= 1;
+		if (!queued) {
+			free(ctx->outbound);
+			ctx->outbound = NULL;
+			ctx->outbound_size = 0;
+		}
+		new = realloc(ctx->outbound, new_size);
+		if (!new)
+			return -1;
+		ctx->outbound = new;
+		ctx->outbound_size = new_size;
+		count_allocation(ctx);
 	}
 
-	strcpy(path + n - 7, ".pid");
-	return path;
+	coalescing_prune(ctx);
+	for (i = 0; i < ctx->coalescable_count; i++)
+		ctx->coalescable[i].start -= ctx->outbound_tail;
+	memmove(ctx->outbound, ctx->outbound + ctx->outbound_tail, queued);
+	ctx->outbound_tail = 0;
+	ctx->outbound_head = queued;
+	return 0;
 }
 
 
 /**
- * Get the socket file of the coopgamma server
- * 
- * SIGCHLD must not be ignored or blocked
+ * Find the 'CRTC' and 'Class' headers of a set-gamma request
  * 
- * @param   method   The adjustment method, `NULL` for automatic
- * @param   site     The site, `NULL` for automatic
- * @return           The pathname of the server's socket, `NULL` on error
- *                   or if there server does have its own socket. The later
- *                   case is detected by checking that `errno` is set to 0,
- *                   and is the case when communicating with a server in a
- *                   multi-server display server like mds.
+ * @param   msg   The request, formatted by `libcoopgamma_set_gamma_send`
+ * @param   lenp  Output parameter for the length of the headers
+ * @return        The offset of the headers in `msg`
  */
-char *
-libcoopgamma_get_socket_file(const char *restrict method, const char *restrict site)
+static size_t
+coalescing_key(const char *msg, size_t *restrict lenp)
 {
-	char *raw;
-	char *p;
-
-	raw = libcoopgamma_query(method, site, "-qq");
-	if (!raw)
-		return NULL;
-
-	p = strchr(raw, '\0') - 1;
-	if (p < raw || *p != '\n') {
-		errno = EBADMSG;
-		goto fail;
-	}
-	*p = '\0';
-	if (!*raw) {
-		errno = EBADMSG;
-		goto fail;
-	}
-
-	return raw;
-fail:
-	free(raw);
-	return NULL;
+	/* The headers are preceded by the 'Command' and 'Message ID'
+	 * headers, and neither value may contain a LF */
+	const char *key = strchr(strchr(msg, '\n') + 1, '\n') + 1;
+	const char *end = strchr(strchr(key, '\n') + 1, '\n') + 1;
+	*lenp = (size_t)(end - key);
+	return (size_t)(key - msg);
 }
 
 
-
 /**
- * Connect to a coopgamma server, and start it if necessary
- * 
- * Use `libcoopgamma_context_destroy` to disconnect
+ * Remove the queued set-gamma request, if any, that a new
+ * set-gamma request for the same CRTC and class replaces,
+ * and record that the response to the new request is also
+ * the response to the removed request
  * 
- * SIGCHLD must not be ignored or blocked
+ * Nothing is removed if memory cannot be allocated
  * 
- * @param   method  The adjustment method, `NULL` for automatic
- * @param   site    The site, `NULL` for automatic
- * @param   ctx     The state of the library, must be initialised
- * @return          Zero on success, -1 on error. On error, `errno` is set
- *                  to 0 if the server could not be initialised.
+ * @param  ctx  The state of the library, the new request shall
+ *              have been formatted into `ctx->outbound` beginning
+ *              at `ctx->outbound_head`, its message ID shall be
+ *              `ctx->message_id`
+ * @param  n    The length of the new request, excluding the payload
  */
-int
-libcoopgamma_connect(const char *restrict method, const char *restrict site, libcoopgamma_context_t *restrict ctx)
+static void
+coalescing_supersede(libcoopgamma_context_t *restrict ctx, size_t n)
 {
-	const char *(args[6]) = {COOPGAMMAD};
-	struct sockaddr_un address;
-	char* path;
-	int saved_errno;
-	int tries = 0, status;
-	pid_t pid;
-	size_t i = 1;
-
-	ctx->blocking = 1;
-
-	if (method) args[i++] = "-m", args[i++] = method;
-	if (site)   args[i++] = "-s", args[i++] = site;
-	args[i] = NULL;
+	struct libcoopgamma_coalescable *old;
+	struct libcoopgamma_superseded *new;
+	const char *key = ctx->outbound + ctx->outbound_head;
+	size_t i, j, key_length, size, end;
+
+	coalescing_prune(ctx);
+	key += coalescing_key(key, &key_length);
+	for (i = 0;; i++) {
+		if (i == ctx->coalescable_count)
+			return;
+		old = &ctx->coalescable[i];
+		if (old->key_length == key_length && !memcmp(ctx->outbound + old->start + old->key, key, key_length))
+			break;
+	}
 
-	path = libcoopgamma_get_socket_file(method, site);
-	if (!path)
-		return -1;
-	if (strlen(path) >= sizeof(address.sun_path)) {
-		free(path);
-		errno = ENAMETOOLONG;
-		return -1;
+	if (ctx->superseded_count == ctx->superseded_size) {
+		size = ctx->superseded_size ? ctx->superseded_size << 1 : 4;
+		new = realloc(ctx->superseded, size * sizeof(*new));
+		if (!new)
+			return;
+		ctx->superseded = new;
+		ctx->superseded_size = size;
 	}
 
-	address.sun_family = AF_UNIX;
-	strcpy(address.sun_path, path);
-	free(path);
-	if ((ctx->fd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0)
-		return -1;
+	/* Requests that the removed request replaced are also replaced */
+	for (j = 0; j < ctx->superseded_count; j++)
+		if (ctx->superseded[j].by == old->id)
+			ctx->superseded[j].by = ctx->message_id;
+	new = &ctx->superseded[ctx->superseded_count++];
+	new->id = old->id;
+	new->by = ctx->message_id;
+
+	end = old->start + old->length;
+	memmove(ctx->outbound + old->start, ctx->outbound + end, ctx->outbound_head + n - end);
+	ctx->outbound_head -= old->length;
+	for (j = i + 1; j < ctx->coalescable_count; j++)
+		ctx->coalescable[j].start -= old->length;
+	ctx->coalescable_count -= 1;
+	memmove(old, old + 1, (ctx->coalescable_count - i) * sizeof(*old));
+}
 
-retry:
-	if (connect(ctx->fd, (struct sockaddr *)&address, (socklen_t)sizeof(address)) < 0) {
-		if ((errno == ECONNREFUSED || errno == ENOENT || errno == ENOTDIR) && !tries++) {
-			switch ((pid = fork())) {
-			case -1:
-				goto fail;
 
-			case 0:
-				/* Child */
-				close(ctx->fd);
-#if defined(__GNUC__)
-# pragma GCC diagnostic push
-# pragma GCC diagnostic ignored "-Wcast-qual"
-#endif
-				execvp(COOPGAMMAD, (char *const *)(args));
-#if defined(__GNUC__)
-# pragma GCC diagnostic pop
-#endif
-				perror(NAME_OF_THE_PROCESS);
-				exit(1);
+/**
+ * Remember a queued set-gamma request so that
+ * it can be replaced by a newer request
+ * 
+ * Nothing is remembered if memory cannot be allocated
+ * 
+ * @param  ctx    The state of the library, the request
+ *                shall end at `ctx->outbound_head`
+ * @param  start  The offset of the request in `ctx->outbound`
+ * @param  id     The message ID of the request
+ */
+static void
+coalescing_add(libcoopgamma_context_t *restrict ctx, size_t start, uint32_t id)
+{
+	struct libcoopgamma_coalescable *new;
+	size_t size;
 
-			default:
-				/* Parent */
-				if (waitpid(pid, &status, 0) < 0)
-					goto fail;
-				if (status) {
-					errno = 0;
-					goto fail;
-				}
-				break;
-			}
-			goto retry;
-		}
-		goto fail;
+	if (ctx->coalescable_count == ctx->coalescable_size) {
+		size = ctx->coalescable_size ? ctx->coalescable_size << 1 : 4;
+		new = realloc(ctx->coalescable, size * sizeof(*new));
+		if (!new)
+			return;
+		ctx->coalescable = new;
+		ctx->coalescable_size = size;
 	}
 
-	return 0;
-
-fail:
-	saved_errno = errno;
-	close(ctx->fd);
-	ctx->fd = -1;
-	errno = saved_errno;
-	return -1;
+	new = &ctx->coalescable[ctx->coalescable_count++];
+	new->start = start;
+	new->length = ctx->outbound_head - start;
+	new->key = coalescing_key(ctx->outbound + start, &new->key_length);
+	new->id = id;
 }
 
 
 /**
- * By default communication is blocking, this function
- * can be used to switch between blocking and nonblocking
- * 
- * After setting the communication to nonblocking,
- * `libcoopgamma_flush`, `libcoopgamma_synchronise` and
- * and request-sending functions can fail with EAGAIN and
- * EWOULDBLOCK. It is safe to continue with `libcoopgamma_flush`
- * (for `libcoopgamma_flush` it selfand equest-sending functions)
- * or `libcoopgamma_synchronise` just like EINTR failure.
+ * Enable or disable coalescing of queued set-gamma requests
  * 
- * @param   ctx          The state of the library, must be connected
- * @param   nonblocking  Nonblocking mode?
- * @return               Zero on success, -1 on error
+ * @param   ctx     The state of the library
+ * @param   enable  Whether requests shall be coalesced
+ * @return          Zero on success, -1 on error
  */
 int
-libcoopgamma_set_nonblocking(libcoopgamma_context_t *restrict ctx, int nonblocking)
+libcoopgamma_set_coalescing(libcoopgamma_context_t *restrict ctx, int enable)
 {
-	int flags = fcntl(ctx->fd, F_GETFL);
-	if (flags == -1)
-		return -1;
-	if (nonblocking)
-		flags |= O_NONBLOCK;
-	else
-		flags &= ~O_NONBLOCK;
-	if (fcntl(ctx->fd, F_SETFL, flags) == -1)
+	if (enable && ctx->threadsafe) {
+		errno = EINVAL;
 		return -1;
-	ctx->blocking = !nonblocking;
+	}
+	ctx->coalescing = !!enable;
+	if (!enable)
+		ctx->coalescable_count = 0;
 	return 0;
 }
 
 
 /**
- * Send all pending outbound data
+ * Get the amount of memory used for buffering and
+ * book-keeping by a `libcoopgamma_context_t`
  * 
- * If this function or another function that sends a request
- * to the server fails with EINTR, call this function to
- * complete the transfer. The `async` parameter will always
- * be in a properly configured state if a function fails
- * with EINTR.
+ * @param   ctx        The state of the library
+ * @param   inboundp   Output parameter for the number of received
+ *                     bytes that have not been parsed, may be `NULL`
+ * @param   outboundp  Output parameter for the number of bytes
+ *                     queued for sending, may be `NULL`
+ * @return             The number of bytes allocated for buffers
+ *                     and tables, not counting the record itself
+ */
+size_t
+libcoopgamma_get_buffer_usage(const libcoopgamma_context_t *restrict ctx, size_t *restrict inboundp, size_t *restrict outboundp)
+{
+	size_t total = ctx->inbound_size + ctx->outbound_size;
+	if (ctx->inflight)
+		total += (ctx->inflight_mask + 1) * sizeof(*ctx->inflight);
+	total += ctx->coalescable_size * sizeof(*ctx->coalescable);
+	total += ctx->superseded_size * sizeof(*ctx->superseded);
+	if (inboundp)
+		*inboundp = ctx->inbound_head - ctx->inbound_tail;
+	if (outboundp)
+		*outboundp = ctx->outbound_head - ctx->outbound_tail;
+	return total;
+}
+
+
+/**
+ * Send a message to the server and wait for response
  * 
- * @param   ctx  The state of the library, must be connected
- * @return       Zero on success, -1 on error
+ * Nothing is sent if `ctx` is corked. Otherwise, if
+ * nothing is queued, the message and the payload
+ * are sent with a single `sendmsg` call without the
+ * payload being copied; only the part of the payload
+ * that could not be sent is copied into the outbound
+ * buffer, so `payload` need not outlive this call
+ * 
+ * @param   ctx           The state of the library, the message shall
+ *                        have been formatted into `ctx->outbound`
+ *                        beginning at `ctx->outbound_head`, and there
+ *                        must be room for `payload_size` additional
+ *                        bytes after it
+ * @param   n             The length of message
+ * @param   coalescable   Whether the message is a set-gamma request
+ * @param   payload       Data to append to the end of the message
+ * @param   payload_size  Byte-size of `payload`
+ * @return                Zero on success, -1 on error
  */
-int
-libcoopgamma_flush(libcoopgamma_context_t *restrict ctx)
+static int
+send_message(libcoopgamma_context_t *restrict ctx, size_t n, int coalescable, const char *payload, size_t payload_size)
 {
+	struct iovec iov[2];
+	size_t off = 0, len, start;
 	ssize_t sent;
-	size_t chunksize = ctx->outbound_head - ctx->outbound_tail;
-	size_t sendsize;
+	int queued, armed, timed, r;
 
-	while (ctx->outbound_tail < ctx->outbound_head) {
-		sendsize = ctx->outbound_head - ctx->outbound_tail;
-		sendsize = sendsize < chunksize ? sendsize : chunksize;
-		sent = send(ctx->fd, ctx->outbound + ctx->outbound_tail, sendsize, MSG_NOSIGNAL);
+	coalescable = coalescable && ctx->coalescing;
+	if (coalescable)
+		coalescing_supersede(ctx, n);
+
+	queued = ctx->outbound_head != ctx->outbound_tail;
+	start = ctx->outbound_head;
+	ctx->outbound_head += n;
+	ctx->message_id += 1;
+
+	if (queued || !payload_size || ctx->corked) {
+		if (payload_size) {
+			memcpy(ctx->outbound + ctx->outbound_head, payload, payload_size);
+			ctx->outbound_head += payload_size;
+		}
+		if (coalescable)
+			coalescing_add(ctx, start, ctx->message_id - 1);
+		return ctx->corked ? 0 : libcoopgamma_flush(ctx);
+	}
+
+	armed = deadline_arm(ctx);
+	timed = ctx->deadline_armed && ctx->blocking;
+	while (off < payload_size) {
+		if (timed && wait_ready(ctx, POLLOUT) < 0)
+			goto queue;
+		iov[0].iov_base = ctx->outbound + ctx->outbound_tail;
+		iov[0].iov_len = ctx->outbound_head - ctx->outbound_tail;
+#if defined(__GNUC__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-qual"
+#endif
+		iov[1].iov_base = (char *)(payload + off);
+#if defined(__GNUC__)
+# pragma GCC diagnostic pop
+#endif
+		iov[1].iov_len = payload_size - off;
+		sent = transmit(ctx, iov[0].iov_len ? &iov[0] : &iov[1], iov[0].iov_len ? 2 : 1, timed);
 		if (sent < 0) {
 			if (errno == EPIPE)
 				errno = ECONNRESET;
-			if (errno != EMSGSIZE)
-				return -1;
-			if (!(chunksize >>= 1))
-				return -1;
-			continue;
+			if (timed && (errno == EAGAIN || errno == EWOULDBLOCK))
+				continue;
+			if (errno == EMSGSIZE) {
+				memcpy(ctx->outbound + ctx->outbound_head, payload + off, payload_size - off);
+				ctx->outbound_head += payload_size - off;
+				r = libcoopgamma_flush(ctx);
+				deadline_disarm(ctx, armed);
+				return r;
+			}
+			goto queue;
 		}
 
 #ifdef DEBUG_MODE
 		fprintf(stderr, "\033[31m");
-		fwrite(ctx->outbound + ctx->outbound_tail, (size_t)sent, 1, stderr);
+		len = (size_t)sent < iov[0].iov_len ? (size_t)sent : iov[0].iov_len;
+		fwrite(iov[0].iov_base, len, 1, stderr);
+		fwrite(iov[1].iov_base, (size_t)sent - len, 1, stderr);
 		fprintf(stderr, "\033[m");
 		fflush(stderr);
 #endif
 
-		ctx->outbound_tail += (size_t)sent;
+		len = ctx->outbound_head - ctx->outbound_tail;
+		len = (size_t)sent < len ? (size_t)sent : len;
+		ctx->outbound_tail += len;
+		off += (size_t)sent - len;
 	}
-
+	deadline_disarm(ctx, armed);
 	return 0;
+
+queue:
+	memcpy(ctx->outbound + ctx->outbound_head, payload + off, payload_size - off);
+	ctx->outbound_head += payload_size - off;
+	deadline_disarm(ctx, armed);
+	return -1;
 }
 
 
 /**
- * Wait for the next message to be received
+ * Request submitted in thread-safe mode
+ */
+struct libcoopgamma_submission {
+	/**
+	 * The next request in the list the request is in
+	 */
+	struct libcoopgamma_submission *next;
+
+	/**
+	 * The message, `NULL` once it has
+	 * been moved to `ctx->outbound`
+	 */
+	char *message;
+
+	/**
+	 * The length of `message`
+	 */
+	size_t length;
+
+	/**
+	 * The request to register in `ctx->inflight`
+	 * once the message has been moved to `ctx->outbound`
+	 */
+	libcoopgamma_inflight_t request;
+};
+
+
+/**
+ * Add requests to the beginning of a list
+ * that is shared between threads
  * 
- * @param   ctx       The state of the library, must be connected
- * @param   pending   Information for each pending request
- * @param   n         The number of elements in `pending`
- * @param   selected  The index of the element in `pending` which corresponds
- *                    to the first inbound message, note that this only means
- *                    that the message is not for any of the other request,
- *                    if the message is corrupt any of the listed requests can
- *                    be selected even if it is not for any of the requests.
- *                    Functions that parse the message will detect such corruption.
- * @return            Zero on success, -1 on error. If the the message is ignored,
- *                    which happens if corresponding `libcoopgamma_async_context_t`
- *                    is not listed, -1 is returned and `errno` is set to 0. If -1
- *                    is returned, `errno` is set to `ENOTRECOVERABLE` you have
- *                    received a corrupt message and the context has been tainted
- *                    beyond recover.
+ * @param  listp  The list
+ * @param  first  The first request to add
+ * @param  last   The last request to add, the requests from `first`
+ *                to `last` must be linked by their `next` members
  */
-int
-libcoopgamma_synchronise(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict pending,
-                         size_t n, size_t *restrict selected)
+static void
+submission_push(struct libcoopgamma_submission **listp, struct libcoopgamma_submission *first,
+                struct libcoopgamma_submission *last)
 {
-	char temp[3 * sizeof(size_t) + 1];
-	ssize_t got;
-	size_t i;
-	char *p;
-	char *line;
-	char *value;
-	struct pollfd pollfd;
-	size_t new_size;
-	void *new;
+#if defined(HAVE_ATOMICS)
+	last->next = __atomic_load_n(listp, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(listp, &last->next, first, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+#else
+	last->next = *listp;
+	*listp = first;
+#endif
+}
 
-	if (ctx->inbound_head == ctx->inbound_tail) {
-		ctx->inbound_head = ctx->inbound_tail = ctx->curline = 0;
-	} else if (ctx->inbound_tail > 0) {
-		memmove(ctx->inbound, ctx->inbound + ctx->inbound_tail, ctx->inbound_head -= ctx->inbound_tail);
-		ctx->curline -= ctx->inbound_tail;
-		ctx->inbound_tail = 0;
+
+/**
+ * Remove all requests from a list that
+ * is shared between threads
+ * 
+ * Only whole lists are removed, so a request cannot
+ * be removed and added back whilst another thread
+ * is adding a request, which could otherwise make
+ * the other thread link its request to a request
+ * that is no longer first in the list
+ * 
+ * @param   listp  The list
+ * @return         The removed requests, in the order they were added
+ */
+static struct libcoopgamma_submission *
+submission_take(struct libcoopgamma_submission **listp)
+{
+	struct libcoopgamma_submission *list, *next, *reversed = NULL;
+#if defined(HAVE_ATOMICS)
+	if (!__atomic_load_n(listp, __ATOMIC_ACQUIRE))
+		return NULL;
+	list = __atomic_exchange_n(listp, NULL, __ATOMIC_SEQ_CST);
+#else
+	list = *listp;
+	*listp = NULL;
+#endif
+	for (; list; list = next) {
+		next = list->next;
+		list->next = reversed;
+		reversed = list;
 	}
+	return reversed;
+}
 
-	pollfd.fd = ctx->fd;
-	pollfd.events = POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI;
 
-	if (ctx->inbound_head)
-		goto skip_recv;
-	for (;;) {
-		if (ctx->inbound_head == ctx->inbound_size) {
-			new_size = ctx->inbound_size ? (ctx->inbound_size << 1) : 1024;
-			new = realloc(ctx->inbound, new_size);
-			if (!new)
-				return -1;
-			ctx->inbound = new;
-			ctx->inbound_size = new_size;
-		}
+/**
+ * Allocate a message ID for a request submitted in
+ * thread-safe mode, and create a context that the
+ * request can be formatted into
+ * 
+ * @param   ctx      The state of the library
+ * @param   scratch  Output parameter for the context that the
+ *                   request shall be formatted into, it is corked
+ *                   so that the request is only queued in it
+ * @return           The message ID of the request
+ */
+static uint32_t
+submission_begin(libcoopgamma_context_t *restrict ctx, libcoopgamma_context_t *restrict scratch)
+{
+	libcoopgamma_context_initialise(scratch);
+	scratch->corked = 1;
+#if defined(HAVE_ATOMICS)
+	scratch->message_id = __atomic_fetch_add(&ctx->message_id, 1, __ATOMIC_RELAXED);
+#else
+	scratch->message_id = ctx->message_id++;
+#endif
+	return scratch->message_id;
+}
 
-		if (ctx->blocking) {
-			pollfd.revents = 0;
-			if (poll(&pollfd, (nfds_t)1, -1) < 0)
-				return -1;
-		}
-		got = recv(ctx->fd, ctx->inbound + ctx->inbound_head, ctx->inbound_size - ctx->inbound_head, 0);
-		if (got <= 0) {
-			if (got == 0)
-				errno = ECONNRESET;
-			return -1;
-		}
 
-#ifdef DEBUG_MODE
-		fprintf(stderr, "\033[32m");
-		fwrite(ctx->inbound + ctx->inbound_head, (size_t)got, 1, stderr);
-		fprintf(stderr, "\033[m");
-		fflush(stderr);
-#endif
+/**
+ * Move the requests submitted in thread-safe mode
+ * to `ctx->outbound`, and hand them over to the
+ * thread that calls `libcoopgamma_dispatch`
+ * 
+ * The caller must be the thread that has set `ctx->flushing`
+ * 
+ * @param   ctx  The state of the library
+ * @return       Zero on success, -1 on error
+ */
+static int
+submissions_drain(libcoopgamma_context_t *restrict ctx)
+{
+	struct libcoopgamma_submission **tailp, *first, *last = NULL;
+	int r = 0;
 
-		ctx->inbound_head += (size_t)got;
+	for (tailp = &ctx->unsent; *tailp; tailp = &(*tailp)->next);
+	*tailp = submission_take(&ctx->submitted);
 
-	skip_recv:
-		while (!ctx->have_all_headers) {
-			line = ctx->inbound + ctx->curline;
-			p = memchr(line, '\n', ctx->inbound_head - ctx->curline);
-			if (!p)
-				break;
-			if (memchr(line, '\0', (size_t)(p - line)) != NULL)
-				ctx->bad_message = 1;
-			*p++ = '\0';
-			ctx->curline = (size_t)(p - ctx->inbound);
-			if (!*line) {
-				ctx->have_all_headers = 1;
-			} else if (strstr(line, "In response to: ") == line) {
-				value = line + (sizeof("In response to: ") - 1);
-				ctx->in_response_to = (uint32_t)atol(value);
-			} else if (strstr(line, "Length: ") == line) {
-				value = line + (sizeof("Length: ") - 1);
-				ctx->length = (size_t)atol(value);
-				sprintf(temp, "%zu", ctx->length);
-				if (strcmp(value, temp))
-					goto fatal;
-			}
+	for (first = ctx->unsent; ctx->unsent; ctx->unsent = ctx->unsent->next) {
+		if (outbound_reserve(ctx, ctx->unsent->length) < 0) {
+			r = -1;
+			break;
 		}
+		memcpy(ctx->outbound + ctx->outbound_head, ctx->unsent->message, ctx->unsent->length);
+		ctx->outbound_head += ctx->unsent->length;
+		free(ctx->unsent->message);
+		ctx->unsent->message = NULL;
+		last = ctx->unsent;
+	}
 
-		if (ctx->have_all_headers && ctx->inbound_head >= ctx->curline + ctx->length) {
-			ctx->curline += ctx->length;
-			if (ctx->bad_message) {
-				ctx->bad_message = 0;
-				ctx->have_all_headers = 0;
-				ctx->length = 0;
-				ctx->inbound_tail = ctx->curline;
-				errno = EBADMSG;
-				return -1;
-			}
-			for (i = 0; i < n; i++) {
-				if (pending[i].message_id == ctx->in_response_to) {
-					*selected = i;
-					return 0;
-				}
-			}
-			*selected = 0;
-			ctx->bad_message = 0;
-			ctx->have_all_headers = 0;
-			ctx->length = 0;
-			ctx->inbound_tail = ctx->curline;
-			errno = 0;
+	/* The requests are handed over before they are sent,
+	 * so they are available when the responses arrive */
+	if (last)
+		submission_push(&ctx->unregistered, first, last);
+	return r;
+}
+
+
+/**
+ * Send the requests submitted in thread-safe mode,
+ * unless another thread is sending them
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   explicit  Whether to fail with EAGAIN, rather than return
+ *                    zero, if another thread is sending the requests
+ * @return            Zero on success, -1 on error
+ */
+static int
+submissions_flush(libcoopgamma_context_t *restrict ctx, int explicit)
+{
+	int r;
+
+	do {
+#if defined(HAVE_ATOMICS)
+		if (__atomic_exchange_n(&ctx->flushing, 1, __ATOMIC_SEQ_CST)) {
+#else
+		if (ctx->flushing) {
+#endif
+			if (!explicit)
+				return 0;
+			errno = EAGAIN;
 			return -1;
 		}
-	}
+		explicit = 0;
+
+		r = submissions_drain(ctx);
+		if (!r)
+			r = flush_outbound(ctx);
+
+		/* A request submitted after `submissions_drain` took
+		 * the list, but before `ctx->flushing` was cleared,
+		 * was left for this thread to send */
+#if defined(HAVE_ATOMICS)
+		__atomic_store_n(&ctx->flushing, 0, __ATOMIC_SEQ_CST);
+	} while (!r && __atomic_load_n(&ctx->submitted, __ATOMIC_SEQ_CST));
+#else
+		ctx->flushing = 0;
+	} while (!r && ctx->submitted);
+#endif
 
-fatal:
-	errno = ENOTRECOVERABLE;
-	return -1;
+	return r;
 }
 
 
 /**
- * Send a message to the server and wait for response
- * 
- * @param  resp:char**                  Output parameter for the response,
- *                                      will be NUL-terminated
- * @param  ctx:libcoopgamma_context_t*  The state of the library
- * @param  payload:void*                Data to append to the end of the message
- * @param  payload_size:size_t          Byte-size of `payload`
- * @param  format:string-literal        Message formatting string
- * @param  ...                          Message formatting arguments
+ * Queue a request submitted in thread-safe mode,
+ * and send it unless another thread is sending
  * 
- * On error, the macro goes to `fail`.
+ * @param   ctx      The state of the library, must be connected
+ * @param   scratch  The context created by `submission_begin`, which
+ *                   the request has been formatted into; it is
+ *                   destroyed by this function
+ * @param   request  The request to register, in `ctx->inflight`,
+ *                   once it has been sent
+ * @param   r        The return value of the function that
+ *                   formatted the request into `scratch`
+ * @return           Zero on success, -1 on error
  */
-#define SEND_MESSAGE(ctx, payload, payload_size, format, ...)\
-	do {\
-		ssize_t n__;\
-		char *msg__;\
-		snprintf(NULL, (size_t)0, format "%zn", __VA_ARGS__, &n__);\
-		msg__ = malloc((size_t)n__ + (payload_size) + (size_t)1);\
-		if (!msg__)\
-			goto fail;\
-		sprintf(msg__, format, __VA_ARGS__);\
-		if (payload)\
-			memcpy(msg__ + n__, (payload), (payload_size));\
-		if (send_message((ctx), msg__, (size_t)n__ + (payload_size)) < 0)\
-			goto fail;\
-	} while (0)
+static int
+submission_commit(libcoopgamma_context_t *restrict ctx, libcoopgamma_context_t *restrict scratch,
+                  const libcoopgamma_inflight_t *restrict request, int r)
+{
+	struct libcoopgamma_submission *submission = NULL;
+	int saved_errno;
+
+	if (!r && (submission = malloc(sizeof(*submission)))) {
+		submission->message = scratch->outbound;
+		submission->length = scratch->outbound_head;
+		submission->request = *request;
+		scratch->outbound = NULL;
+	}
+	saved_errno = errno;
+	libcoopgamma_context_destroy(scratch, 0);
+	errno = saved_errno;
+	if (!submission)
+		return -1;
+
+	submission_push(&ctx->submitted, submission, submission);
+	return submissions_flush(ctx, 0);
+}
 
 
 /**
- * Send a message to the server and wait for response
+ * Register the requests, submitted in thread-safe
+ * mode, that have been moved to `ctx->outbound`,
+ * in `ctx->inflight`
  * 
  * @param   ctx  The state of the library
- * @param   msg  The message to send
- * @param   n    The length of `msg`
  * @return       Zero on success, -1 on error
  */
 static int
-send_message(libcoopgamma_context_t *restrict ctx, char *msg, size_t n)
+submissions_adopt(libcoopgamma_context_t *restrict ctx)
 {
-	void *new;
-	if (ctx->outbound_head == ctx->outbound_tail) {
-		free(ctx->outbound);
-		ctx->outbound = msg;
-		ctx->outbound_tail = 0;
-		ctx->outbound_head = n;
-		ctx->outbound_size = n;
-	} else {
-		if (ctx->outbound_head + n > ctx->outbound_size) {
-			memmove(ctx->outbound, ctx->outbound + ctx->outbound_tail, ctx->outbound_head -= ctx->outbound_tail);
-			ctx->outbound_tail = 0;
-		}
-		if (ctx->outbound_head + n > ctx->outbound_size) {
-			new = realloc(ctx->outbound, ctx->outbound_head + n);
-			if (!new) {
-				free(msg);
-				return -1;
-			}
-			ctx->outbound = new;
-			ctx->outbound_size = ctx->outbound_head + n;
+	struct libcoopgamma_submission *list, *next, *last;
+	libcoopgamma_inflight_t *slot;
+
+	for (list = submission_take(&ctx->unregistered); list; list = next) {
+		slot = inflight_reserve(ctx, list->request.own.message_id, NULL);
+		if (!slot) {
+			for (last = list; last->next; last = last->next);
+			submission_push(&ctx->unregistered, list, last);
+			return -1;
 		}
-		memcpy(ctx->outbound + ctx->outbound_head, msg, n);
-		ctx->outbound_head += n;
-		free(msg);
+		*slot = list->request;
+		slot->async = &slot->own;
+		next = list->next;
+		free(list);
 	}
-	ctx->message_id += 1;
-	return libcoopgamma_flush(ctx);
+	return 0;
 }
 
 
 /**
- * Get the next header of the inbound message
+ * Release the requests submitted in thread-safe
+ * mode that have not been registered in `ctx->inflight`
  * 
- * All headers must be read before the payload is read
+ * @param  ctx  The state of the library
+ */
+static void
+submissions_free(libcoopgamma_context_t *restrict ctx)
+{
+	struct libcoopgamma_submission **lists[] = {&ctx->submitted, &ctx->unsent, &ctx->unregistered};
+	struct libcoopgamma_submission *list, *next;
+	size_t i;
+
+	for (i = 0; i < sizeof(lists) / sizeof(*lists); i++) {
+		for (list = *lists[i]; list; list = next) {
+			next = list->next;
+			free(list->message);
+			free(list);
+		}
+		*lists[i] = NULL;
+	}
+}
+
+
+/**
+ * Enable or disable thread-safe mode
  * 
- * @param   ctx  The state of the library, must be connected
- * @return       The next header line, can never be `NULL`,
- *               the empty string marks the end of the headers.
- *               This memory segment must not be freed.
+ * @param   ctx     The state of the library
+ * @param   enable  Whether thread-safe mode shall be used,
+ *                  when disabling it, no other thread may
+ *                  be using `ctx`
+ * @return          Zero on success, -1 on error
  */
-static char *
-next_header(libcoopgamma_context_t *restrict ctx)
+int
+libcoopgamma_set_threadsafe(libcoopgamma_context_t *restrict ctx, int enable)
 {
-	char *rc = ctx->inbound + ctx->inbound_tail;
-	ctx->inbound_tail += strlen(rc) + 1;
-	return rc;
+#if defined(HAVE_ATOMICS)
+	if (enable) {
+		if (ctx->timeout >= 0 || ctx->uring || ctx->reactor_events || ctx->corked || ctx->coalescing) {
+			errno = EINVAL;
+			return -1;
+		}
+		ctx->threadsafe = 1;
+	} else if (ctx->threadsafe) {
+		/* Requests that have not been sent are
+		 * left in `ctx->outbound` to be flushed */
+		if (submissions_drain(ctx) < 0 || submissions_adopt(ctx) < 0)
+			return -1;
+		ctx->threadsafe = 0;
+	}
+	return 0;
+#else
+	if (!enable)
+		return 0;
+	(void) ctx;
+	errno = ENOSYS;
+	return -1;
+#endif
 }
 
 
@@ -1725,7 +6698,11 @@ next_header(libcoopgamma_context_t *restrict ctx)
  * 
  * Calling this function marks that the inbound message
  * has been fully ready. You must call this function
- * even if you do not expect a payload
+ * even if you do not expect a payload, and the headers
+ * must not be looked up after calling this function
+ * 
+ * If the payload was received directly into caller-owned
+ * gamma ramps, a pointer to those ramps is returned
  * 
  * @param   ctx  The state of the library, must be connected
  * @param   n    Output parameter for the size of the payload
@@ -1736,15 +6713,27 @@ next_header(libcoopgamma_context_t *restrict ctx)
 static char *
 next_payload(libcoopgamma_context_t *restrict ctx, size_t *n)
 {
-	char *rc;
-	ctx->have_all_headers = 0;
-	if ((*n = ctx->length)) {
-		rc = ctx->inbound + ctx->inbound_tail;
-		ctx->inbound_tail += *n;
-		ctx->length = 0;
+	char *rc = NULL;
+	if (ctx->redelivering) {
+		/* The message will be delivered again */
+		*n = ctx->length;
+		if (*n)
+			rc = ctx->divert ? ctx->divert : ctx->inbound + ctx->inbound_tail + ctx->headers_end;
 		return rc;
 	}
-	return NULL;
+	ctx->inbound_tail += ctx->headers_end;
+	if ((*n = ctx->length)) {
+		if (ctx->divert) {
+			rc = ctx->divert;
+			ctx->divert = NULL;
+			ctx->diverted = 0;
+		} else {
+			rc = ctx->inbound + ctx->inbound_tail;
+			ctx->inbound_tail += *n;
+		}
+	}
+	clear_headers(ctx);
+	return rc;
 }
 
 
@@ -1757,7 +6746,6 @@ void
 libcoopgamma_skip_message(libcoopgamma_context_t *restrict ctx)
 {
 	size_t _n;
-	while (*next_header(ctx));
 	(void) next_payload(ctx, &_n);
 }
 
@@ -1778,60 +6766,57 @@ libcoopgamma_skip_message(libcoopgamma_context_t *restrict ctx)
 static int
 check_error(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict async)
 {
-	char temp[3 * sizeof(uint64_t) + 1];
-	size_t old_tail = ctx->inbound_tail;
-	char *line;
+	uintmax_t number;
 	char *value;
-	int command_ok = 0;
-	int have_in_response_to = 0;
-	int have_error = 0;
+	int have_in_response_to;
+	int have_error;
 	int bad = 0;
 	char *payload;
 	size_t n;
 
-	for (;;) {
-		line = next_header(ctx);
-		value = strchr(line, ':') + 2;
-		if (!*line) {
-			break;
-		} else if (!strcmp(line, "Command: error")) {
-			command_ok = 1;
-		} else if (strstr(line, "In response to: ") == line) {
-			uint32_t id = (uint32_t)atol(value);
-			have_in_response_to = 1 + !!have_in_response_to;
-			if (id != async->message_id) {
-				bad = 1;
-			} else {
-				sprintf(temp, "%" PRIu32, id);
-				if (strcmp(value, temp))
-					bad = 1;
-			}
-		} else if (strstr(line, "Error: ") == line) {
-			have_error = 1 + !!have_error;
-			ctx->error.server_side = 1;
-			ctx->error.custom = (strstr(value, "custom") == value);
-			if (ctx->error.custom) {
-				if (value[6] == '\0') {
-					ctx->error.number = 0;
-					continue;
-				} else if (value[6] != ' ') {
-					bad = 1;
-					continue;
-				}
-				value += 7;
-			}
-			ctx->error.number = (uint64_t)atoll(value);
-			sprintf(temp, "%" PRIu64, ctx->error.number);
-			if (strcmp(value, temp))
-				bad = 1;
-		}
+	if (ctx->oversized) {
+		free(ctx->error.description);
+		ctx->error.description = NULL;
+		(void) next_payload(ctx, &n);
+		errno = EMSGSIZE;
+		goto fail;
 	}
 
-	if (!command_ok) {
-		ctx->inbound_tail = old_tail;
+	value = header_value(ctx, HEADER_COMMAND);
+	if (!value || strcmp(value, "error"))
 		return 0;
+
+	have_in_response_to = header_count(ctx, HEADER_IN_RESPONSE_TO);
+	if (have_in_response_to) {
+		value = header_value(ctx, HEADER_IN_RESPONSE_TO);
+		/* `ctx->in_response_to` differs from the header
+		 * when the message is delivered as the response
+		 * to a request that was replaced by another request */
+		if (parse_uint(value, UINT32_MAX, &number) || ctx->in_response_to != async->message_id)
+			bad = 1;
+	}
+
+	have_error = header_count(ctx, HEADER_ERROR);
+	if (have_error) {
+		value = header_value(ctx, HEADER_ERROR);
+		ctx->error.server_side = 1;
+		ctx->error.custom = (strstr(value, "custom") == value);
+		if (ctx->error.custom && value[6] == '\0') {
+			ctx->error.number = 0;
+		} else if (ctx->error.custom && value[6] != ' ') {
+			bad = 1;
+		} else {
+			if (ctx->error.custom)
+				value += 7;
+			if (parse_uint(value, UINT64_MAX, &number))
+				bad = 1;
+			else
+				ctx->error.number = (uint64_t)number;
+		}
 	}
 
+	free(ctx->error.description);
+	ctx->error.description = NULL;
 	payload = next_payload(ctx, &n);
 	if (payload) {
 		if (memchr(payload, '\0', n) || payload[n - 1] != '\n')
@@ -1878,7 +6863,8 @@ int
 libcoopgamma_get_crtcs_send(libcoopgamma_context_t *restrict ctx, libcoopgamma_async_context_t *restrict async)
 {
 	async->message_id = ctx->message_id;
-	SEND_MESSAGE(ctx, NULL, (size_t)0,
+	async->ramps = NULL;
+	SEND_MESSAGE(ctx, 0, NULL, (size_t)0,
 	             "Command: enumerate-crtcs\n"
 	             "Message ID: %" PRIu32 "\n"
 	             "\n",
@@ -1908,20 +6894,15 @@ libcoopgamma_get_crtcs_recv(libcoopgamma_context_t *restrict ctx, libcoopgamma_a
 	char *line;
 	char *payload;
 	char *end;
-	int command_ok = 0;
+	int command_ok;
 	size_t i, n, lines, len, length;
 	char **rc;
 
 	if (check_error(ctx, async))
 		return NULL;
 
-	for (;;) {
-		line = next_header(ctx);
-		if (!*line)
-			break;
-		else if (!strcmp(line, "Command: crtc-enumeration"))
-			command_ok = 1;
-	}
+	line = header_value(ctx, HEADER_COMMAND);
+	command_ok = line && !strcmp(line, "crtc-enumeration");
 
 	payload = next_payload(ctx, &n);
 
@@ -1984,6 +6965,21 @@ libcoopgamma_get_crtcs_sync(libcoopgamma_context_t *restrict ctx)
 }
 
 
+/**
+ * List all available CRTC:s, callback version
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+int
+libcoopgamma_get_crtcs_submit(libcoopgamma_context_t *restrict ctx, libcoopgamma_callback_t *callback, void *user)
+{
+	SUBMIT_CALL(INFLIGHT_GET_CRTCS, libcoopgamma_get_crtcs_send(sender, async));
+}
+
+
 
 /**
  * Retrieve information about a CRTC:s gamma ramps, send request part
@@ -2013,7 +7009,8 @@ libcoopgamma_get_gamma_info_send(const char *restrict crtc, libcoopgamma_context
 #endif
 
 	async->message_id = ctx->message_id;
-	SEND_MESSAGE(ctx, NULL, (size_t)0,
+	async->ramps = NULL;
+	SEND_MESSAGE(ctx, 0, NULL, (size_t)0,
 	             "Command: get-gamma-info\n"
 	             "Message ID: %" PRIu32 "\n"
 	             "CRTC: %s\n"
@@ -2023,7 +7020,7 @@ libcoopgamma_get_gamma_info_send(const char *restrict crtc, libcoopgamma_context
 	return 0;
 fail:
 	copy_errno(ctx);
-	return 0;
+	return -1;
 }
 
 
@@ -2040,19 +7037,21 @@ int
 libcoopgamma_get_gamma_info_recv(libcoopgamma_crtc_info_t *restrict info, libcoopgamma_context_t *restrict ctx,
                                  libcoopgamma_async_context_t *restrict async)
 {
-	char temp[3 * sizeof(size_t) + 1];
-	char *line;
+	static const enum header size_headers[] = {
+		HEADER_RED_SIZE, HEADER_GREEN_SIZE, HEADER_BLUE_SIZE
+	};
+	static const enum header gamut_headers[] = {
+		HEADER_RED_X,   HEADER_RED_Y,   HEADER_GREEN_X, HEADER_GREEN_Y,
+		HEADER_BLUE_X,  HEADER_BLUE_Y,  HEADER_WHITE_X, HEADER_WHITE_Y
+	};
+	uintmax_t number;
 	char *value;
-	size_t _n;
-	int have_cooperative = 0, have_gamma_support = 0, have_colourspace = 0;
-	int have_depth       = 0, have_white_x = 0, have_white_y = 0;
-	int have_red_size    = 0, have_red_x   = 0, have_red_y   = 0;
-	int have_green_size  = 0, have_green_x = 0, have_green_y = 0;
-	int have_blue_size   = 0, have_blue_x  = 0, have_blue_y  = 0;
-	int bad = 0, r = 0, g = 0, b = 0, x = 0;
-	size_t *outz;
-	unsigned *outu;
-	int *have;
+	size_t _n, i;
+	int have_cooperative, have_gamma_support, have_colourspace, have_depth;
+	int have_size[3], have_gamut[8];
+	int bad = 0;
+	size_t *outz[3];
+	unsigned *outu[8];
 
 	if (check_error(ctx, async))
 		return -1;
@@ -2060,91 +7059,81 @@ libcoopgamma_get_gamma_info_recv(libcoopgamma_crtc_info_t *restrict info, libcoo
 	info->cooperative = 0; /* Should be in the response, but ... */
 	info->colourspace = LIBCOOPGAMMA_UNKNOWN;
 
-	for (;;) {
-		line = next_header(ctx);
-		value = strchr(line, ':') + 2;
-		if (!*line) {
-			break;
-		} else if (strstr(line, "Cooperative: ") == line) {
-			have_cooperative = 1 + !!have_cooperative;
-			if      (!strcmp(value, "yes")) info->cooperative = 1;
-			else if (!strcmp(value, "no"))  info->cooperative = 0;
-			else
-				bad = 1;
-		} else if (strstr(line, "Depth: ") == line) {
-			have_depth = 1 + !!have_depth;
-			if      (!strcmp(value, "8"))  info->depth = LIBCOOPGAMMA_UINT8;
-			else if (!strcmp(value, "16")) info->depth = LIBCOOPGAMMA_UINT16;
-			else if (!strcmp(value, "32")) info->depth = LIBCOOPGAMMA_UINT32;
-			else if (!strcmp(value, "64")) info->depth = LIBCOOPGAMMA_UINT64;
-			else if (!strcmp(value, "f"))  info->depth = LIBCOOPGAMMA_FLOAT;
-			else if (!strcmp(value, "d"))  info->depth = LIBCOOPGAMMA_DOUBLE;
-			else
-				bad = 1;
-		} else if (strstr(line, "Gamma support: ") == line) {
-			have_gamma_support = 1 + !!have_gamma_support;
-			if      (!strcmp(value, "yes"))   info->supported = LIBCOOPGAMMA_YES;
-			else if (!strcmp(value, "no"))    info->supported = LIBCOOPGAMMA_NO;
-			else if (!strcmp(value, "maybe")) info->supported = LIBCOOPGAMMA_MAYBE;
-			else
-				bad = 1;
-		} else if ((r = (strstr(line, "Red size: ")   == line)) ||
-			   (g = (strstr(line, "Green size: ") == line)) ||
-			         strstr(line, "Blue size: ")  == line) {
-			if (r)      have_red_size   = 1 + !!have_red_size,   outz = &info->red_size;
-			else if (g) have_green_size = 1 + !!have_green_size, outz = &info->green_size;
-			else        have_blue_size  = 1 + !!have_blue_size,  outz = &info->blue_size;
-			*outz = (size_t)atol(value);
-			sprintf(temp, "%zu", *outz);
-			if (strcmp(value, temp))
-				bad = 1;
-		} else if ((x = r = (strstr(line, "Red x: ")   == line)) ||
-			       (r = (strstr(line, "Red y: ")   == line)) ||
-			   (x = g = (strstr(line, "Green x: ") == line)) ||
-			       (g = (strstr(line, "Green y: ") == line)) ||
-			   (x = b = (strstr(line, "Blue x: ")  == line)) ||
-			       (b = (strstr(line, "Blue y: ")  == line)) ||
-			   (x =     (strstr(line, "White x: ") == line)) ||
-			             strstr(line, "White y: ") == line) {
-			if      (r && x) have = &have_red_x,   outu = &info->red_x;
-			else if (r)      have = &have_red_y,   outu = &info->red_y;
-			else if (g && x) have = &have_green_x, outu = &info->green_x;
-			else if (g)      have = &have_green_y, outu = &info->green_y;
-			else if (b && x) have = &have_blue_x,  outu = &info->blue_x;
-			else if (b)      have = &have_blue_y,  outu = &info->blue_y;
-			else if (x)      have = &have_white_x, outu = &info->white_x;
-			else             have = &have_white_y, outu = &info->white_y;
-			*have = 1 + !!*have;
-			*outu = (unsigned)atoi(value);
-			sprintf(temp, "%u", *outu);
-			if (strcmp(value, temp))
-				bad = 1;
-		} else if (strstr(line, "Colour space: ") == line) {
-			have_colourspace = 1 + !!have_colourspace;
-			if      (!strcmp(value, "sRGB"))    info->colourspace = LIBCOOPGAMMA_SRGB;
-			else if (!strcmp(value, "RGB"))     info->colourspace = LIBCOOPGAMMA_RGB;
-			else if (!strcmp(value, "non-RGB")) info->colourspace = LIBCOOPGAMMA_NON_RGB;
-			else if (!strcmp(value, "grey"))    info->colourspace = LIBCOOPGAMMA_GREY;
-			else
-				info->colourspace = LIBCOOPGAMMA_UNKNOWN;
-		}
+	outz[0] = &info->red_size;
+	outz[1] = &info->green_size;
+	outz[2] = &info->blue_size;
+	outu[0] = &info->red_x,   outu[1] = &info->red_y;
+	outu[2] = &info->green_x, outu[3] = &info->green_y;
+	outu[4] = &info->blue_x,  outu[5] = &info->blue_y;
+	outu[6] = &info->white_x, outu[7] = &info->white_y;
+
+	if ((have_cooperative = header_count(ctx, HEADER_COOPERATIVE))) {
+		value = header_value(ctx, HEADER_COOPERATIVE);
+		if      (!strcmp(value, "yes")) info->cooperative = 1;
+		else if (!strcmp(value, "no"))  info->cooperative = 0;
+		else
+			bad = 1;
+	}
+
+	if ((have_depth = header_count(ctx, HEADER_DEPTH)))
+		if (parse_depth(header_value(ctx, HEADER_DEPTH), &info->depth))
+			bad = 1;
+
+	if ((have_gamma_support = header_count(ctx, HEADER_GAMMA_SUPPORT))) {
+		value = header_value(ctx, HEADER_GAMMA_SUPPORT);
+		if      (!strcmp(value, "yes"))   info->supported = LIBCOOPGAMMA_YES;
+		else if (!strcmp(value, "no"))    info->supported = LIBCOOPGAMMA_NO;
+		else if (!strcmp(value, "maybe")) info->supported = LIBCOOPGAMMA_MAYBE;
+		else
+			bad = 1;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (!(have_size[i] = header_count(ctx, size_headers[i])))
+			continue;
+		value = header_value(ctx, size_headers[i]);
+		if (parse_uint(value, SIZE_MAX, &number))
+			bad = 1;
+		else
+			*outz[i] = (size_t)number;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (!(have_gamut[i] = header_count(ctx, gamut_headers[i])))
+			continue;
+		value = header_value(ctx, gamut_headers[i]);
+		if (parse_uint(value, UINT_MAX, &number))
+			bad = 1;
+		else
+			*outu[i] = (unsigned)number;
+	}
+
+	if ((have_colourspace = header_count(ctx, HEADER_COLOUR_SPACE))) {
+		value = header_value(ctx, HEADER_COLOUR_SPACE);
+		if      (!strcmp(value, "sRGB"))    info->colourspace = LIBCOOPGAMMA_SRGB;
+		else if (!strcmp(value, "RGB"))     info->colourspace = LIBCOOPGAMMA_RGB;
+		else if (!strcmp(value, "non-RGB")) info->colourspace = LIBCOOPGAMMA_NON_RGB;
+		else if (!strcmp(value, "grey"))    info->colourspace = LIBCOOPGAMMA_GREY;
+		else
+			info->colourspace = LIBCOOPGAMMA_UNKNOWN;
 	}
 
 	(void) next_payload(ctx, &_n);
 
-	info->have_gamut = (have_red_x && have_green_x && have_blue_x && have_white_x &&
-			    have_red_y && have_green_y && have_blue_y && have_white_y);
+	info->have_gamut = 1;
+	for (i = 0; i < 8; i++) {
+		info->have_gamut &= !!have_gamut[i];
+		bad |= have_gamut[i] > 1;
+	}
 
-	if (bad || have_gamma_support != 1 || have_red_x > 1 || have_red_y > 1 ||
-	    have_green_x > 1 || have_green_y > 1 || have_blue_x > 1 || have_blue_y > 1 ||
-	    have_white_x > 1 || have_white_y > 1 || have_colourspace > 1) {
+	if (bad || have_gamma_support != 1 || have_colourspace > 1) {
 		errno = EBADMSG;
 		copy_errno(ctx);
 		return -1;
 	}
 	if (info->supported != LIBCOOPGAMMA_NO) {
 		if (have_cooperative > 1 || have_depth != 1 || have_gamma_support != 1 ||
-		    have_red_size != 1 || have_green_size != 1 || have_blue_size != 1) {
+		    have_size[0] != 1 || have_size[1] != 1 || have_size[2] != 1) {
 			errno = EBADMSG;
 			copy_errno(ctx);
 			return -1;
@@ -2180,6 +7169,23 @@ libcoopgamma_get_gamma_info_sync(const char *restrict ctrc, libcoopgamma_crtc_in
 }
 
 
+/**
+ * Retrieve information about a CRTC:s gamma ramps, callback version
+ * 
+ * @param   crtc      The name of the CRTC
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+int
+libcoopgamma_get_gamma_info_submit(const char *restrict crtc, libcoopgamma_context_t *restrict ctx,
+                                   libcoopgamma_callback_t *callback, void *user)
+{
+	SUBMIT_CALL(INFLIGHT_GET_GAMMA_INFO, libcoopgamma_get_gamma_info_send(crtc, sender, async));
+}
+
+
 
 /**
  * Retrieve the current gamma ramp adjustments, send request part
@@ -2210,7 +7216,7 @@ libcoopgamma_get_gamma_send(const libcoopgamma_filter_query_t *restrict query, l
 
 	async->message_id = ctx->message_id;
 	async->coalesce = query->coalesce;
-	SEND_MESSAGE(ctx, NULL, (size_t)0,
+	SEND_MESSAGE(ctx, 0, NULL, (size_t)0,
 	             "Command: get-gamma\n"
 	             "Message ID: %" PRIu32 "\n"
 	             "CRTC: %s\n"
@@ -2229,7 +7235,7 @@ fail:
 
 
 /**
- * Retrieve the current gamma ramp adjustments, receive response part
+ * Parse the response to a `libcoopgamma_get_gamma_send` request
  * 
  * @param   table  Output for the response, must be initialised
  * @param   ctx    The state of the library, must be connected
@@ -2237,22 +7243,23 @@ fail:
  * @return         Zero on success, -1 on error, in which case `ctx->error`
  *                 (rather than `errno`) is read for information about the error
  */
-int
-libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoopgamma_context_t *restrict ctx,
-                            libcoopgamma_async_context_t *restrict async)
+static int
+get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoopgamma_context_t *restrict ctx,
+               libcoopgamma_async_context_t *restrict async)
 {
-	char temp[3 * sizeof(size_t) + 1];
-	char *line;
+	static const enum header size_headers[] = {
+		HEADER_RED_SIZE, HEADER_GREEN_SIZE, HEADER_BLUE_SIZE
+	};
+	uintmax_t number;
 	char *value;
 	char *payload;
-	size_t i, n, width, clutsize;
-	int have_depth = 0;
-	int have_red_size = 0;
-	int have_green_size = 0;
-	int have_blue_size = 0;
-	int have_tables = 0;
-	int bad = 0, r = 0, g = 0;
-	size_t *out;
+	size_t i, n, width, out_width, stops, clutsize;
+	libcoopgamma_depth_t depth;
+	int have_depth;
+	int have_size[3];
+	int have_tables;
+	int bad = 0;
+	size_t *out[3];
 	size_t off, len;
 
 	if (check_error(ctx, async))
@@ -2260,44 +7267,35 @@ libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoop
 
 	libcoopgamma_filter_table_destroy(table);
 
-	for (;;) {
-		line = next_header(ctx);
-		value = strchr(line, ':') + 2;
-		if (!*line) {
-			break;
-		} else if (strstr(line, "Depth: ") == line) {
-			have_depth = 1 + !!have_depth;
-			if      (!strcmp(value, "8"))  table->depth = LIBCOOPGAMMA_UINT8;
-			else if (!strcmp(value, "16")) table->depth = LIBCOOPGAMMA_UINT16;
-			else if (!strcmp(value, "32")) table->depth = LIBCOOPGAMMA_UINT32;
-			else if (!strcmp(value, "64")) table->depth = LIBCOOPGAMMA_UINT64;
-			else if (!strcmp(value, "f"))  table->depth = LIBCOOPGAMMA_FLOAT;
-			else if (!strcmp(value, "d"))  table->depth = LIBCOOPGAMMA_DOUBLE;
-			else
-				bad = 1;
-		} else if ((r = (strstr(line, "Red size: ")   == line)) ||
-		           (g = (strstr(line, "Green size: ") == line)) ||
-		                 strstr(line, "Blue size: ")  == line) {
-			if (r)      have_red_size   = 1 + !!have_red_size,   out = &table->red_size;
-			else if (g) have_green_size = 1 + !!have_green_size, out = &table->green_size;
-			else        have_blue_size  = 1 + !!have_blue_size,  out = &table->blue_size;
-			*out = (size_t)atol(value);
-			sprintf(temp, "%zu", *out);
-			if (strcmp(value, temp))
-				bad = 1;
-		} else if (strstr(line, "Tables: ") == line) {
-			have_tables = 1 + have_tables;
-			table->filter_count = (size_t)atol(value);
-			sprintf(temp, "%zu", table->filter_count);
-			if (strcmp(value, temp))
-				bad = 1;
-		}
+	if ((have_depth = header_count(ctx, HEADER_DEPTH)))
+		if (parse_depth(header_value(ctx, HEADER_DEPTH), &table->depth))
+			bad = 1;
+
+	out[0] = &table->red_size;
+	out[1] = &table->green_size;
+	out[2] = &table->blue_size;
+	for (i = 0; i < 3; i++) {
+		if (!(have_size[i] = header_count(ctx, size_headers[i])))
+			continue;
+		value = header_value(ctx, size_headers[i]);
+		if (parse_uint(value, SIZE_MAX, &number))
+			bad = 1;
+		else
+			*out[i] = (size_t)number;
+	}
+
+	if ((have_tables = header_count(ctx, HEADER_TABLES))) {
+		value = header_value(ctx, HEADER_TABLES);
+		if (parse_uint(value, SIZE_MAX, &number))
+			bad = 1;
+		else
+			table->filter_count = (size_t)number;
 	}
 
 	payload = next_payload(ctx, &n);
 
-	if (bad || have_depth != 1 || have_red_size != 1 || have_green_size != 1 ||
-	    have_blue_size != 1 || (async->coalesce ? have_tables > 1 : !have_tables) ||
+	if (bad || have_depth != 1 || have_size[0] != 1 || have_size[1] != 1 ||
+	    have_size[2] != 1 || (async->coalesce ? have_tables > 1 : !have_tables) ||
 	    ((!payload || !n) && (async->coalesce || table->filter_count > 0)) ||
 	    (n > 0 && have_tables && !table->filter_count) ||
 	    (async->coalesce && have_tables && table->filter_count != 1))
@@ -2313,10 +7311,26 @@ libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoop
 		break;
 	}
 
-	clutsize = table->red_size + table->green_size + table->blue_size;
-	clutsize *= width;
+	depth = async->output_depth ? async->output_depth : table->depth;
+	if (depth_index(depth, &out_width) < 0)
+		goto bad;
+
+	stops = table->red_size + table->green_size + table->blue_size;
+	clutsize = stops * width;
 
-	if (async->coalesce) {
+	if (async->coalesce && payload && payload == async->ramps) {
+		if (n != clutsize || table->depth != async->depth)
+			goto bad;
+		depth = table->depth;
+		table->filters = NULL;
+		table->filter_count = 0;
+	} else if (async->coalesce && async->ramps && depth == async->depth && async->ramps_size == stops * out_width) {
+		if (n != clutsize)
+			goto bad;
+		convert_stops(async->ramps, depth, payload, table->depth, stops);
+		table->filters = NULL;
+		table->filter_count = 0;
+	} else if (async->coalesce) {
 		if (n != clutsize)
 			goto bad;
 		table->filters = malloc(sizeof(*(table->filters)));
@@ -2327,9 +7341,9 @@ libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoop
 		table->filters->ramps.u8.red_size   = table->red_size;
 		table->filters->ramps.u8.green_size = table->green_size;
 		table->filters->ramps.u8.blue_size  = table->blue_size;
-		if (libcoopgamma_ramps_initialise_(&table->filters->ramps, width) < 0)
+		if (libcoopgamma_ramps_initialise_(&table->filters->ramps, out_width) < 0)
 			goto fail;
-		memcpy(table->filters->ramps.u8.red, payload, clutsize);
+		convert_stops(table->filters->ramps.u8.red, depth, payload, table->depth, stops);
 		table->filter_count = 1;
 	} else if (!table->filter_count) {
 		table->filters = NULL;
@@ -2341,7 +7355,7 @@ libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoop
 		for (i = 0; i < table->filter_count; i++) {
 			if (off + sizeof(int64_t) > n)
 				goto bad;
-			table->filters[i].priority = *(int64_t *)(payload + off);
+			memcpy(&table->filters[i].priority, payload + off, sizeof(int64_t));
 			off += sizeof(int64_t);
 			if (!memchr(payload + off, '\0', n - off))
 				goto bad;
@@ -2356,15 +7370,16 @@ libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoop
 			table->filters[i].ramps.u8.red_size   = table->red_size;
 			table->filters[i].ramps.u8.green_size = table->green_size;
 			table->filters[i].ramps.u8.blue_size  = table->blue_size;
-			if (libcoopgamma_ramps_initialise_(&(table->filters[i].ramps), width) < 0)
+			if (libcoopgamma_ramps_initialise_(&(table->filters[i].ramps), out_width) < 0)
 				goto fail;
-			memcpy(table->filters[i].ramps.u8.red, payload + off, clutsize);
+			convert_stops(table->filters[i].ramps.u8.red, depth, payload + off, table->depth, stops);
 			off += clutsize;
 		}
 		if (off != n)
 			goto bad;
 	}
 
+	table->depth = depth;
 	return 0;
 bad:
 	errno = EBADMSG;
@@ -2374,6 +7389,40 @@ fail:
 }
 
 
+/**
+ * Retrieve the current gamma ramp adjustments, receive response part
+ * 
+ * If the ramps was received directly into the ramps registered
+ * with `libcoopgamma_async_context_set_ramps`, `table->filters`
+ * is set to `NULL` and `table->filter_count` is set to 0, but
+ * the other members of `table` are set
+ * 
+ * If a data type was requested with `libcoopgamma_async_context_set_depth`,
+ * the ramp stops are converted to that type as they are copied out of the
+ * received message, and `table->depth` is set to it
+ * 
+ * Ramps registered with `libcoopgamma_async_context_set_ramps`
+ * and the data type requested with `libcoopgamma_async_context_set_depth`
+ * are unregistered, whether or not the function is successful
+ * 
+ * @param   table  Output for the response, must be initialised
+ * @param   ctx    The state of the library, must be connected
+ * @param   async  Information about the request
+ * @return         Zero on success, -1 on error, in which case `ctx->error`
+ *                 (rather than `errno`) is read for information about the error
+ */
+int
+libcoopgamma_get_gamma_recv(libcoopgamma_filter_table_t *restrict table, libcoopgamma_context_t *restrict ctx,
+                            libcoopgamma_async_context_t *restrict async)
+{
+	int ret = get_gamma_recv(table, ctx, async);
+	async->ramps = NULL;
+	async->ramps_size = 0;
+	async->output_depth = 0;
+	return ret;
+}
+
+
 /**
  * Retrieve the current gamma ramp adjustments, synchronous version
  * 
@@ -2399,6 +7448,23 @@ libcoopgamma_get_gamma_sync(const libcoopgamma_filter_query_t *restrict query, l
 }
 
 
+/**
+ * Retrieve the current gamma ramp adjustments, callback version
+ * 
+ * @param   query     The query to send
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+int
+libcoopgamma_get_gamma_submit(const libcoopgamma_filter_query_t *restrict query, libcoopgamma_context_t *restrict ctx,
+                              libcoopgamma_callback_t *callback, void *user)
+{
+	SUBMIT_CALL(INFLIGHT_GET_GAMMA, libcoopgamma_get_gamma_send(query, sender, async));
+}
+
+
 
 /**
  * Apply, update, or remove a gamma ramp adjustment, send request part
@@ -2415,7 +7481,7 @@ int
 libcoopgamma_set_gamma_send(const libcoopgamma_filter_t *restrict filter, libcoopgamma_context_t *restrict ctx,
                             libcoopgamma_async_context_t *restrict async)
 {
-	const void *payload = NULL;
+	const char *payload = NULL;
 	const char *lifespan;
 	char priority[sizeof("Priority: \n") + 3 * sizeof(int64_t)] = {'\0'};
 	char length  [sizeof("Length: \n")   + 3 * sizeof(size_t) ] = {'\0'};
@@ -2459,13 +7525,14 @@ libcoopgamma_set_gamma_send(const libcoopgamma_filter_t *restrict filter, libcoo
 		payload_size += filter->ramps.u8.green_size;
 		payload_size += filter->ramps.u8.blue_size;
 		payload_size *= stopwidth;
-		payload = filter->ramps.u8.red;
+		payload = (const char *)filter->ramps.u8.red;
 		sprintf(priority, "Priority: %" PRIi64 "\n", filter->priority);
 		sprintf(length, "Length: %zu\n", payload_size);
 	}
 
 	async->message_id = ctx->message_id;
-	SEND_MESSAGE(ctx, payload, payload_size,
+	async->ramps = NULL;
+	SEND_MESSAGE(ctx, 1, payload, payload_size,
 	             "Command: set-gamma\n"
 	             "Message ID: %" PRIu32 "\n"
 	             "CRTC: %s\n"
@@ -2499,7 +7566,6 @@ libcoopgamma_set_gamma_recv(libcoopgamma_context_t *restrict ctx, libcoopgamma_a
 	if (check_error(ctx, async))
 		return -(ctx->error.custom || ctx->error.number);
 
-	while (*next_header(ctx));
 	(void) next_payload(ctx, &_n);
 
 	errno = EBADMSG;
@@ -2532,6 +7598,367 @@ libcoopgamma_set_gamma_sync(const libcoopgamma_filter_t *restrict filter, libcoo
 }
 
 
+/**
+ * Apply, update, or remove a gamma ramp adjustment, callback version
+ * 
+ * @param   filter    The filter to apply, update, or remove, gamma ramp meta-data must match the CRTC's
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+int
+libcoopgamma_set_gamma_submit(const libcoopgamma_filter_t *restrict filter, libcoopgamma_context_t *restrict ctx,
+                              libcoopgamma_callback_t *callback, void *user)
+{
+	SUBMIT_CALL(INFLIGHT_SET_GAMMA, libcoopgamma_set_gamma_send(filter, sender, async));
+}
+
+
+/**
+ * Receive and parse all available responses to requests
+ * sent with the callback versions of the request functions,
+ * and call their callback functions
+ * 
+ * If a response to a request registered with `libcoopgamma_track`
+ * is received, the function returns, leaving the response to be
+ * selected by `libcoopgamma_synchronise_tracked`
+ * 
+ * If a corrupt response is received, its request's callback function
+ * is called with EBADMSG, if the response has a readable "In response to"
+ * header; otherwise the function fails with EBADMSG and the request
+ * is lost, as is a request registered with `libcoopgamma_track`
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       The number of callback functions called, -1 on error
+ */
+int
+libcoopgamma_dispatch(libcoopgamma_context_t *restrict ctx)
+{
+	libcoopgamma_inflight_t req;
+	libcoopgamma_crtc_info_t info;
+	libcoopgamma_filter_table_t table;
+	char **crtcs;
+	size_t i;
+	int r, count = 0;
+
+	for (;;) {
+		i = SIZE_MAX;
+		if (synchronise(ctx, NULL, 0, &i, 1)) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return count;
+			if (!errno)
+				continue;
+			if (errno != EBADMSG || i == SIZE_MAX || !ctx->inflight[i].callback)
+				return -1;
+			req = ctx->inflight[i];
+			ctx->inflight[i].async = NULL;
+			copy_errno(ctx);
+			req.callback(ctx, -1, NULL, req.cookie);
+			count += 1;
+			continue;
+		}
+
+		if (!ctx->inflight[i].callback) {
+			/* Registered with `libcoopgamma_track` */
+			defer_delivery(ctx);
+			return count;
+		}
+
+		/* Unregister before calling the callback, which may submit
+		 * new requests and thereby move `ctx->inflight` */
+		req = ctx->inflight[i];
+		ctx->inflight[i].async = NULL;
+		req.async = &req.own;
+
+		switch (req.kind) {
+		case INFLIGHT_GET_CRTCS:
+			crtcs = libcoopgamma_get_crtcs_recv(ctx, req.async);
+			req.callback(ctx, crtcs ? 0 : -1, crtcs, req.cookie);
+			free(crtcs);
+			break;
+
+		case INFLIGHT_GET_GAMMA_INFO:
+			libcoopgamma_crtc_info_initialise(&info);
+			r = libcoopgamma_get_gamma_info_recv(&info, ctx, req.async);
+			req.callback(ctx, r, r ? NULL : &info, req.cookie);
+			libcoopgamma_crtc_info_destroy(&info);
+			break;
+
+		case INFLIGHT_GET_GAMMA:
+			libcoopgamma_filter_table_initialise(&table);
+			r = libcoopgamma_get_gamma_recv(&table, ctx, req.async);
+			req.callback(ctx, r, r ? NULL : &table, req.cookie);
+			libcoopgamma_filter_table_destroy(&table);
+			break;
+
+		default:
+			r = libcoopgamma_set_gamma_recv(ctx, req.async);
+			req.callback(ctx, r, NULL, req.cookie);
+			break;
+		}
+		count += 1;
+	}
+}
+
+
+/**
+ * The number of events `libcoopgamma_reactor_run`
+ * fetches with each call to `epoll_wait`
+ */
+#define REACTOR_EVENTS 64
+
+
+/**
+ * Initialise a `libcoopgamma_reactor_t`
+ * 
+ * @param   reactor  The reactor to initialise
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_reactor_initialise(libcoopgamma_reactor_t *restrict reactor)
+{
+#if defined(__linux__)
+	reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return reactor->epfd < 0 ? -1 : 0;
+#else
+	reactor->epfd = -1;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Release all resources allocated to a `libcoopgamma_reactor_t`,
+ * the allocation of the record itself, and the contexts added
+ * to the reactor, are not freed
+ * 
+ * @param  reactor  The reactor to destroy
+ */
+void
+libcoopgamma_reactor_destroy(libcoopgamma_reactor_t *restrict reactor)
+{
+	if (reactor->epfd >= 0)
+		close(reactor->epfd);
+	reactor->epfd = -1;
+}
+
+
+/**
+ * Get the epoll events a context shall be watched for
+ * 
+ * @param   ctx  The state of the library
+ * @return       The events
+ */
+static int
+reactor_events(const libcoopgamma_context_t *restrict ctx)
+{
+#if defined(__linux__)
+	return (int)(EPOLLIN | EPOLLET) | (ctx->outbound_head > ctx->outbound_tail ? (int)EPOLLOUT : 0);
+#else
+	(void) ctx;
+	return 0;
+#endif
+}
+
+
+/**
+ * Add a context to a reactor
+ * 
+ * The communication of the context is made nonblocking
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library, must be connected
+ *                   and must not already be added to a reactor
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_reactor_add(libcoopgamma_reactor_t *restrict reactor, libcoopgamma_context_t *restrict ctx)
+{
+#if defined(__linux__)
+	struct epoll_event event;
+
+	if (ctx->threadsafe) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (libcoopgamma_set_nonblocking(ctx, 1))
+		return -1;
+	event.events = (uint32_t)reactor_events(ctx);
+	event.data.ptr = ctx;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, ctx->fd, &event))
+		return -1;
+	ctx->reactor_events = (int)event.events;
+	return 0;
+#else
+	(void) reactor;
+	(void) ctx;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Remove a context from a reactor
+ * 
+ * The communication of the context remains nonblocking
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_reactor_remove(libcoopgamma_reactor_t *restrict reactor, libcoopgamma_context_t *restrict ctx)
+{
+#if defined(__linux__)
+	if (!ctx->reactor_events) {
+		errno = ENOENT;
+		return -1;
+	}
+	ctx->reactor_events = 0;
+	return epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, ctx->fd, NULL);
+#else
+	(void) reactor;
+	(void) ctx;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Update the events a reactor watches a context for
+ * 
+ * Call this function after sending requests on a context
+ * that has been added to a reactor, other than from a
+ * callback called by `libcoopgamma_reactor_run`, so that
+ * the reactor sends the remainder of the requests if
+ * they could not be sent immediately
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library, must be added to `reactor`
+ * @return           Zero on success, -1 on error
+ */
+int
+libcoopgamma_reactor_update(libcoopgamma_reactor_t *restrict reactor, libcoopgamma_context_t *restrict ctx)
+{
+#if defined(__linux__)
+	struct epoll_event event;
+
+	if (!ctx->reactor_events) {
+		errno = ENOENT;
+		return -1;
+	}
+	event.events = (uint32_t)reactor_events(ctx);
+	if ((int)event.events == ctx->reactor_events)
+		return 0;
+	event.data.ptr = ctx;
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_MOD, ctx->fd, &event))
+		return -1;
+	ctx->reactor_events = (int)event.events;
+	return 0;
+#else
+	(void) reactor;
+	(void) ctx;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+/**
+ * Remove a context, whose connection has failed, from a reactor,
+ * and call the callbacks of all its submitted requests
+ * 
+ * @param  reactor  The reactor
+ * @param  ctx      The state of the library, `errno` shall
+ *                  describe why the connection failed
+ */
+static void
+reactor_fail(libcoopgamma_reactor_t *restrict reactor, libcoopgamma_context_t *restrict ctx)
+{
+	libcoopgamma_inflight_t req;
+	size_t i;
+
+	copy_errno(ctx);
+	libcoopgamma_reactor_remove(reactor, ctx);
+
+	for (i = 0; ctx->inflight && i <= ctx->inflight_mask; i++) {
+		if (!ctx->inflight[i].async || !ctx->inflight[i].callback)
+			continue;
+		req = ctx->inflight[i];
+		ctx->inflight[i].async = NULL;
+		req.callback(ctx, -1, NULL, req.cookie);
+	}
+}
+
+
+/**
+ * Wait for communication on the contexts added to a reactor,
+ * send pending requests, and call the callbacks of the requests,
+ * submitted with functions such as `libcoopgamma_set_gamma_submit`,
+ * whose responses have been received
+ * 
+ * If the connection of a context fails, the context is removed
+ * from the reactor, and the callbacks of all of its submitted
+ * requests are called with `status` set to -1 and `ctx->error`
+ * describing the failure
+ * 
+ * Callbacks must not remove or destroy any context
+ * 
+ * @param   reactor  The reactor
+ * @param   timeout  The maximum number of milliseconds to wait
+ *                   for communication, -1 to wait indefinitely
+ * @return           The number of callbacks that were called,
+ *                   -1 on error
+ */
+int
+libcoopgamma_reactor_run(libcoopgamma_reactor_t *restrict reactor, int timeout)
+{
+#if defined(__linux__)
+	struct epoll_event events[REACTOR_EVENTS];
+	libcoopgamma_context_t *ctx;
+	int i, n, r, count = 0;
+
+	n = epoll_wait(reactor->epfd, events, REACTOR_EVENTS, timeout);
+	if (n < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		ctx = events[i].data.ptr;
+
+		if ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && ctx->outbound_head > ctx->outbound_tail) {
+			if (libcoopgamma_flush(ctx) < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				reactor_fail(reactor, ctx);
+				continue;
+			}
+		}
+
+		if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			while ((r = libcoopgamma_dispatch(ctx)) < 0 && errno == EBADMSG);
+			if (r < 0) {
+				reactor_fail(reactor, ctx);
+				continue;
+			}
+			count += r;
+		}
+
+		if (libcoopgamma_reactor_update(reactor, ctx))
+			reactor_fail(reactor, ctx);
+	}
+
+	return count;
+#else
+	(void) reactor;
+	(void) timeout;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
 
 #if defined(__GNUC__)
 # pragma GCC diagnostic pop
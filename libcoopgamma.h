@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 
 #if defined(__clang__)
@@ -137,14 +138,14 @@
  * version of `libcoopgamma_context_t`, if it
  * is ever modified, this number is increased
  */
-#define LIBCOOPGAMMA_CONTEXT_VERSION  0
+#define LIBCOOPGAMMA_CONTEXT_VERSION  7
 
 /**
  * Number used to identify implementation
  * version of `libcoopgamma_async_context_t`, if it
  * is ever modified, this number is increased
  */
-#define LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION  0
+#define LIBCOOPGAMMA_ASYNC_CONTEXT_VERSION  1
 
 
 
@@ -702,7 +703,8 @@ typedef struct libcoopgamma_error {
  * 
  * Use of this structure is not thread-safe,
  * create one instance per thread that uses
- * this structure
+ * this structure, unless it is in thread-safe
+ * mode, see `libcoopgamma_set_threadsafe`
  */
 typedef struct libcoopgamma_context {
 	/**
@@ -749,7 +751,8 @@ typedef struct libcoopgamma_context {
 	uint32_t in_response_to;
 
 	/**
-	 * Buffer with the outbound message
+	 * Buffer with the outbound message, messages
+	 * are formatted directly into this buffer
 	 */
 	char *outbound;
 
@@ -770,6 +773,13 @@ typedef struct libcoopgamma_context {
 
 	/**
 	 * Buffer with the inbound message
+	 * 
+	 * If `inbound_mirrored` is set, this is a ring
+	 * buffer whose memory is mapped twice, directly
+	 * after each other, so that unread data can
+	 * always be read contiguously from `inbound_tail`
+	 * even if `inbound_head` is greater than
+	 * `inbound_size`
 	 */
 	char *inbound;
 
@@ -784,7 +794,8 @@ typedef struct libcoopgamma_context {
 	size_t inbound_tail;
 
 	/**
-	 * The allocation size of `inbound`
+	 * The allocation size of `inbound`,
+	 * not counting the mirror
 	 */
 	size_t inbound_size;
 
@@ -800,6 +811,295 @@ typedef struct libcoopgamma_context {
 	 */
 	size_t curline;
 
+	/**
+	 * The offset, from the beginning of the inbound
+	 * message, of the payload, only set once
+	 * `libcoopgamma_synchronise` has read all headers
+	 */
+	size_t headers_end;
+
+	/**
+	 * Index of the headers in the inbound message
+	 * 
+	 * Each element corresponds to one header the
+	 * library recognises, and is selected by a
+	 * perfect hash of the header's name; it holds
+	 * the offset, from the beginning of the inbound
+	 * message, of the header's value, or 0 if the
+	 * header is not present
+	 */
+	size_t headers[32];
+
+	/**
+	 * Caller-owned gamma ramps that the payload of
+	 * the inbound message is being received directly
+	 * into, `NULL` if the payload is received into
+	 * `inbound`
+	 */
+	char *divert;
+
+	/**
+	 * The number of bytes of the payload of the
+	 * inbound message that has been received
+	 * into `divert`
+	 */
+	size_t diverted;
+
+	/**
+	 * The number of times `outbound` or `inbound`
+	 * has been allocated or reallocated
+	 * 
+	 * Unless `inbound_baseline` is set, the buffers
+	 * are never shrunk, so this number stops increasing
+	 * once a program that sends and receives messages
+	 * of similar sizes has reached a steady state
+	 */
+	size_t allocations;
+
+	/**
+	 * Whether `inbound` is a mirrored ring buffer
+	 */
+	int inbound_mirrored;
+
+	/**
+	 * The number of unmatched calls to `libcoopgamma_cork`,
+	 * outbound messages are queued rather than sent while
+	 * this is nonzero
+	 */
+	int corked;
+
+	/**
+	 * Bitmask of the elements in `headers` for which
+	 * the header occurred more than once
+	 */
+	uint32_t duplicate_headers;
+
+#if INT_MAX != LONG_MAX
+	int padding__;
+#endif
+
+	/**
+	 * Table of requests registered with `libcoopgamma_track`,
+	 * indexed by the lowest bits of their message IDs, or
+	 * stored in one of the following few elements if that
+	 * element is in use
+	 * 
+	 * This table is not marshalled
+	 */
+	struct libcoopgamma_inflight *inflight;
+
+	/**
+	 * The number of elements in `inflight` less one,
+	 * the number of elements is always a power of two
+	 */
+	size_t inflight_mask;
+
+	/**
+	 * The state of the connection being established with
+	 * `libcoopgamma_connect_start`, `NULL` if none
+	 * 
+	 * This state is not marshalled
+	 */
+	struct libcoopgamma_connection *connection;
+
+	/**
+	 * The maximum number of milliseconds a call may
+	 * block, -1 for no limit, see `libcoopgamma_set_timeout`
+	 */
+	int timeout;
+
+	/**
+	 * Whether `deadline` applies to the current call
+	 * 
+	 * This member is not marshalled
+	 */
+	int deadline_armed;
+
+	/**
+	 * The time, on the `CLOCK_MONOTONIC` clock,
+	 * at which the current call shall time out
+	 * 
+	 * This member is not marshalled
+	 */
+	struct timespec deadline;
+
+	/**
+	 * The epoll events the context is watched for by
+	 * the reactor it has been added to, 0 if none
+	 * 
+	 * This member is not marshalled
+	 */
+	int reactor_events;
+
+#if INT_MAX != LONG_MAX
+	int padding2__;
+#endif
+
+	/**
+	 * The io_uring instance used to communicate with the
+	 * server, `NULL` if none, see `libcoopgamma_set_io_uring`
+	 * 
+	 * This member is not marshalled
+	 */
+	struct libcoopgamma_uring *uring;
+
+	/**
+	 * Whether the context is in thread-safe mode,
+	 * see `libcoopgamma_set_threadsafe`
+	 * 
+	 * This member is not marshalled
+	 */
+	int threadsafe;
+
+	/**
+	 * Whether a thread is sending requests submitted
+	 * in thread-safe mode, only the thread that sets
+	 * this member may use `outbound`
+	 * 
+	 * This member is not marshalled
+	 */
+	int flushing;
+
+	/**
+	 * Requests submitted in thread-safe mode that have
+	 * not yet been picked up for sending, most recently
+	 * submitted request first
+	 * 
+	 * This list is not marshalled
+	 */
+	struct libcoopgamma_submission *submitted;
+
+	/**
+	 * Requests, in submission order, that have been
+	 * picked up for sending but did not fit in `outbound`
+	 * 
+	 * This list is not marshalled
+	 */
+	struct libcoopgamma_submission *unsent;
+
+	/**
+	 * Requests that have been moved to `outbound`
+	 * but not yet registered in `inflight`
+	 * 
+	 * This list is not marshalled
+	 */
+	struct libcoopgamma_submission *unregistered;
+
+	/**
+	 * Whether a queued set-gamma request is replaced by
+	 * a newer request for the same CRTC and class, see
+	 * `libcoopgamma_set_coalescing`
+	 */
+	int coalescing;
+
+	/**
+	 * Whether the inbound message is being delivered
+	 * again, as a response to a request that was
+	 * replaced by the request it is a response to
+	 */
+	int redelivering;
+
+	/**
+	 * The ID of the message the inbound message is
+	 * a response to, whilst `redelivering` is set
+	 */
+	uint32_t actual_response_to;
+
+#if INT_MAX != LONG_MAX
+	int padding3__;
+#endif
+
+	/**
+	 * Queued set-gamma requests that no part of has
+	 * been sent, in the order they are queued
+	 * 
+	 * This list is not marshalled
+	 */
+	struct libcoopgamma_coalescable *coalescable;
+
+	/**
+	 * The number of elements in `coalescable`
+	 */
+	size_t coalescable_count;
+
+	/**
+	 * The allocation size of `coalescable`
+	 */
+	size_t coalescable_size;
+
+	/**
+	 * Set-gamma requests that were replaced by newer
+	 * requests before they were sent, and whose
+	 * responses have not yet been delivered
+	 */
+	struct libcoopgamma_superseded *superseded;
+
+	/**
+	 * The number of elements in `superseded`
+	 */
+	size_t superseded_count;
+
+	/**
+	 * The allocation size of `superseded`
+	 */
+	size_t superseded_size;
+
+	/**
+	 * The number of queued bytes in `outbound` at or below
+	 * which requests are accepted again after the number has
+	 * reached `outbound_high`, see `libcoopgamma_set_watermarks`
+	 */
+	size_t outbound_low;
+
+	/**
+	 * The number of queued bytes in `outbound` at or above
+	 * which requests are refused, 0 for no limit, see
+	 * `libcoopgamma_set_watermarks`
+	 */
+	size_t outbound_high;
+
+	/**
+	 * Whether requests are refused because the number of
+	 * queued bytes has reached `outbound_high` and has not
+	 * yet fallen to `outbound_low`
+	 */
+	int throttled;
+
+#if INT_MAX != LONG_MAX
+	int padding4__;
+#endif
+
+	/**
+	 * The largest payload, in bytes, of an inbound message
+	 * that is received rather than discarded, 0 for no limit,
+	 * see `libcoopgamma_set_inbound_limits`
+	 */
+	size_t inbound_max;
+
+	/**
+	 * The size `inbound` is shrunk to when it holds no
+	 * unread data, 0 to never shrink it, see
+	 * `libcoopgamma_set_inbound_limits`
+	 */
+	size_t inbound_baseline;
+
+	/**
+	 * The number of bytes of the payload of an inbound
+	 * message larger than `inbound_max` that have not
+	 * yet been received and discarded
+	 */
+	size_t discard;
+
+	/**
+	 * Whether the payload of the inbound message is
+	 * larger than `inbound_max` and is discarded
+	 */
+	int oversized;
+
+#if INT_MAX != LONG_MAX
+	int padding5__;
+#endif
+
 } libcoopgamma_context_t;
 
 
@@ -822,9 +1122,213 @@ typedef struct libcoopgamma_async_context {
 	 */
 	int coalesce;
 
+	/**
+	 * Caller-owned gamma ramps, registered with
+	 * `libcoopgamma_async_context_set_ramps`, that
+	 * the response shall be received directly into,
+	 * `NULL` if none are registered
+	 */
+	void *ramps;
+
+	/**
+	 * The byte-size of the gamma ramps in `ramps`
+	 */
+	size_t ramps_size;
+
+	/**
+	 * The data type and bit-depth of the ramp
+	 * stops in `ramps`
+	 */
+	libcoopgamma_depth_t depth;
+
+#if INT_MAX != LONG_MAX
+	int padding__;
+#endif
+
+	/**
+	 * The data type and bit-depth the ramp stops in
+	 * the response shall be converted to, set with
+	 * `libcoopgamma_async_context_set_depth`,
+	 * 0 for none
+	 */
+	libcoopgamma_depth_t output_depth;
+
+#if INT_MAX != LONG_MAX
+	int padding2__;
+#endif
+
 } libcoopgamma_async_context_t;
 
 
+/**
+ * Function called by `libcoopgamma_dispatch` when
+ * the response to a request has been received
+ * 
+ * @param  ctx     The state of the library
+ * @param  status  Zero if the request was successful, -1 on error,
+ *                 in which case `ctx->error` (rather than `errno`)
+ *                 is read for information about the error
+ * @param  result  The parsed response, only valid until the function
+ *                 returns: a `char **` (as returned by
+ *                 `libcoopgamma_get_crtcs_recv`) for
+ *                 `libcoopgamma_get_crtcs_submit`, a
+ *                 `libcoopgamma_crtc_info_t *` for
+ *                 `libcoopgamma_get_gamma_info_submit`, a
+ *                 `libcoopgamma_filter_table_t *` for
+ *                 `libcoopgamma_get_gamma_submit`, and `NULL`
+ *                 for `libcoopgamma_set_gamma_submit` and on error
+ * @param  user    The user-defined pointer the request was submitted with
+ */
+typedef void libcoopgamma_callback_t(libcoopgamma_context_t *restrict, int, void *, void *);
+
+
+/**
+ * Request registered with `libcoopgamma_track`,
+ * or submitted with a function such as
+ * `libcoopgamma_set_gamma_submit`
+ */
+typedef struct libcoopgamma_inflight {
+	/* All members are internal. */
+
+	/**
+	 * Information about the request, `NULL`
+	 * if the element is unused
+	 */
+	libcoopgamma_async_context_t *async;
+
+	/**
+	 * The user-defined cookie for the request
+	 */
+	void *cookie;
+
+	/**
+	 * The function to call when the response has
+	 * been received, `NULL` if the request was
+	 * registered with `libcoopgamma_track`
+	 */
+	libcoopgamma_callback_t *callback;
+
+	/**
+	 * Storage for `*async` for submitted requests
+	 */
+	libcoopgamma_async_context_t own;
+
+	/**
+	 * The type of the request, used to select the
+	 * function that parses the response
+	 */
+	int kind;
+
+#if INT_MAX != LONG_MAX
+	int padding__;
+#endif
+
+} libcoopgamma_inflight_t;
+
+
+/**
+ * Event loop that drives the communication of
+ * many contexts, see `libcoopgamma_reactor_run`
+ */
+typedef struct libcoopgamma_reactor {
+	/**
+	 * The epoll file descriptor, -1 if none
+	 */
+	int epfd;
+
+} libcoopgamma_reactor_t;
+
+
+/**
+ * Methods of interpolation, used to resample gamma ramps
+ */
+typedef enum libcoopgamma_interpolation {
+	/**
+	 * Linear interpolation
+	 */
+	LIBCOOPGAMMA_LINEAR = 0,
+
+	/**
+	 * Monotone cubic Hermite interpolation, with
+	 * harmonic-mean slopes, which never overshoots
+	 * and keeps monotone ramps monotone
+	 */
+	LIBCOOPGAMMA_MONOTONE_CUBIC = 1
+
+} libcoopgamma_interpolation_t;
+
+
+/**
+ * Weights for resampling a ramp to another
+ * size, cached by `libcoopgamma_resampler_t`
+ */
+typedef struct libcoopgamma_resample_table {
+	/* All members are internal. */
+
+	/**
+	 * The number of stops in the input ramp
+	 */
+	size_t src_size;
+
+	/**
+	 * The number of stops in the output ramp
+	 */
+	size_t dst_size;
+
+	/**
+	 * For each output stop, the index of the
+	 * input stop at or immediately before it
+	 */
+	size_t *index;
+
+	/**
+	 * The weights of the input stops (and, for
+	 * `LIBCOOPGAMMA_MONOTONE_CUBIC`, the slopes)
+	 * at and after `index`, stored as 2 or 4
+	 * consecutive arrays of `dst_size` elements
+	 */
+	double *weights;
+
+} libcoopgamma_resample_table_t;
+
+
+/**
+ * Gamma ramp resampler, see `libcoopgamma_ramps_resample`
+ */
+typedef struct libcoopgamma_resampler {
+	/**
+	 * The method of interpolation
+	 */
+	libcoopgamma_interpolation_t method;
+
+#if INT_MAX != LONG_MAX
+	int padding__;
+#endif
+
+	/**
+	 * The number of elements in `tables`
+	 */
+	size_t table_count;
+
+	/**
+	 * Cached weight tables, most recently used first
+	 */
+	libcoopgamma_resample_table_t *tables;
+
+	/**
+	 * Scratch buffer for the input stops converted
+	 * to `double`, their slopes, and output stops
+	 */
+	double *buffer;
+
+	/**
+	 * The number of elements allocated to `buffer`
+	 */
+	size_t buffer_size;
+
+} libcoopgamma_resampler_t;
+
+
 
 /**
  * Initialise a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
@@ -852,73 +1356,239 @@ typedef struct libcoopgamma_async_context {
 	(libcoopgamma_ramps_marshal_((this), (buf), sizeof(*((this)->red))))
 
 /**
- * Unmarshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
- * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` from a buffer
+ * Unmarshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
+ * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` from a buffer
+ * 
+ * @param   this  The output parameter for unmarshalled record
+ * @param   buf   The buffer with the marshalled record
+ * @param   n     Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+#define libcoopgamma_ramps_unmarshal(this, buf, n)\
+	(libcoopgamma_ramps_unmarshal_((this), (buf), (n), sizeof(*((this)->red))))
+
+
+/**
+ * Initialise a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
+ * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t`
+ * 
+ * `this->red_size`, `this->green_size`, and `this->blue_size` must already be set
+ * 
+ * @param   this   The record to initialise
+ * @param   width  The `sizeof(*(this->red))`
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_initialise_(void *restrict, size_t);
+
+/**
+ * Release all resources allocated to  a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`,
+ * `libcoopgamma_ramps32_t`, `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`,
+ * `libcoopgamma_rampsd_t`, or `libcoopgamma_ramps_t`, the allocation of the record
+ * itself is not freed
+ * 
+ * Always call this function after failed call to `libcoopgamma_ramps_initialise`
+ * or failed call to `libcoopgamma_ramps_unmarshal`
+ * 
+ * @param  this  The record to destroy
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_ramps_destroy(void *restrict);
+
+/**
+ * Marshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
+ * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` into a buffer
+ * 
+ * @param   this   The record to marshal
+ * @param   buf    The output buffer, `NULL` to only measure
+ *                 how large this buffer has to be
+ * @param   width  The `sizeof(*(this->red))`
+ * @return         The number of marshalled bytes, or if `buf == NULL`,
+ *                 how many bytes would be marshalled if `buf != NULL`
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1), __leaf__)))
+size_t libcoopgamma_ramps_marshal_(const void *restrict, void *restrict, size_t);
+
+/**
+ * Unmarshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
+ * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` from a buffer
+ * 
+ * @param   this   The output parameter for unmarshalled record
+ * @param   buf    The buffer with the marshalled record
+ * @param   n      Output parameter for the number of unmarshalled bytes, undefined on failure
+ * @param   width  The `sizeof(*(this->red))`
+ * @return         `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
+ *                 `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_unmarshal_(void *restrict, const void *restrict, size_t *restrict, size_t);
+
+/**
+ * Convert a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
+ * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` to
+ * another of these types
+ * 
+ * Integer stops span the entire range of their type, and floating-point
+ * stops span [0, 1]. Values are rounded to nearest, and floating-point
+ * values outside [0, 1] are clamped when converted to integers
+ * 
+ * @param   dst        The output ramps, must already be initialised with
+ *                     the same number of stops in each ramp as `src`
+ * @param   dst_depth  The data type and bit-depth of the ramp stops in `dst`
+ * @param   src        The input ramps
+ * @param   src_depth  The data type and bit-depth of the ramp stops in `src`
+ * @return             Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_convert(void *restrict, libcoopgamma_depth_t, const void *restrict, libcoopgamma_depth_t);
+
+/**
+ * Set gamma ramps to the identity mapping, that is, each
+ * stop is set to its position in its ramp; this is the
+ * starting point for the other ramp generators
+ * 
+ * Integer stops span the entire range of their type, and
+ * floating-point stops span [0, 1]
+ * 
+ * @param   ramps  The gamma ramps, `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`,
+ *                 `libcoopgamma_ramps32_t`, `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`,
+ *                 or `libcoopgamma_rampsd_t`, must already be initialised
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_identity(void *restrict, libcoopgamma_depth_t);
+
+/**
+ * Apply gamma correction to gamma ramps, each stop
+ * is raised to the power of the reciprocal of the
+ * gamma of its ramp
+ * 
+ * @param   ramps  The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The gamma for the red ramp, must be positive
+ * @param   green  The gamma for the green ramp, must be positive
+ * @param   blue   The gamma for the blue ramp, must be positive
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_gamma(void *restrict, libcoopgamma_depth_t, double, double, double);
+
+/**
+ * Adjust the brightness of gamma ramps, each
+ * stop is multiplied by the brightness of its ramp
+ * 
+ * @param   ramps  The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The brightness for the red ramp
+ * @param   green  The brightness for the green ramp
+ * @param   blue   The brightness for the blue ramp
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_brightness(void *restrict, libcoopgamma_depth_t, double, double, double);
+
+/**
+ * Adjust the contrast of gamma ramps, the distance
+ * between each stop and 1/2 is multiplied by the
+ * contrast of its ramp
  * 
- * @param   this  The output parameter for unmarshalled record
- * @param   buf   The buffer with the marshalled record
- * @param   n     Output parameter for the number of unmarshalled bytes, undefined on failure
- * @return        `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * @param   ramps  The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    The contrast for the red ramp
+ * @param   green  The contrast for the green ramp
+ * @param   blue   The contrast for the blue ramp
+ * @return         Zero on success, -1 on error
  */
-#define libcoopgamma_ramps_unmarshal(this, buf, n)\
-	(libcoopgamma_ramps_unmarshal_((this), (buf), (n), sizeof(*((this)->red))))
-
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_contrast(void *restrict, libcoopgamma_depth_t, double, double, double);
 
 /**
- * Initialise a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
- * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t`
+ * Limit the output range of gamma ramps, [0, 1] is
+ * mapped to [minimum, maximum] in each ramp
  * 
- * `this->red_size`, `this->green_size`, and `this->blue_size` must already be set
+ * @param   ramps      The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth      The data type and bit-depth of the ramp stops
+ * @param   red_min    The value 0 shall have in the red ramp
+ * @param   red_max    The value 1 shall have in the red ramp
+ * @param   green_min  The value 0 shall have in the green ramp
+ * @param   green_max  The value 1 shall have in the green ramp
+ * @param   blue_min   The value 0 shall have in the blue ramp
+ * @param   blue_max   The value 1 shall have in the blue ramp
+ * @return             Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_limits(void *restrict, libcoopgamma_depth_t, double, double, double, double, double, double);
+
+/**
+ * Invert gamma ramps, each stop is subtracted from 1
  * 
- * @param   this   The record to initialise
- * @param   width  The `sizeof(*(this->red))`
+ * @param   ramps  The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @param   red    Whether to invert the red ramp
+ * @param   green  Whether to invert the green ramp
+ * @param   blue   Whether to invert the blue ramp
  * @return         Zero on success, -1 on error
  */
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
-int libcoopgamma_ramps_initialise_(void *restrict, size_t);
+int libcoopgamma_ramps_negative(void *restrict, libcoopgamma_depth_t, int, int, int);
 
 /**
- * Release all resources allocated to  a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`,
- * `libcoopgamma_ramps32_t`, `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`,
- * `libcoopgamma_rampsd_t`, or `libcoopgamma_ramps_t`, the allocation of the record
- * itself is not freed
+ * Adjust the white point of gamma ramps to the colour of
+ * a black body, normalised so that 6500 K does not change
+ * the ramps, and scaled so that no ramp is amplified
  * 
- * Always call this function after failed call to `libcoopgamma_ramps_initialise`
- * or failed call to `libcoopgamma_ramps_unmarshal`
+ * @param   ramps   The gamma ramps, see `libcoopgamma_ramps_identity`
+ * @param   depth   The data type and bit-depth of the ramp stops
+ * @param   kelvin  The temperature, in kelvins, values outside
+ *                  [1000, 40000] are clamped to that range
+ * @return          Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_ramps_temperature(void *restrict, libcoopgamma_depth_t, double);
+
+
+/**
+ * Initialise a `libcoopgamma_resampler_t`
  * 
- * @param  this  The record to destroy
+ * @param   this    The record to initialise
+ * @param   method  The method of interpolation
+ * @return          Zero on success, -1 on error
  */
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
-void libcoopgamma_ramps_destroy(void *restrict);
+int libcoopgamma_resampler_initialise(libcoopgamma_resampler_t *restrict, libcoopgamma_interpolation_t);
 
 /**
- * Marshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
- * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` into a buffer
+ * Release all resources allocated to a `libcoopgamma_resampler_t`,
+ * the allocation of the record itself is not freed
  * 
- * @param   this   The record to marshal
- * @param   buf    The output buffer, `NULL` to only measure
- *                 how large this buffer has to be
- * @param   width  The `sizeof(*(this->red))`
- * @return         The number of marshalled bytes, or if `buf == NULL`,
- *                 how many bytes would be marshalled if `buf != NULL`
+ * @param  this  The record to destroy
  */
-LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1), __leaf__)))
-size_t libcoopgamma_ramps_marshal_(const void *restrict, void *restrict, size_t);
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_resampler_destroy(libcoopgamma_resampler_t *restrict);
 
 /**
- * Unmarshal a `libcoopgamma_ramps8_t`, `libcoopgamma_ramps16_t`, `libcoopgamma_ramps32_t`,
- * `libcoopgamma_ramps64_t`, `libcoopgamma_rampsf_t`, or `libcoopgamma_rampsd_t` from a buffer
+ * Resample gamma ramps to other sizes, for example to the sizes
+ * reported in a `libcoopgamma_crtc_info_t`, and convert them to
+ * another type of ramp stops
  * 
- * @param   this   The output parameter for unmarshalled record
- * @param   buf    The buffer with the marshalled record
- * @param   n      Output parameter for the number of unmarshalled bytes, undefined on failure
- * @param   width  The `sizeof(*(this->red))`
- * @return         `LIBCOOPGAMMA_SUCCESS` (0), `LIBCOOPGAMMA_INCOMPATIBLE_DOWNGRADE`,
- *                 `LIBCOOPGAMMA_INCOMPATIBLE_UPGRADE`, or `LIBCOOPGAMMA_ERRNO_SET`
+ * The weights for each pair of input and output ramp sizes are
+ * cached in `resampler`, so resampling to the same sizes again
+ * only needs to interpolate
+ * 
+ * @param   resampler  The resampler
+ * @param   dst        The output ramps, must already be initialised,
+ *                     the ramps may have any number of stops
+ * @param   dst_depth  The data type and bit-depth of the ramp stops in `dst`
+ * @param   src        The input ramps, each ramp with at least one stop
+ *                     unless the corresponding output ramp has no stops
+ * @param   src_depth  The data type and bit-depth of the ramp stops in `src`
+ * @return             Zero on success, -1 on error
  */
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
-int libcoopgamma_ramps_unmarshal_(void *restrict, const void *restrict, size_t *restrict, size_t);
+int libcoopgamma_ramps_resample(libcoopgamma_resampler_t *restrict, void *restrict, libcoopgamma_depth_t,
+                                const void *restrict, libcoopgamma_depth_t);
 
 
 /**
@@ -1225,6 +1895,10 @@ void libcoopgamma_context_destroy(libcoopgamma_context_t *restrict, int);
 /**
  * Marshal a `libcoopgamma_context_t` into a buffer
  * 
+ * Must not be used while `libcoopgamma_synchronise` is receiving
+ * a response directly into ramps registered with
+ * `libcoopgamma_async_context_set_ramps`
+ * 
  * @param   this  The record to marshal
  * @param   buf   The output buffer, `NULL` to only measure
  *                how large this buffer has to be
@@ -1292,6 +1966,54 @@ size_t libcoopgamma_async_context_marshal(const libcoopgamma_async_context_t *re
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
 int libcoopgamma_async_context_unmarshal(libcoopgamma_async_context_t *restrict, const void *restrict, size_t *restrict);
 
+/**
+ * Register caller-owned gamma ramps that the response to a
+ * `libcoopgamma_get_gamma_send` request with coalesced filters
+ * shall be received directly into, rather than first being
+ * buffered in the library state and then copied into a newly
+ * allocated filter table
+ * 
+ * This function must be called before `libcoopgamma_get_gamma_send`,
+ * and the ramps are only used for the next request; they are
+ * unregistered by `libcoopgamma_get_gamma_recv`
+ * 
+ * The ramps must be laid out as by `libcoopgamma_ramps_initialise`,
+ * that is, the green ramp must directly follow the red ramp, and
+ * the blue ramp must directly follow the green ramp. They must not
+ * be freed until the response has been parsed
+ * 
+ * The ramps are only used if the response has exactly their size
+ * and type, or if `depth` was also requested with
+ * `libcoopgamma_async_context_set_depth` and the response has the
+ * same number of stops, in which case the stops are converted into
+ * the ramps; otherwise the response is received as without
+ * registered ramps
+ * 
+ * @param   this   The record to register the ramps with
+ * @param   ramps  The ramps, `NULL` to unregister any ramps
+ * @param   depth  The data type and bit-depth of the ramp stops
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1), __leaf__)))
+int libcoopgamma_async_context_set_ramps(libcoopgamma_async_context_t *restrict, void *restrict, libcoopgamma_depth_t);
+
+/**
+ * Request that the ramp stops in the response to a
+ * `libcoopgamma_get_gamma_send` request be converted
+ * to a specific data type and bit-depth as they are
+ * copied out of the received message
+ * 
+ * This function must be called before `libcoopgamma_get_gamma_send`
+ * 
+ * @param   this   The record to register the data type with
+ * @param   depth  The data type and bit-depth the ramp stops
+ *                 shall be converted to, 0 to return them as
+ *                 sent by the server
+ * @return         Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_async_context_set_depth(libcoopgamma_async_context_t *restrict, libcoopgamma_depth_t);
+
 
 /**
  * List all recognised adjustment method
@@ -1354,14 +2076,38 @@ char *libcoopgamma_get_pid_file(const char *restrict, const char *restrict);
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__malloc__)))
 char *libcoopgamma_get_socket_file(const char *restrict, const char *restrict);
 
+/**
+ * Enable the discovery cache
+ * 
+ * While the cache is enabled, the output of coopgammad is remembered
+ * by `libcoopgamma_get_methods`, `libcoopgamma_get_method_and_site`,
+ * `libcoopgamma_get_pid_file`, and `libcoopgamma_get_socket_file`, so
+ * that coopgammad need not be run again for the same query. Cached
+ * output is discarded when the coopgammad binary is replaced, or when
+ * the user or the display or runtime directory in the environment changes.
+ * 
+ * This function, and the functions that use the cache, are not
+ * thread-safe while the cache is enabled
+ * 
+ * @param   file  The pathname of the file the cache shall be stored in,
+ *                so that it is shared with other processes, `NULL` to
+ *                only keep the cache in memory
+ * @return        Zero on success, -1 on error
+ */
+int libcoopgamma_enable_discovery_cache(const char *restrict);
+
+/**
+ * Disable the discovery cache and forget its content,
+ * the cache file, if any, is left unmodified
+ */
+void libcoopgamma_disable_discovery_cache(void);
+
 
 /**
  * Connect to a coopgamma server, and start it if necessary
  * 
  * Use `libcoopgamma_context_destroy` to disconnect
  * 
- * SIGCHLD must not be ignored or blocked
- * 
  * @param   method  The adjustment method, `NULL` for automatic
  * @param   site    The site, `NULL` for automatic
  * @param   ctx     The state of the library, must be initialised
@@ -1371,6 +2117,56 @@ char *libcoopgamma_get_socket_file(const char *restrict, const char *restrict);
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(3))))
 int libcoopgamma_connect(const char *restrict, const char *restrict, libcoopgamma_context_t *restrict);
 
+/**
+ * Start connecting to a coopgamma server, and start it if necessary,
+ * without blocking
+ * 
+ * Use `libcoopgamma_context_destroy` to disconnect, or to abandon
+ * the connection attempt
+ * 
+ * @param   method   The adjustment method, `NULL` for automatic
+ * @param   site     The site, `NULL` for automatic
+ * @param   ctx      The state of the library, must be initialised
+ * @param   fdp      Output parameter for the file descriptor to wait
+ *                   on if the connection is in progress
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ *                   on `*fdp` if the connection is in progress
+ * @return           Zero on success, -1 on error. If the connection
+ *                   is in progress `errno` is set to EINPROGRESS; wait
+ *                   for `*eventsp` on `*fdp` and then call
+ *                   `libcoopgamma_connect_continue`. If the server is
+ *                   not accepting connections at the moment, `errno` is
+ *                   set to EAGAIN and `*fdp` to -1; call
+ *                   `libcoopgamma_connect_continue` again later. On error,
+ *                   `errno` is set to 0 if the server could not be initialised,
+ *                   and to EALREADY if a connection is already in progress.
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(3, 4, 5))))
+int libcoopgamma_connect_start(const char *restrict, const char *restrict, libcoopgamma_context_t *restrict,
+                               int *restrict, int *restrict);
+
+/**
+ * Continue connecting to a coopgamma server after
+ * `libcoopgamma_connect_start` or `libcoopgamma_connect_continue`
+ * failed with `errno` set to EINPROGRESS
+ * 
+ * @param   ctx      The state of the library
+ * @param   fdp      Output parameter for the file descriptor to wait
+ *                   on if the connection is in progress
+ * @param   eventsp  Output parameter for the `poll` events to wait for
+ *                   on `*fdp` if the connection is in progress
+ * @return           Zero on success, -1 on error. If the connection
+ *                   is still in progress `errno` is set to EINPROGRESS;
+ *                   wait for `*eventsp` on `*fdp` and then call this
+ *                   function again. If the server is not accepting
+ *                   connections at the moment, `errno` is set to EAGAIN
+ *                   and `*fdp` to -1; call this function again later.
+ *                   On error, `errno` is set to 0 if the server could
+ *                   not be initialised.
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
+int libcoopgamma_connect_continue(libcoopgamma_context_t *restrict, int *restrict, int *restrict);
+
 /**
  * By default communication is blocking, this function
  * can be used to switch between blocking and nonblocking
@@ -1389,6 +2185,179 @@ int libcoopgamma_connect(const char *restrict, const char *restrict, libcoopgamm
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
 int libcoopgamma_set_nonblocking(libcoopgamma_context_t *restrict, int);
 
+/**
+ * Limit the time blocking communication may block
+ * 
+ * The limit applies to the total time spent in a call to
+ * `libcoopgamma_flush`, `libcoopgamma_synchronise`,
+ * `libcoopgamma_synchronise_tracked`, a request-sending
+ * function, or a synchronous function. When the limit is
+ * reached, the function fails with ETIMEDOUT; it is safe
+ * to continue with `libcoopgamma_flush` or
+ * `libcoopgamma_synchronise` just like EINTR failure
+ * 
+ * @param   ctx      The state of the library
+ * @param   timeout  The limit in milliseconds, -1 for no limit
+ * @return           Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_set_timeout(libcoopgamma_context_t *restrict, int);
+
+/**
+ * Use, or stop using, io_uring to communicate with the server
+ * 
+ * When io_uring is used, blocking communication waits for and
+ * transfers data with a single system call per transfer, and
+ * the header and payload of a request are sent with linked
+ * requests. io_uring is not used for nonblocking communication
+ * or while the time limit set with `libcoopgamma_set_timeout`
+ * is in effect.
+ * 
+ * @param   ctx     The state of the library
+ * @param   enable  Whether io_uring shall be used
+ * @return          Zero on success, -1 on error. If io_uring
+ *                  is unavailable, `errno` is set to ENOSYS,
+ *                  or another value reported by the kernel,
+ *                  and the context continues to use `poll`,
+ *                  `send` and `recv`
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
+int libcoopgamma_set_io_uring(libcoopgamma_context_t *restrict, int);
+
+/**
+ * Enable or disable thread-safe mode
+ * 
+ * In thread-safe mode, any number of threads may
+ * concurrently call `libcoopgamma_get_crtcs_submit`,
+ * `libcoopgamma_get_gamma_info_submit`,
+ * `libcoopgamma_get_gamma_submit`,
+ * `libcoopgamma_set_gamma_submit`, and
+ * `libcoopgamma_flush`, whilst one thread, and only
+ * that thread, calls `libcoopgamma_dispatch` and any
+ * other function. No thread waits for another: each
+ * request is formatted by the submitting thread and
+ * queued without locking, and the queued requests are
+ * sent by whichever thread finds no other thread
+ * sending; the responses are routed, by message ID,
+ * to the submitted callback functions by the thread
+ * that calls `libcoopgamma_dispatch`
+ * 
+ * In thread-safe mode, the submit functions do not
+ * update `ctx->error` on failure, and a request that
+ * could not be sent immediately remains queued even
+ * if the function fails, just like on EINTR failure
+ * 
+ * Thread-safe mode cannot be used together with
+ * `libcoopgamma_set_timeout`, `libcoopgamma_set_io_uring`,
+ * `libcoopgamma_cork`, `libcoopgamma_set_coalescing`, or
+ * a reactor, requests may only be
+ * sent with the submit functions, and the context must
+ * not be marshalled while in thread-safe mode
+ * 
+ * @param   ctx     The state of the library
+ * @param   enable  Whether thread-safe mode shall be used,
+ *                  when disabling it, no other thread may
+ *                  be using `ctx`
+ * @return          Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
+int libcoopgamma_set_threadsafe(libcoopgamma_context_t *restrict, int);
+
+/**
+ * Enable or disable coalescing of queued set-gamma requests
+ * 
+ * When coalescing is enabled and a set-gamma request is
+ * sent whilst an earlier set-gamma request for the same
+ * CRTC and class is queued, no part of which has been
+ * sent, the earlier request is removed from the queue,
+ * so only the newest ramps are sent. The response to the
+ * newer request is also delivered as the response to the
+ * removed request, so both requests are completed
+ * 
+ * Requests are only queued when communication is
+ * nonblocking and the server does not keep up, or
+ * when `ctx` is corked
+ * 
+ * Coalescing cannot be used in thread-safe mode
+ * 
+ * @param   ctx     The state of the library
+ * @param   enable  Whether requests shall be coalesced
+ * @return          Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_set_coalescing(libcoopgamma_context_t *restrict, int);
+
+/**
+ * Limit the amount of data that may be queued for sending
+ * 
+ * Once `high` bytes are queued, the request-sending functions
+ * fail with ENOBUFS, without queuing anything, until the queue
+ * has been flushed down to `low` bytes. A request is never
+ * refused only because it is larger than `high`
+ * 
+ * The limit does not apply in thread-safe mode
+ * 
+ * @param   ctx   The state of the library
+ * @param   low   The number of queued bytes at or below which
+ *                requests are accepted again
+ * @param   high  The number of queued bytes at or above which
+ *                requests are refused, 0 for no limit
+ * @return        Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_set_watermarks(libcoopgamma_context_t *restrict, size_t, size_t);
+
+/**
+ * Check whether a request would be accepted, or refused
+ * because of the limit set with `libcoopgamma_set_watermarks`
+ * 
+ * @param   ctx  The state of the library
+ * @return       1 if a request would be accepted, 0 otherwise
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_writable(libcoopgamma_context_t *restrict);
+
+/**
+ * Limit the amount of memory used for received data
+ * 
+ * A message whose payload is larger than `max` bytes is
+ * discarded as it is received, and the response-parsing
+ * functions fail with EMSGSIZE when given it; a message
+ * whose headers alone are larger than `max` bytes, or
+ * 4096 bytes if that is greater, is treated as
+ * irrecoverably corrupt
+ * 
+ * When a message is waited for, the buffer for received
+ * data is shrunk to `baseline` bytes if it is larger and
+ * the data received, but not yet parsed, fits
+ * 
+ * @param  ctx       The state of the library
+ * @param  max       The largest payload, in bytes, that
+ *                   is received, 0 for no limit
+ * @param  baseline  The size, in bytes, to shrink the buffer
+ *                   to when it is idle, 0 to never shrink it
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_set_inbound_limits(libcoopgamma_context_t *restrict, size_t, size_t);
+
+/**
+ * Get the amount of memory used for buffering and
+ * book-keeping by a `libcoopgamma_context_t`
+ * 
+ * In thread-safe mode, this function must not be called
+ * while another thread is sending or receiving messages
+ * 
+ * @param   ctx        The state of the library
+ * @param   inboundp   Output parameter for the number of received
+ *                     bytes that have not been parsed, may be `NULL`
+ * @param   outboundp  Output parameter for the number of bytes
+ *                     queued for sending, may be `NULL`
+ * @return             The number of bytes allocated for buffers
+ *                     and tables, not counting the record itself
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1), __leaf__)))
+size_t libcoopgamma_get_buffer_usage(const libcoopgamma_context_t *restrict, size_t *restrict, size_t *restrict);
+
 /**
  * Send all pending outbound data
  * 
@@ -1398,12 +2367,47 @@ int libcoopgamma_set_nonblocking(libcoopgamma_context_t *restrict, int);
  * be in a properly configured state if a function fails
  * with EINTR.
  * 
+ * In thread-safe mode, this function fails with EAGAIN
+ * if another thread is already sending; that thread
+ * will also try to send the requests queued before this call.
+ * 
  * @param   ctx  The state of the library, must be connected
  * @return       Zero on success, -1 on error
  */
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
 int libcoopgamma_flush(libcoopgamma_context_t *restrict);
 
+/**
+ * Stop sending requests to the server immediately,
+ * and instead queue them until `libcoopgamma_uncork`
+ * has been called once for every call to this function
+ * 
+ * This lets any number of requests be sent with a
+ * single system call. `libcoopgamma_synchronise`
+ * will send all queued requests before it waits
+ * for a response, so corking does not change how
+ * responses are received.
+ * 
+ * @param  ctx  The state of the library
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_cork(libcoopgamma_context_t *restrict);
+
+/**
+ * Undo one call to `libcoopgamma_cork`, and if
+ * it was the last unmatched call, send all
+ * queued requests
+ * 
+ * If this function fails, the context is still
+ * uncorked, call `libcoopgamma_flush` to resume
+ * sending the queued requests.
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_uncork(libcoopgamma_context_t *restrict);
+
 /**
  * Wait for the next message to be received
  * 
@@ -1426,6 +2430,53 @@ int libcoopgamma_flush(libcoopgamma_context_t *restrict);
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 4), __leaf__)))
 int libcoopgamma_synchronise(libcoopgamma_context_t *restrict, libcoopgamma_async_context_t *restrict, size_t, size_t *restrict);
 
+/**
+ * Register a request so that `libcoopgamma_synchronise_tracked`
+ * can find it without searching
+ * 
+ * The request shall have been sent (so that its message ID
+ * is set) and `async` must remain valid until the response
+ * is selected by `libcoopgamma_synchronise_tracked` or the
+ * request is unregistered with `libcoopgamma_untrack`
+ * 
+ * @param   ctx     The state of the library
+ * @param   async   Information about the request
+ * @param   cookie  User-defined data to return with `async`
+ * @return          Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 2), __leaf__)))
+int libcoopgamma_track(libcoopgamma_context_t *restrict, libcoopgamma_async_context_t *restrict, void *);
+
+/**
+ * Unregister a request registered with `libcoopgamma_track`
+ * 
+ * @param  ctx    The state of the library
+ * @param  async  Information about the request
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_untrack(libcoopgamma_context_t *restrict, libcoopgamma_async_context_t *restrict);
+
+/**
+ * Wait for the next message to be received, and select
+ * the request, registered with `libcoopgamma_track`,
+ * it is a response to
+ * 
+ * The lookup is done in constant time, regardless of
+ * the number of registered requests, and the selected
+ * request is unregistered
+ * 
+ * @param   ctx     The state of the library, must be connected
+ * @param   asyncp  Output parameter for the request the message is a response to
+ * @param   cookiep Output parameter for the cookie of the request, may be `NULL`
+ * @return          Zero on success, -1 on error. If the the message is ignored,
+ *                  which happens if the request is not registered, -1 is
+ *                  returned and `errno` is set to 0. Otherwise, the errors are
+ *                  the same as for `libcoopgamma_synchronise`.
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 2), __leaf__)))
+int libcoopgamma_synchronise_tracked(libcoopgamma_context_t *restrict, libcoopgamma_async_context_t **restrict,
+                                     void **restrict);
+
 /**
  * Tell the library that you will not be parsing a receive message
  * 
@@ -1482,6 +2533,20 @@ char **libcoopgamma_get_crtcs_recv(libcoopgamma_context_t *restrict, libcoopgamm
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__malloc__, __nonnull__)))
 char **libcoopgamma_get_crtcs_sync(libcoopgamma_context_t *restrict);
 
+/**
+ * List all available CRTC:s, callback version
+ * 
+ * The request is sent, and `callback` is called by
+ * `libcoopgamma_dispatch` when the response is received
+ * 
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 2))))
+int libcoopgamma_get_crtcs_submit(libcoopgamma_context_t *restrict, libcoopgamma_callback_t *, void *);
+
 
 /**
  * Retrieve information about a CRTC:s gamma ramps, send request part
@@ -1529,6 +2594,22 @@ int libcoopgamma_get_gamma_info_recv(libcoopgamma_crtc_info_t *restrict, libcoop
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
 int libcoopgamma_get_gamma_info_sync(const char *restrict, libcoopgamma_crtc_info_t *restrict, libcoopgamma_context_t *restrict);
 
+/**
+ * Retrieve information about a CRTC:s gamma ramps, callback version
+ * 
+ * The request is sent, and `callback` is called by
+ * `libcoopgamma_dispatch` when the response is received
+ * 
+ * @param   crtc      The name of the CRTC
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(2, 3))))
+int libcoopgamma_get_gamma_info_submit(const char *restrict, libcoopgamma_context_t *restrict,
+                                       libcoopgamma_callback_t *, void *);
+
 
 /**
  * Retrieve the current gamma ramp adjustments, send request part
@@ -1548,6 +2629,19 @@ int libcoopgamma_get_gamma_send(const libcoopgamma_filter_query_t *restrict, lib
 /**
  * Retrieve the current gamma ramp adjustments, receive response part
  * 
+ * If the ramps was received directly into the ramps registered
+ * with `libcoopgamma_async_context_set_ramps`, `table->filters`
+ * is set to `NULL` and `table->filter_count` is set to 0, but
+ * the other members of `table` are set
+ * 
+ * If a data type was requested with `libcoopgamma_async_context_set_depth`,
+ * the ramp stops are converted to that type as they are copied out of the
+ * received message, and `table->depth` is set to it
+ * 
+ * Ramps registered with `libcoopgamma_async_context_set_ramps`
+ * and the data type requested with `libcoopgamma_async_context_set_depth`
+ * are unregistered, whether or not the function is successful
+ * 
  * @param   table  Output for the response, must be initialised
  * @param   ctx    The state of the library, must be connected
  * @param   async  Information about the request
@@ -1579,6 +2673,22 @@ int libcoopgamma_get_gamma_sync(const libcoopgamma_filter_query_t *restrict,
                                 libcoopgamma_filter_table_t *restrict,
                                 libcoopgamma_context_t *restrict);
 
+/**
+ * Retrieve the current gamma ramp adjustments, callback version
+ * 
+ * The request is sent, and `callback` is called by
+ * `libcoopgamma_dispatch` when the response is received
+ * 
+ * @param   query     The query to send
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 2, 3))))
+int libcoopgamma_get_gamma_submit(const libcoopgamma_filter_query_t *restrict, libcoopgamma_context_t *restrict,
+                                  libcoopgamma_callback_t *, void *);
+
 
 /**
  * Apply, update, or remove a gamma ramp adjustment, send request part
@@ -1624,6 +2734,128 @@ int libcoopgamma_set_gamma_recv(libcoopgamma_context_t *restrict, libcoopgamma_a
 LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
 int libcoopgamma_set_gamma_sync(const libcoopgamma_filter_t *restrict, libcoopgamma_context_t *restrict);
 
+/**
+ * Apply, update, or remove a gamma ramp adjustment, callback version
+ * 
+ * The request is sent, and `callback` is called by
+ * `libcoopgamma_dispatch` when the response is received
+ * 
+ * @param   filter    The filter to apply, update, or remove, gamma ramp meta-data must match the CRTC's
+ * @param   ctx       The state of the library, must be connected
+ * @param   callback  The function to call with the response
+ * @param   user      User-defined pointer passed to `callback`
+ * @return            Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__(1, 2, 3))))
+int libcoopgamma_set_gamma_submit(const libcoopgamma_filter_t *restrict, libcoopgamma_context_t *restrict,
+                                  libcoopgamma_callback_t *, void *);
+
+/**
+ * Receive and parse all available responses to requests
+ * sent with the callback versions of the request functions,
+ * such as `libcoopgamma_set_gamma_submit`, and call their
+ * callback functions
+ * 
+ * This function never waits for data to be received, it
+ * is intended to be called when `ctx->fd` is readable.
+ * If a response to a request registered with `libcoopgamma_track`
+ * is received, the function returns, leaving the response to be
+ * selected by `libcoopgamma_synchronise_tracked`.
+ * 
+ * If a corrupt response is received, its request's callback function
+ * is called with EBADMSG, if the response has a readable "In response to"
+ * header; otherwise the function fails with EBADMSG and the request
+ * is lost, as is a request registered with `libcoopgamma_track`.
+ * 
+ * @param   ctx  The state of the library, must be connected
+ * @return       The number of callback functions called, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
+int libcoopgamma_dispatch(libcoopgamma_context_t *restrict);
+
+
+/**
+ * Initialise a `libcoopgamma_reactor_t`
+ * 
+ * @param   reactor  The reactor to initialise
+ * @return           Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_reactor_initialise(libcoopgamma_reactor_t *restrict);
+
+/**
+ * Release all resources allocated to a `libcoopgamma_reactor_t`,
+ * the allocation of the record itself, and the contexts added
+ * to the reactor, are not freed
+ * 
+ * @param  reactor  The reactor to destroy
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+void libcoopgamma_reactor_destroy(libcoopgamma_reactor_t *restrict);
+
+/**
+ * Add a context to a reactor
+ * 
+ * The communication of the context is made nonblocking
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library, must be connected
+ *                   and must not already be added to a reactor
+ * @return           Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_reactor_add(libcoopgamma_reactor_t *restrict, libcoopgamma_context_t *restrict);
+
+/**
+ * Remove a context from a reactor
+ * 
+ * The communication of the context remains nonblocking
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library
+ * @return           Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_reactor_remove(libcoopgamma_reactor_t *restrict, libcoopgamma_context_t *restrict);
+
+/**
+ * Update the events a reactor watches a context for
+ * 
+ * Call this function after sending requests on a context
+ * that has been added to a reactor, other than from a
+ * callback called by `libcoopgamma_reactor_run`, so that
+ * the reactor sends the remainder of the requests if
+ * they could not be sent immediately
+ * 
+ * @param   reactor  The reactor
+ * @param   ctx      The state of the library, must be added to `reactor`
+ * @return           Zero on success, -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__, __leaf__)))
+int libcoopgamma_reactor_update(libcoopgamma_reactor_t *restrict, libcoopgamma_context_t *restrict);
+
+/**
+ * Wait for communication on the contexts added to a reactor,
+ * send pending requests, and call the callbacks of the requests,
+ * submitted with functions such as `libcoopgamma_set_gamma_submit`,
+ * whose responses have been received
+ * 
+ * If the connection of a context fails, the context is removed
+ * from the reactor, and the callbacks of all of its submitted
+ * requests are called with `status` set to -1 and `ctx->error`
+ * describing the failure
+ * 
+ * Callbacks must not remove or destroy any context
+ * 
+ * @param   reactor  The reactor
+ * @param   timeout  The maximum number of milliseconds to wait
+ *                   for communication, -1 to wait indefinitely
+ * @return           The number of callbacks that were called,
+ *                   -1 on error
+ */
+LIBCOOPGAMMA_GCC_ONLY(__attribute__((__nonnull__)))
+int libcoopgamma_reactor_run(libcoopgamma_reactor_t *restrict, int);
+
 
 
 #if defined(__clang__)
@@ -5,16 +5,24 @@ MAN3=\
 	libcoopgamma_async_context_destroy.3\
 	libcoopgamma_async_context_initialise.3\
 	libcoopgamma_async_context_marshal.3\
+	libcoopgamma_async_context_set_depth.3\
+	libcoopgamma_async_context_set_ramps.3\
 	libcoopgamma_async_context_unmarshal.3\
 	libcoopgamma_connect.3\
+	libcoopgamma_connect_continue.3\
+	libcoopgamma_connect_start.3\
 	libcoopgamma_context_destroy.3\
 	libcoopgamma_context_initialise.3\
 	libcoopgamma_context_marshal.3\
 	libcoopgamma_context_unmarshal.3\
+	libcoopgamma_cork.3\
 	libcoopgamma_crtc_info_destroy.3\
 	libcoopgamma_crtc_info_initialise.3\
 	libcoopgamma_crtc_info_marshal.3\
 	libcoopgamma_crtc_info_unmarshal.3\
+	libcoopgamma_disable_discovery_cache.3\
+	libcoopgamma_dispatch.3\
+	libcoopgamma_enable_discovery_cache.3\
 	libcoopgamma_error_destroy.3\
 	libcoopgamma_error_initialise.3\
 	libcoopgamma_error_marshal.3\
@@ -32,14 +40,18 @@ MAN3=\
 	libcoopgamma_filter_table_unmarshal.3\
 	libcoopgamma_filter_unmarshal.3\
 	libcoopgamma_flush.3\
+	libcoopgamma_get_buffer_usage.3\
 	libcoopgamma_get_crtcs_recv.3\
 	libcoopgamma_get_crtcs_send.3\
+	libcoopgamma_get_crtcs_submit.3\
 	libcoopgamma_get_crtcs_sync.3\
 	libcoopgamma_get_gamma_info_recv.3\
 	libcoopgamma_get_gamma_info_send.3\
+	libcoopgamma_get_gamma_info_submit.3\
 	libcoopgamma_get_gamma_info_sync.3\
 	libcoopgamma_get_gamma_recv.3\
 	libcoopgamma_get_gamma_send.3\
+	libcoopgamma_get_gamma_submit.3\
 	libcoopgamma_get_gamma_sync.3\
 	libcoopgamma_get_method_and_site.3\
 	libcoopgamma_get_methods.3\
@@ -49,16 +61,45 @@ MAN3=\
 	libcoopgamma_queried_filter_initialise.3\
 	libcoopgamma_queried_filter_marshal.3\
 	libcoopgamma_queried_filter_unmarshal.3\
+	libcoopgamma_ramps_brightness.3\
+	libcoopgamma_ramps_contrast.3\
+	libcoopgamma_ramps_convert.3\
 	libcoopgamma_ramps_destroy.3\
+	libcoopgamma_ramps_gamma.3\
+	libcoopgamma_ramps_identity.3\
 	libcoopgamma_ramps_initialise.3\
+	libcoopgamma_ramps_limits.3\
 	libcoopgamma_ramps_marshal.3\
+	libcoopgamma_ramps_negative.3\
+	libcoopgamma_ramps_resample.3\
+	libcoopgamma_ramps_temperature.3\
 	libcoopgamma_ramps_unmarshal.3\
+	libcoopgamma_reactor_add.3\
+	libcoopgamma_reactor_destroy.3\
+	libcoopgamma_reactor_initialise.3\
+	libcoopgamma_reactor_remove.3\
+	libcoopgamma_reactor_run.3\
+	libcoopgamma_reactor_update.3\
+	libcoopgamma_resampler_destroy.3\
+	libcoopgamma_resampler_initialise.3\
+	libcoopgamma_set_coalescing.3\
 	libcoopgamma_set_gamma_recv.3\
 	libcoopgamma_set_gamma_send.3\
+	libcoopgamma_set_gamma_submit.3\
 	libcoopgamma_set_gamma_sync.3\
+	libcoopgamma_set_inbound_limits.3\
+	libcoopgamma_set_io_uring.3\
 	libcoopgamma_set_nonblocking.3\
+	libcoopgamma_set_threadsafe.3\
+	libcoopgamma_set_timeout.3\
+	libcoopgamma_set_watermarks.3\
 	libcoopgamma_skip_message.3\
-	libcoopgamma_synchronise.3
+	libcoopgamma_synchronise.3\
+	libcoopgamma_synchronise_tracked.3\
+	libcoopgamma_track.3\
+	libcoopgamma_uncork.3\
+	libcoopgamma_untrack.3\
+	libcoopgamma_writable.3
 
 MAN7 =\
 	libcoopgamma.7
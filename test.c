@@ -1,9 +1,15 @@
 /* See LICENSE file for copyright and license details. */
 #include "libcoopgamma.h"
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #ifdef __GNUC__
 # pragma GCC diagnostic ignored "-Wunsuffixed-float-constants"
@@ -49,17 +55,44 @@ rampseq(const libcoopgamma_ramps_t *a, const libcoopgamma_ramps_t *b, libcoopgam
 }
 
 
+static void
+count_response(libcoopgamma_context_t *restrict ctx, int status, void *result, void *user)
+{
+	(void) ctx;
+	if (!status && result)
+		*(size_t *)user += 1;
+}
+
+
 int
 main(void)
 {
 	libcoopgamma_filter_t filter1, filter2;
 	libcoopgamma_crtc_info_t crtc1, crtc2;
 	libcoopgamma_filter_query_t query1, query2;
-	libcoopgamma_filter_table_t table1, table2;
+	libcoopgamma_filter_table_t table1, table2, table3;
 	libcoopgamma_context_t ctx1, ctx2;
 	libcoopgamma_async_context_t async1, async2;
-	size_t n, m, i;
+	libcoopgamma_context_t ctx3;
+	libcoopgamma_async_context_t tracked[40], *trackedp, *many;
+	char **crtcs;
+	libcoopgamma_ramps8_t conv8;
+	libcoopgamma_ramps16_t conv16;
+	libcoopgamma_rampsf_t convf;
+	libcoopgamma_resampler_t resampler;
+	void *cookie;
+	char msg[128];
+	size_t n, m, i, allocations;
 	char *buf;
+	int fds[2];
+	char dir[] = "/tmp/libcoopgamma-test.XXXXXX";
+	char *path;
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	FILE *f;
+	int r, events;
+	unsigned long int id;
+	ssize_t got;
 
 	filter1.priority = INT64_MIN;
 	filter1.crtc = (char []){"CRTC"};
@@ -152,9 +185,28 @@ main(void)
 	ctx1.inbound_size = 9;
 	ctx1.length = 100;
 	ctx1.curline = 5;
+	ctx1.corked = 2;
+	ctx1.headers_end = 4;
+	memset(ctx1.headers, 0, sizeof(ctx1.headers));
+	ctx1.headers[15] = 2;
+	ctx1.duplicate_headers = 1 << 15;
+	ctx1.timeout = 250;
+	ctx1.coalescing = 1;
+	ctx1.redelivering = 1;
+	ctx1.actual_response_to = UINT32_MAX - 2;
+	ctx1.superseded = NULL;
+	ctx1.superseded_count = 0;
+	ctx1.outbound_low = 1;
+	ctx1.outbound_high = 2;
+	ctx1.throttled = 1;
+	ctx1.inbound_max = 3;
+	ctx1.inbound_baseline = 4;
+	ctx1.discard = 5;
+	ctx1.oversized = 1;
 
 	async1.message_id = UINT32_MAX;
 	async1.coalesce = 1;
+	async1.output_depth = LIBCOOPGAMMA_FLOAT;
 
 	n  = libcoopgamma_filter_marshal(&filter1, NULL);
 	n += libcoopgamma_crtc_info_marshal(&crtc1, NULL);
@@ -236,7 +288,23 @@ main(void)
 	    ctx1.message_id != ctx2.message_id ||
 	    ctx1.in_response_to != ctx2.in_response_to ||
 	    ctx1.length != ctx2.length ||
-	    ctx1.curline != ctx2.curline)
+	    ctx1.curline != ctx2.curline ||
+	    ctx1.corked != ctx2.corked ||
+	    ctx1.headers_end != ctx2.headers_end ||
+	    memcmp(ctx1.headers, ctx2.headers, sizeof(ctx1.headers)) ||
+	    ctx1.duplicate_headers != ctx2.duplicate_headers ||
+	    ctx1.timeout != ctx2.timeout ||
+	    ctx1.coalescing != ctx2.coalescing ||
+	    ctx1.redelivering != ctx2.redelivering ||
+	    ctx1.actual_response_to != ctx2.actual_response_to ||
+	    ctx1.superseded_count != ctx2.superseded_count ||
+	    ctx1.outbound_low != ctx2.outbound_low ||
+	    ctx1.outbound_high != ctx2.outbound_high ||
+	    ctx1.throttled != ctx2.throttled ||
+	    ctx1.inbound_max != ctx2.inbound_max ||
+	    ctx1.inbound_baseline != ctx2.inbound_baseline ||
+	    ctx1.discard != ctx2.discard ||
+	    ctx1.oversized != ctx2.oversized)
 		return 13;
 
 	if (ctx2.outbound_head > ctx2.outbound_size ||
@@ -254,9 +322,423 @@ main(void)
 		return 16;
 
 	if (async1.message_id != async2.message_id ||
-	    async1.coalesce != async2.coalesce)
+	    async1.coalesce != async2.coalesce ||
+	    async1.output_depth != async2.output_depth)
 		return 17;
 
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    socketpair(PF_UNIX, SOCK_STREAM, 0, fds))
+		return 18;
+	ctx3.fd = fds[0];
+	if (libcoopgamma_set_gamma_send(&filter1, &ctx3, &async1))
+		return 19;
+	allocations = ctx3.allocations;
+	for (i = 0; i < 64; i++)
+		if (libcoopgamma_set_gamma_send(&filter1, &ctx3, &async1))
+			return 19;
+	if (ctx3.allocations != allocations)
+		return 20;
+	libcoopgamma_cork(&ctx3);
+	for (i = 0; i < 12; i++)
+		if (libcoopgamma_set_gamma_send(&filter1, &ctx3, &async1))
+			return 21;
+	if (ctx3.outbound_head - ctx3.outbound_tail < 12 * sizeof(double[15]))
+		return 21;
+	if (libcoopgamma_uncork(&ctx3) || ctx3.outbound_head != ctx3.outbound_tail)
+		return 22;
+
+	for (i = 0; i < 40; i++) {
+		tracked[i].message_id = (uint32_t)(UINT32_MAX - 20 + i);
+		if (libcoopgamma_track(&ctx3, &tracked[i], &tracked[39 - i]))
+			return 23;
+	}
+	for (i = 40; i--;) {
+		n = (size_t)sprintf(msg, "Command: error\nIn response to: %lu\nError: 0\n\n",
+		                    (unsigned long)tracked[i].message_id);
+		if (write(fds[1], msg, n) != (ssize_t)n)
+			return 24;
+		if (libcoopgamma_synchronise_tracked(&ctx3, &trackedp, &cookie) ||
+		    trackedp != &tracked[i] || cookie != &tracked[39 - i])
+			return 25;
+		libcoopgamma_skip_message(&ctx3);
+	}
+
+	if (libcoopgamma_set_timeout(&ctx3, 50) ||
+	    libcoopgamma_track(&ctx3, &tracked[0], NULL))
+		return 26;
+	if (!libcoopgamma_synchronise_tracked(&ctx3, &trackedp, &cookie) || errno != ETIMEDOUT)
+		return 26;
+	n = (size_t)sprintf(msg, "Command: error\nIn response to: %lu\nError: 0\n\n",
+	                    (unsigned long)tracked[0].message_id);
+	if (write(fds[1], msg, n) != (ssize_t)n ||
+	    libcoopgamma_synchronise_tracked(&ctx3, &trackedp, &cookie) || trackedp != &tracked[0])
+		return 27;
+	libcoopgamma_skip_message(&ctx3);
+	libcoopgamma_context_destroy(&ctx3, 1);
+	close(fds[1]);
+
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    socketpair(PF_UNIX, SOCK_STREAM, 0, fds) ||
+	    libcoopgamma_set_coalescing(&ctx3, 1))
+		return 28;
+	ctx3.fd = fds[0];
+	libcoopgamma_cork(&ctx3);
+	for (i = 0; i < 3; i++) {
+		if (libcoopgamma_set_gamma_send(&filter1, &ctx3, &tracked[i]))
+			return 28;
+		if (!i)
+			n = ctx3.outbound_head - ctx3.outbound_tail;
+	}
+	if (ctx3.outbound_head - ctx3.outbound_tail != n || libcoopgamma_uncork(&ctx3))
+		return 28;
+	n = (size_t)sprintf(msg, "Command: error\nIn response to: %lu\nError: 0\n\n",
+	                    (unsigned long)tracked[2].message_id);
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 29;
+	for (m = 0; m < 3; m++) {
+		if (libcoopgamma_synchronise(&ctx3, tracked, 3, &i) ||
+		    libcoopgamma_set_gamma_recv(&ctx3, &tracked[i]) ||
+		    tracked[i].message_id == UINT32_MAX)
+			return 29;
+		tracked[i].message_id = UINT32_MAX;
+	}
+
+	libcoopgamma_cork(&ctx3);
+	if (libcoopgamma_set_watermarks(&ctx3, 0, 2 * n) || !libcoopgamma_writable(&ctx3))
+		return 30;
+	for (i = 0; libcoopgamma_writable(&ctx3); i++)
+		if (libcoopgamma_get_crtcs_send(&ctx3, &async1))
+			return 30;
+	if (!i || !libcoopgamma_get_crtcs_send(&ctx3, &async1) || errno != ENOBUFS)
+		return 30;
+	if (libcoopgamma_uncork(&ctx3) || !libcoopgamma_writable(&ctx3))
+		return 30;
+
+	libcoopgamma_set_inbound_limits(&ctx3, 16, 0);
+	tracked[0].message_id = 1000;
+	tracked[1].message_id = 1001;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: 1000\nLength: 100\n\n");
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 31;
+	memset(msg, 'x', 100);
+	if (write(fds[1], msg, 100) != 100)
+		return 31;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: 1001\nLength: 5\n\nCRTC\n");
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 31;
+	if (libcoopgamma_synchronise(&ctx3, tracked, 2, &i) || i != 0 ||
+	    libcoopgamma_get_crtcs_recv(&ctx3, &tracked[0]) || ctx3.error.number != EMSGSIZE)
+		return 31;
+	if (libcoopgamma_synchronise(&ctx3, tracked, 2, &i) || i != 1 ||
+	    !(crtcs = libcoopgamma_get_crtcs_recv(&ctx3, &tracked[1])) ||
+	    !crtcs[0] || strcmp(crtcs[0], "CRTC") || crtcs[1])
+		return 31;
+	free(crtcs);
+	if (libcoopgamma_set_nonblocking(&ctx3, 1))
+		return 31;
+	tracked[0].message_id = 1002;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: 1002\nLength: 5\n\nCRTC\n");
+	if (write(fds[1], msg, 30) != 30)
+		return 31;
+	if (!libcoopgamma_synchronise(&ctx3, tracked, 1, &i) ||
+	    (errno != EAGAIN && errno != EWOULDBLOCK))
+		return 31;
+	if (write(fds[1], &msg[30], n - 30) != (ssize_t)(n - 30))
+		return 31;
+	if (libcoopgamma_synchronise(&ctx3, tracked, 1, &i) || i != 0 ||
+	    !(crtcs = libcoopgamma_get_crtcs_recv(&ctx3, &tracked[0])) ||
+	    !crtcs[0] || strcmp(crtcs[0], "CRTC") || crtcs[1])
+		return 31;
+	free(crtcs);
+	if (libcoopgamma_set_nonblocking(&ctx3, 0))
+		return 31;
+	if (!libcoopgamma_get_buffer_usage(&ctx3, &m, &n) || m || n)
+		return 31;
+
+	conv16.red_size = 2;
+	conv16.green_size = conv16.blue_size = 1;
+	convf.red_size = 2;
+	convf.green_size = convf.blue_size = 1;
+	conv8.red_size = 2;
+	conv8.green_size = conv8.blue_size = 1;
+	if (libcoopgamma_ramps_initialise(&conv16) ||
+	    libcoopgamma_ramps_initialise(&convf) ||
+	    libcoopgamma_ramps_initialise(&conv8))
+		return 32;
+	conv16.red[0] = 0;
+	conv16.red[1] = UINT16_MAX;
+	conv16.green[0] = 0x8080;
+	conv16.blue[0] = 0x807F;
+	if (libcoopgamma_ramps_convert(&conv8, LIBCOOPGAMMA_UINT8, &conv16, LIBCOOPGAMMA_UINT16) ||
+	    conv8.red[0] != 0 || conv8.red[1] != UINT8_MAX || conv8.green[0] != 0x80 || conv8.blue[0] != 0x80)
+		return 32;
+	if (libcoopgamma_ramps_convert(&conv16, LIBCOOPGAMMA_UINT16, &conv8, LIBCOOPGAMMA_UINT8) ||
+	    conv16.red[1] != UINT16_MAX || conv16.green[0] != 0x8080)
+		return 32;
+	convf.red[0] = -1;
+	convf.red[1] = 2;
+	convf.green[0] = 0.5f;
+	convf.blue[0] = 0;
+	if (libcoopgamma_ramps_convert(&conv8, LIBCOOPGAMMA_UINT8, &convf, LIBCOOPGAMMA_FLOAT) ||
+	    conv8.red[0] != 0 || conv8.red[1] != UINT8_MAX || conv8.green[0] != 128 || conv8.blue[0] != 0)
+		return 32;
+	conv8.red_size = 1;
+	if (!libcoopgamma_ramps_convert(&conv8, LIBCOOPGAMMA_UINT8, &convf, LIBCOOPGAMMA_FLOAT) || errno != EINVAL)
+		return 32;
+	libcoopgamma_ramps_destroy(&conv8);
+	libcoopgamma_ramps_destroy(&conv16);
+	libcoopgamma_ramps_destroy(&convf);
+
+	if (libcoopgamma_filter_table_initialise(&table3) ||
+	    libcoopgamma_async_context_initialise(&tracked[0]) ||
+	    !libcoopgamma_async_context_set_depth(&tracked[0], 12) || errno != EINVAL ||
+	    libcoopgamma_async_context_set_depth(&tracked[0], LIBCOOPGAMMA_DOUBLE) ||
+	    libcoopgamma_get_gamma_send(&query1, &ctx3, &tracked[0]))
+		return 33;
+	n = (size_t)sprintf(msg, "Command: gamma\nIn response to: %lu\nDepth: 16\nRed size: 2\n"
+	                         "Green size: 1\nBlue size: 1\nLength: 8\n\n",
+	                    (unsigned long)tracked[0].message_id);
+	memcpy(&msg[n], (uint16_t []){0, UINT16_MAX, 0x8080, 1}, 8);
+	if (write(fds[1], msg, n + 8) != (ssize_t)(n + 8))
+		return 33;
+	if (libcoopgamma_synchronise(&ctx3, tracked, 1, &i) ||
+	    libcoopgamma_get_gamma_recv(&table3, &ctx3, &tracked[0]) ||
+	    table3.depth != LIBCOOPGAMMA_DOUBLE || table3.filter_count != 1 ||
+	    table3.filters->ramps.d.red[0] != 0 || table3.filters->ramps.d.red[1] != 1 ||
+	    table3.filters->ramps.d.green[0] != 0x8080 / (double)UINT16_MAX ||
+	    table3.filters->ramps.d.blue[0] != 1 / (double)UINT16_MAX)
+		return 33;
+	libcoopgamma_filter_table_destroy(&table3);
+	libcoopgamma_context_destroy(&ctx3, 1);
+	close(fds[1]);
+
+	conv8.red_size = conv8.green_size = conv8.blue_size = 256;
+	if (libcoopgamma_ramps_initialise(&conv8) ||
+	    libcoopgamma_ramps_identity(&conv8, LIBCOOPGAMMA_UINT8) ||
+	    conv8.red[0] != 0 || conv8.red[128] != 128 || conv8.blue[255] != 255)
+		return 34;
+	if (libcoopgamma_ramps_gamma(&conv8, LIBCOOPGAMMA_UINT8, 0.5, 1, 1) ||
+	    libcoopgamma_ramps_negative(&conv8, LIBCOOPGAMMA_UINT8, 0, 1, 0) ||
+	    libcoopgamma_ramps_temperature(&conv8, LIBCOOPGAMMA_UINT8, 6500) ||
+	    conv8.red[128] != 64 || conv8.red[255] != 255 ||
+	    conv8.green[0] != 255 || conv8.green[255] != 0 || conv8.blue[128] != 128)
+		return 34;
+	if (!libcoopgamma_ramps_gamma(&conv8, LIBCOOPGAMMA_UINT8, 0, 1, 1) || errno != EINVAL)
+		return 34;
+	libcoopgamma_ramps_destroy(&conv8);
+
+	conv8.red_size = conv8.green_size = conv8.blue_size = 2;
+	conv16.red_size = conv16.green_size = conv16.blue_size = 256;
+	if (libcoopgamma_resampler_initialise(&resampler, LIBCOOPGAMMA_MONOTONE_CUBIC) ||
+	    libcoopgamma_ramps_initialise(&conv8) ||
+	    libcoopgamma_ramps_initialise(&conv16) ||
+	    libcoopgamma_ramps_identity(&conv8, LIBCOOPGAMMA_UINT8))
+		return 35;
+	for (i = 0; i < 2; i++)
+		if (libcoopgamma_ramps_resample(&resampler, &conv16, LIBCOOPGAMMA_UINT16, &conv8, LIBCOOPGAMMA_UINT8) ||
+		    conv16.red[0] != 0 || conv16.green[128] != 128 * 257 || conv16.blue[255] != UINT16_MAX)
+			return 35;
+	if (resampler.table_count != 1)
+		return 35;
+	conv8.green_size = 0;
+	if (!libcoopgamma_ramps_resample(&resampler, &conv16, LIBCOOPGAMMA_UINT16, &conv8, LIBCOOPGAMMA_UINT8) ||
+	    errno != EINVAL)
+		return 35;
+	libcoopgamma_resampler_destroy(&resampler);
+	libcoopgamma_ramps_destroy(&conv8);
+	libcoopgamma_ramps_destroy(&conv16);
+
+	conv16.red_size = 2;
+	conv16.green_size = conv16.blue_size = 1;
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    socketpair(PF_UNIX, SOCK_STREAM, 0, fds) ||
+	    libcoopgamma_filter_table_initialise(&table3) ||
+	    libcoopgamma_ramps_initialise(&conv16))
+		return 36;
+	ctx3.fd = fds[0];
+	for (m = 0; m < 2; m++) {
+		if ((!m && (libcoopgamma_async_context_initialise(&tracked[0]) ||
+		            libcoopgamma_async_context_set_ramps(&tracked[0], &conv16, LIBCOOPGAMMA_UINT16))) ||
+		    libcoopgamma_get_gamma_send(&query1, &ctx3, &tracked[0]))
+			return 36;
+		n = (size_t)sprintf(msg, "Command: gamma\nIn response to: %lu\nDepth: 16\nRed size: 2\n"
+		                         "Green size: 1\nBlue size: 1\nLength: 8\n\n",
+		                    (unsigned long)tracked[0].message_id);
+		memcpy(&msg[n], (uint16_t []){0, UINT16_MAX, 0x8080, 1}, 8);
+		if (write(fds[1], msg, n + 8) != (ssize_t)(n + 8) ||
+		    libcoopgamma_synchronise(&ctx3, tracked, 1, &i) ||
+		    (ctx3.divert == (void *)conv16.red) != !m ||
+		    libcoopgamma_get_gamma_recv(&table3, &ctx3, &tracked[0]) ||
+		    tracked[0].ramps || table3.filter_count != (size_t)m)
+			return 36;
+		if (!m && (table3.filters || conv16.red[1] != UINT16_MAX || conv16.blue[0] != 1))
+			return 36;
+		if (m && table3.filters->ramps.u16.green[0] != 0x8080)
+			return 36;
+	}
+	libcoopgamma_filter_table_destroy(&table3);
+	libcoopgamma_ramps_destroy(&conv16);
+	libcoopgamma_context_destroy(&ctx3, 1);
+	close(fds[1]);
+
+	m = 0;
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    socketpair(PF_UNIX, SOCK_STREAM, 0, fds))
+		return 37;
+	ctx3.fd = fds[0];
+	if (libcoopgamma_get_crtcs_send(&ctx3, &tracked[0]) ||
+	    libcoopgamma_track(&ctx3, &tracked[0], &m) ||
+	    libcoopgamma_get_crtcs_submit(&ctx3, count_response, &m))
+		return 37;
+	for (i = 0; i < 2; i++) {
+		n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: %lu\nLength: 5\n\nCRTC\n",
+		                    (unsigned long)tracked[0].message_id + i);
+		if (write(fds[1], msg, n) != (ssize_t)n)
+			return 37;
+	}
+	if (libcoopgamma_dispatch(&ctx3) || m || libcoopgamma_dispatch(&ctx3) ||
+	    libcoopgamma_synchronise_tracked(&ctx3, &trackedp, &cookie) || trackedp != &tracked[0] || cookie != &m ||
+	    !(crtcs = libcoopgamma_get_crtcs_recv(&ctx3, trackedp)) || !crtcs[0] || strcmp(crtcs[0], "CRTC"))
+		return 37;
+	free(crtcs);
+	if (libcoopgamma_dispatch(&ctx3) != 1 || m != 1)
+		return 37;
+	if (libcoopgamma_get_gamma_info_submit("a\nb", &ctx3, count_response, &m) != -1 ||
+	    ctx3.error.number != EINVAL ||
+	    libcoopgamma_get_crtcs_submit(&ctx3, count_response, &m))
+		return 37;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: %lu\nLength: 5\n\nCRTC\n",
+	                    (unsigned long)tracked[0].message_id + 2);
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 37;
+	if (libcoopgamma_dispatch(&ctx3) != 1 || m != 2)
+		return 37;
+	if (libcoopgamma_get_crtcs_submit(&ctx3, count_response, &m))
+		return 37;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: %lu\nX: @\nLength: 5\n\nCRTC\n",
+	                    (unsigned long)tracked[0].message_id + 3);
+	*strchr(msg, '@') = '\0';
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 37;
+	if (libcoopgamma_dispatch(&ctx3) != 1 || m != 2 || ctx3.error.number != EBADMSG)
+		return 37;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: %lu\nLength: 5\n\nCRTC\n",
+	                    (unsigned long)tracked[0].message_id + 3);
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 37;
+	if (libcoopgamma_dispatch(&ctx3) || m != 2)
+		return 37;
+	n = (size_t)sprintf(msg, "Command: crtc-enumeration\nX: @\nLength: 5\n\nCRTC\n");
+	*strchr(msg, '@') = '\0';
+	if (write(fds[1], msg, n) != (ssize_t)n)
+		return 37;
+	if (libcoopgamma_dispatch(&ctx3) != -1 || errno != EBADMSG)
+		return 37;
+	libcoopgamma_context_destroy(&ctx3, 1);
+	close(fds[1]);
+
+	tracked[0].message_id = 0;
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    libcoopgamma_track(&ctx3, &tracked[0], NULL))
+		return 38;
+	for (i = 1; i < 100000; i++) {
+		tracked[1].message_id = (uint32_t)i;
+		if (libcoopgamma_track(&ctx3, &tracked[1], NULL))
+			return 38;
+		libcoopgamma_untrack(&ctx3, &tracked[1]);
+	}
+	if (ctx3.inflight_mask > 15)
+		return 38;
+	many = calloc(100000, sizeof(*many));
+	if (!many)
+		return 38;
+	for (i = 0; i < 100000; i++) {
+		many[i].message_id = (uint32_t)(i + 1);
+		if (libcoopgamma_track(&ctx3, &many[i], NULL))
+			break;
+	}
+	if (i == 100000 || errno != ENOBUFS)
+		return 38;
+	free(many);
+	libcoopgamma_context_destroy(&ctx3, 0);
+
+	path = getenv("PATH");
+	if (!mkdtemp(dir) || !(path = strdup(path ? path : "")) || setenv("PATH", dir, 1))
+		return 39;
+	addr.sun_family = AF_UNIX;
+	sprintf(addr.sun_path, "%s/coopgammad", dir);
+	f = fopen(addr.sun_path, "w");
+	if (!f || fprintf(f, "#!/bin/sh\necho %s/socket\n", dir) < 0 || fclose(f) || chmod(addr.sun_path, 0755))
+		return 39;
+	sprintf(addr.sun_path, "%s/socket", dir);
+	fds[0] = socket(PF_UNIX, SOCK_STREAM, 0);
+	fds[1] = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fds[0] < 0 || fds[1] < 0 ||
+	    bind(fds[0], (struct sockaddr *)&addr, (socklen_t)sizeof(addr)) ||
+	    listen(fds[0], 0) ||
+	    connect(fds[1], (struct sockaddr *)&addr, (socklen_t)sizeof(addr)))
+		return 39;
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    !libcoopgamma_connect_start(NULL, NULL, &ctx3, &pfd.fd, &events) || errno != EINPROGRESS ||
+	    !libcoopgamma_connect_start(NULL, NULL, &ctx3, &pfd.fd, &events) || errno != EALREADY)
+		return 39;
+	do {
+		pfd.events = (short)events;
+		if (poll(&pfd, 1, -1) < 0)
+			return 39;
+	} while ((r = libcoopgamma_connect_continue(&ctx3, &pfd.fd, &events)) && errno == EINPROGRESS);
+	if (!r || errno != EAGAIN || pfd.fd != -1 || ctx3.fd < 0)
+		return 39;
+	close(fds[1]);
+	if ((fds[1] = accept(fds[0], NULL, NULL)) < 0 ||
+	    libcoopgamma_connect_continue(&ctx3, &pfd.fd, &events) ||
+	    !libcoopgamma_connect_continue(&ctx3, &pfd.fd, &events) || errno != EINVAL)
+		return 39;
+	close(fds[1]);
+	if ((fds[1] = accept(fds[0], NULL, NULL)) < 0)
+		return 39;
+	close(fds[1]);
+	close(fds[0]);
+	libcoopgamma_context_destroy(&ctx3, 1);
+	unlink(addr.sun_path);
+	sprintf(addr.sun_path, "%s/coopgammad", dir);
+	unlink(addr.sun_path);
+	rmdir(dir);
+	setenv("PATH", path, 1);
+	free(path);
+
+	m = 0;
+	if (libcoopgamma_context_initialise(&ctx3) ||
+	    socketpair(PF_UNIX, SOCK_STREAM, 0, fds))
+		return 40;
+	ctx3.fd = fds[0];
+	if (libcoopgamma_set_threadsafe(&ctx3, 1) ||
+	    !libcoopgamma_set_timeout(&ctx3, 10) || errno != EINVAL ||
+	    !libcoopgamma_set_coalescing(&ctx3, 1) || errno != EINVAL ||
+	    !libcoopgamma_set_io_uring(&ctx3, 1) || (errno != EINVAL && errno != ENOSYS))
+		return 40;
+	for (i = 0; i < 2; i++) {
+		if (libcoopgamma_get_crtcs_submit(&ctx3, count_response, &m))
+			return 40;
+		got = read(fds[1], msg, sizeof(msg) - 1);
+		if (got <= 0)
+			return 40;
+		msg[got] = '\0';
+		if (sscanf(msg, "Command: enumerate-crtcs\nMessage ID: %lu\n\n", &id) != 1 || id != i)
+			return 40;
+		n = (size_t)sprintf(msg, "Command: crtc-enumeration\nIn response to: %lu\nLength: 5\n\nCRTC\n", id);
+		if (write(fds[1], msg, n) != (ssize_t)n)
+			return 40;
+		if (i && libcoopgamma_set_threadsafe(&ctx3, 0))
+			return 40;
+		if (libcoopgamma_dispatch(&ctx3) != 1 || m != i + 1)
+			return 40;
+	}
+	if (libcoopgamma_set_timeout(&ctx3, -1))
+		return 40;
+	libcoopgamma_context_destroy(&ctx3, 1);
+	close(fds[1]);
+
 	libcoopgamma_context_destroy(&ctx2, 1);
 	libcoopgamma_filter_destroy(&filter2);
 	libcoopgamma_filter_query_destroy(&query2);